@@ -10,6 +10,7 @@ message(STATUS "compiler is ${CMAKE_COMPILER_IS_GNUCXX}")
 set(CXX_FLAGS
  -DCHECK_PTHREAD_RETURN_VALUE
  -D_FILE_OFFSET_BITS=64
+ -DFERMAT_MIN_LOG_LEVEL=${FERMAT_MIN_LOG_LEVEL}
  -Wall
  -Wextra
  -Werror
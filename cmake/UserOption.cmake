@@ -8,6 +8,17 @@ option (FMT_DEBUG "if using debug mode" ON)
 ###################################
 option (enable_dynamic "if using debug mode" ON)
 
+###################################
+#LOG_* sites below this level compile to nothing
+#0 TRACE 1 DEBUG 2 INFO 3 WARN 4 ERROR
+###################################
+set (FERMAT_MIN_LOG_LEVEL 0 CACHE STRING "lowest log level compiled in")
+
+###################################
+#gzip rolled log files (LogCompressor) when zlib is found
+###################################
+option (with_zlib "compress rolled log files with zlib" ON)
+
 ##########################################
 #install path
 #header ~/include
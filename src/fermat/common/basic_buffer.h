@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <algorithm>
 #include <cstring>
+#include <memory>
 
 namespace fermat {
 
@@ -0,0 +1,80 @@
+#include <fermat/common/hazard_pointer.h>
+#include <fermat/common/this_thread.h>
+
+namespace fermat {
+
+namespace detail {
+
+static std::atomic<HazardRecord*> g_hazard_records(NULL);
+
+__thread HazardRecord *t_hazard_record = NULL;
+// set once the thread gave its record back
+static __thread bool t_hazard_released = false;
+
+// gives the record back when the thread exits
+struct HazardRelease {
+    ~HazardRelease()
+    {
+        if (t_hazard_record) {
+            t_hazard_record->active.store(false, std::memory_order_release);
+            t_hazard_record = NULL;
+        }
+        t_hazard_released = true;
+    }
+};
+
+static thread_local HazardRelease t_hazard_release;
+
+HazardRecord* hazard_record()
+{
+    if (t_hazard_released) {
+        return NULL;
+    }
+    HazardRecord *rec = g_hazard_records.load(std::memory_order_acquire);
+    for (; rec; rec = rec->next) {
+        bool expect = false;
+        if (!rec->active.load(std::memory_order_relaxed) &&
+            rec->active.compare_exchange_strong(expect, true,
+                                                std::memory_order_acquire)) {
+            break;
+        }
+    }
+    if (!rec) {
+        rec = new HazardRecord();
+        HazardRecord *head = g_hazard_records.load(std::memory_order_relaxed);
+        do {
+            rec->next = head;
+        } while (!g_hazard_records.compare_exchange_weak(head, rec,
+                                                         std::memory_order_release,
+                                                         std::memory_order_relaxed));
+    }
+    rec->depth = 0;
+    t_hazard_record = rec;
+    // odr-use so the thread_local is constructed on this thread
+    (void)&t_hazard_release;
+    return rec;
+}
+
+}
+
+bool is_hazard(const void *p)
+{
+    detail::HazardRecord *rec = detail::g_hazard_records.load(std::memory_order_acquire);
+    for (; rec; rec = rec->next) {
+        for (int i = 0; i < detail::HazardRecord::kSlots; ++i) {
+            if (rec->slots[i].load(std::memory_order_seq_cst) == p) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void hazard_wait(const void *p)
+{
+    while (is_hazard(p)) {
+        this_thread::yield();
+    }
+}
+
+}
@@ -0,0 +1,110 @@
+#ifndef FERMAT_COMMON_HAZARD_POINTER_H_
+#define FERMAT_COMMON_HAZARD_POINTER_H_
+#include <atomic>
+#include <cstddef>
+
+namespace fermat {
+
+namespace detail {
+
+/*!
+* The hazard slots of one thread. Records are linked into one
+* global list and never freed; a thread takes a free record on
+* its first use and gives it back when it exits.
+*/
+struct HazardRecord {
+    static const int kSlots = 4;
+
+    HazardRecord() : active(true), depth(0), next(NULL)
+    {
+        for (int i = 0; i < kSlots; ++i) {
+            slots[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<const void*>  slots[kSlots];
+    std::atomic<bool>         active;
+    int                       depth;   //!< slots in use, owner thread only
+    HazardRecord             *next;
+};
+
+/*!
+* @return the record of the calling thread, NULL while the
+* thread exits.
+*/
+HazardRecord* hazard_record();
+
+extern __thread HazardRecord *t_hazard_record;
+
+}
+
+/*!
+* Reads a pointer published in an atomic and keeps the object
+* alive until the guard goes out of scope: a writer that
+* replaced the pointer calls hazard_wait() before it frees the
+* old object. Taking and dropping the guard writes only the
+* calling thread's own record, so readers on many cores share
+* no cache line but the one the pointer is published in.
+* get() is NULL if the thread has no free slot, when guards
+* nest too deep or the thread is exiting; the caller must then
+* fall back to a locked path.
+*/
+template <typename T>
+class HazardPtr {
+public:
+    explicit HazardPtr(const std::atomic<T*> &src)
+        : _slot(NULL), _ptr(NULL)
+    {
+        detail::HazardRecord *rec = detail::t_hazard_record;
+        if (__builtin_expect(!rec, 0)) {
+            rec = detail::hazard_record();
+        }
+        if (!rec || rec->depth >= detail::HazardRecord::kSlots) {
+            return;
+        }
+        _slot = &rec->slots[rec->depth++];
+        T *p = src.load(std::memory_order_relaxed);
+        while (true) {
+            // the seq_cst store and load pair with hazard_wait()
+            _slot->store(p, std::memory_order_seq_cst);
+            T *q = src.load(std::memory_order_seq_cst);
+            if (q == p) {
+                break;
+            }
+            p = q;
+        }
+        _ptr = p;
+    }
+
+    ~HazardPtr()
+    {
+        if (_slot) {
+            _slot->store(NULL, std::memory_order_release);
+            --detail::t_hazard_record->depth;
+        }
+    }
+
+    T* get() const { return _ptr; }
+    T* operator->() const { return _ptr; }
+    bool acquired() const { return _slot != NULL; }
+private:
+    HazardPtr(const HazardPtr&);
+    HazardPtr& operator=(const HazardPtr&);
+
+    std::atomic<const void*> *_slot;
+    T                        *_ptr;
+};
+
+/*!
+* @return true if a HazardPtr of any thread holds p.
+*/
+bool is_hazard(const void *p);
+
+/*!
+* Waits until no HazardPtr holds p. Call it after the pointer
+* to p was replaced in its atomic and before p is freed.
+*/
+void hazard_wait(const void *p);
+
+}
+#endif
@@ -1,144 +1,880 @@
 #include <fermat/common/log_async.h>
+#include <fermat/common/this_thread.h>
+#include <fermat/common/clock.h>
+#include <fermat/common/log_crash.h>
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
 
 namespace fermat {
+
+namespace detail {
+
+// the rings a thread holds, given back when the thread exits
+struct ThreadRings {
+    typedef std::pair<uint64_t, std::shared_ptr<LogRing> > Ref;
+
+    ~ThreadRings()
+    {
+        for (size_t i = 0; i < refs.size(); ++i) {
+            refs[i].second->owned.store(false, std::memory_order_release);
+        }
+    }
+
+    std::vector<Ref> refs;
+};
+
+thread_local ThreadRings t_rings;
+
+// per-thread cache of the rings this thread owns, keyed by LogAsync id
+struct RingSlot {
+    uint64_t  owner;
+    SpscRing *ring;
+};
+static const int kRingSlots = 8;
+__thread RingSlot t_ring_slots[kRingSlots];
+__thread int      t_ring_next = 0;
+
+std::atomic<uint64_t> g_async_id(0);
+
+}
+
 LogAsync::LogAsync(const std::string &baseName,
              size_t rollSize,
-             int flushInterval)
+             int flushInterval,
+             QueueMode mode)
     : LogOutput("async_log"),
       _flush_interval(flushInterval),
+      _mode(mode),
+      _id(++detail::g_async_id),
       _is_running(false),
       _base_name(baseName),
       _roll_size(rollSize),
       _state(0),
       _mutex(),
       _cond(),
-      _current_buffer(new Buffer()),
-      _next_buffer(new Buffer()),
+      _current_buffer(NULL),
+      _next_buffer(NULL),
       _buffers(),
+      _queued_lines(0),
+      _current_lines(0),
+      _ring_size(kDefaultRingSize),
+      _ring_wakeup(false),
+      _ring_mutex(),
+      _rings(),
+      _ring_head(NULL),
+      _drain_buffer(),
+      _binary(false),
+      _decoder(),
+      _decode_buffer(),
+      _iov(),
+      _overflow_policy(eOverflowDrop),
+      _max_buffer_bytes(kDefaultMaxBufferBytes),
+      _buffer_size(kDefaultBufferSize),
+      _huge_pages(false),
+      _pool(),
+      _space_cond(),
+      _dropped_bytes(0),
+      _dropped_lines(0),
+      _overflow(baseName, rollSize),
+      _roll_listener(),
+      _crash_file(NULL),
+      _schedule(flushInterval),
+      _priority_level(Logging::eERROR),
+      _urgent_buffer(NULL),
+      _urgent_buffers(),
+      _urgent_lines(0),
+      _urgent_pending(false),
+      _urgent_drain(),
+      _dedup_window(0),
+      _dedup(),
+      _dedup_iov(),
+      _sequence(false),
+      _sequence_next(0),
+      _counters(),
       _thread("async-log")
 {
-    _current_buffer->bzero();
-    _next_buffer->bzero();
-    _buffers.reserve(16);
+    _iov.reserve(16);
 }
 
 LogAsync::~LogAsync()
 {
+}
+
+void LogAsync::set_ring_size(size_t size)
+{
+    _ring_size = size;
+}
+
+void LogAsync::set_overflow_policy(OverflowPolicy policy)
+{
+    _overflow_policy = policy;
+}
+
+void LogAsync::set_max_buffer_bytes(size_t bytes)
+{
+    _max_buffer_bytes = bytes;
+}
+
+void LogAsync::set_buffer_size(size_t size)
+{
+    _buffer_size = size;
+}
+
+void LogAsync::set_huge_pages(bool on)
+{
+    _huge_pages = on;
+}
+
+void LogAsync::set_binary(bool on)
+{
+    _binary = on;
+}
+
+void LogAsync::set_roll_listener(const LogRollListener &listener)
+{
+    _roll_listener = listener;
+}
+
+void LogAsync::set_report_interval(Timespan interval)
+{
+    _schedule.set_report_interval(interval);
+}
+
+void LogAsync::set_sync_policy(const LogSyncPolicy &policy)
+{
+    _schedule.set_sync_policy(policy);
+}
+
+void LogAsync::set_dedup_window(Timespan window)
+{
+    _dedup_window = window;
+}
+
+void LogAsync::set_sequence(bool on)
+{
+    _sequence = on;
+}
+
+void LogAsync::set_priority_level(Logging::LogLevel level)
+{
+    _priority_level = level;
+}
+
+LogAsyncStats LogAsync::stats()
+{
+    LogAsyncStats s;
+    _counters.copy_to(&s);
+    s.queued_buffers = 0;
+    s.queued_bytes = 0;
+    s.extra_buffers = 0;
+    if (_mode == eThreadRing) {
+        detail::LogRing *r = _ring_head.load(std::memory_order_acquire);
+        for (; r; r = r->next) {
+            s.queued_bytes += r->ring.size();
+        }
+    } else {
+        ScopedMutex lock(_mutex);
+        s.queued_buffers = _buffers.size();
+        for (LogBuffer *b = _buffers.front(); b; b = LogBufferList::next(b)) {
+            s.queued_bytes += b->size();
+        }
+        if (_current_buffer) {
+            s.queued_bytes += _current_buffer->size();
+        }
+        size_t used = _pool ? _pool->in_use() : 0;
+        s.extra_buffers = used > 4 ? used - 4 : 0;
+    }
+    {
+        ScopedMutex lock(_mutex);
+        for (LogBuffer *b = _urgent_buffers.front(); b; b = LogBufferList::next(b)) {
+            s.queued_bytes += b->size();
+        }
+        if (_urgent_buffer) {
+            s.queued_bytes += _urgent_buffer->size();
+        }
+    }
+    // dropped since the backend last wrote the "Dropped" line
+    ScopedMutex lock(_mutex);
+    s.dropped_lines += _dropped_lines;
+    s.dropped_bytes += _dropped_bytes;
+    return s;
+}
+
+size_t LogAsync::ring_count()
+{
+    ScopedMutex lock(_ring_mutex);
+    return _rings.size();
+}
+
+bool LogAsync::binary() const
+{
+    return _binary;
+}
 
+void LogAsync::append(LogFile<NullMutex> *output, const struct iovec *iov, int cnt)
+{
+    Clock begin;
+    output->append(iov, cnt);
+    detail::LogWriterCounters::add(_counters.append_micro_seconds, begin.elapsed());
+    uint64_t bytes = 0;
+    for (int i = 0; i < cnt; ++i) {
+        bytes += iov[i].iov_len;
+    }
+    detail::LogWriterCounters::add(_counters.written_bytes, bytes);
 }
+
+// append() through the LogDedup filter when there is one
+void LogAsync::append_lines(LogFile<NullMutex> *output, const struct iovec *iov, int cnt)
+{
+    if (!_dedup) {
+        append(output, iov, cnt);
+        return;
+    }
+    int64_t now = Timestamp().total_micro_seconds();
+    _dedup_iov.clear();
+    for (int i = 0; i < cnt; ++i) {
+        _dedup->filter(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len, now, _dedup_iov);
+    }
+    if (!_dedup_iov.empty()) {
+        append(output, &_dedup_iov[0], static_cast<int>(_dedup_iov.size()));
+    }
+    _dedup->clear_notes();
+    _counters.coalesced_lines.store(_dedup->dropped_lines(), std::memory_order_relaxed);
+    _counters.coalesced_bytes.store(_dedup->dropped_bytes(), std::memory_order_relaxed);
+}
+
+// the "Message repeated" lines of the repeats whose window passed
+void LogAsync::write_repeats(LogFile<NullMutex> *output, bool all)
+{
+    if (!_dedup) {
+        return;
+    }
+    _dedup_iov.clear();
+    _dedup->expire(Timestamp().total_micro_seconds(), _dedup_iov, all);
+    if (!_dedup_iov.empty()) {
+        append(output, &_dedup_iov[0], static_cast<int>(_dedup_iov.size()));
+    }
+    _dedup->clear_notes();
+}
+
+void LogAsync::write(LogFile<NullMutex> *output, const char* data, size_t len)
+{
+    struct iovec iov;
+    if (!_binary) {
+        iov.iov_base = const_cast<char*>(data);
+        iov.iov_len = len;
+    } else {
+        _decode_buffer.clear();
+        _decoder.decode(data, len, _decode_buffer);
+        iov.iov_base = const_cast<char*>(_decode_buffer.data());
+        iov.iov_len = _decode_buffer.size();
+    }
+    append_lines(output, &iov, 1);
+}
+
+void LogAsync::write(LogFile<NullMutex> *output, const BufferVector &buffers)
+{
+    if (_binary) {
+        _decode_buffer.clear();
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            _decoder.decode(buffers[i]->data(), buffers[i]->size(), _decode_buffer);
+        }
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(_decode_buffer.data());
+        iov.iov_len = _decode_buffer.size();
+        append_lines(output, &iov, 1);
+        return;
+    }
+    _iov.clear();
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        if (buffers[i]->size() == 0) {
+            continue;
+        }
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(buffers[i]->data());
+        iov.iov_len = buffers[i]->size();
+        _iov.push_back(iov);
+    }
+    if (!_iov.empty()) {
+        append_lines(output, &_iov[0], static_cast<int>(_iov.size()));
+    }
+}
+
+SpscRing* LogAsync::thread_ring()
+{
+    for (int i = 0; i < detail::kRingSlots; ++i) {
+        if (detail::t_ring_slots[i].owner == _id) {
+            return detail::t_ring_slots[i].ring;
+        }
+    }
+    // first use by this thread, or evicted from the cache
+    std::vector<detail::ThreadRings::Ref> &refs = detail::t_rings.refs;
+    SpscRing *ring = NULL;
+    for (size_t i = 0; i < refs.size() && !ring; ++i) {
+        if (refs[i].first == _id) {
+            ring = &refs[i].second->ring;
+        }
+    }
+    if (!ring) {
+        ring = &register_ring()->ring;
+    }
+    detail::RingSlot &slot = detail::t_ring_slots[detail::t_ring_next];
+    detail::t_ring_next = (detail::t_ring_next + 1) % detail::kRingSlots;
+    slot.owner = _id;
+    slot.ring = ring;
+    return ring;
+}
+
+detail::LogRing* LogAsync::register_ring()
+{
+    ScopedMutex lock(_ring_mutex);
+    RingPtr r;
+    for (size_t i = 0; i < _rings.size() && !r; ++i) {
+        if (!_rings[i]->owned.load(std::memory_order_acquire)) {
+            r = _rings[i];
+        }
+    }
+    if (r) {
+        r->owned.store(true, std::memory_order_relaxed);
+    } else {
+        r = std::make_shared<detail::LogRing>(_ring_size);
+        r->next = _ring_head.load(std::memory_order_relaxed);
+        _rings.push_back(r);
+        _ring_head.store(r.get(), std::memory_order_release);
+    }
+    detail::t_rings.refs.push_back(std::make_pair(_id, r));
+    return r.get();
+}
+
+void LogAsync::wakeup()
+{
+    ScopedMutex lock(_mutex);
+    _ring_wakeup = true;
+    _cond.signal();
+}
+
+void LogAsync::wait_ring(SpscRing *ring, const char* line, size_t len)
+{
+    // ring full: the backend is behind, wait until a drain makes
+    // room so this thread's lines stay in order
+    ScopedMutex lock(_mutex);
+    while (_is_running) {
+        if (ring->push(line, len)) {
+            return;
+        }
+        _ring_wakeup = true;
+        _cond.signal();
+        _space_cond.wait(_mutex, Timespan(_flush_interval * 1000000));
+    }
+}
+
 void LogAsync::puts(const char* line, size_t len)
 {
-    if(!_is_running) {
+    if (!_is_running.load(std::memory_order_relaxed)) {
         return ;
     }
-    ScopedMutex lock(_mutex);
-  	if ((_current_buffer->size() + len) < _current_buffer->stack_size()) {
-	    _current_buffer->append(line, len);
-  	} else {
-    	_buffers.push_back(_current_buffer);
-		_current_buffer.reset();
-    	if (_next_buffer)  {
-     		_current_buffer = _next_buffer;
-	  		_next_buffer.reset();
-		} else {
-      		_current_buffer.reset(new Buffer); // Rarely happens
-		}	
-    	_current_buffer->append(line, len);
-   	 	_cond.signal();
-  	}
+    if (_mode == eThreadRing) {
+        SpscRing *ring = thread_ring();
+        if (__builtin_expect(!ring->push(line, len), 0)) {
+            overflow_ring(ring, line, len);
+        } else if (ring->should_wakeup()) {
+            wakeup();
+        }
+        return;
+    }
+    {
+        ScopedMutex lock(_mutex);
+        if (_sequence) {
+            puts_sequenced(line, len);
+            return;
+        }
+        if (len < _current_buffer->avail()) {
+            _current_buffer->append(line, len);
+            ++_current_lines;
+            return;
+        }
+        const bool large = len >= _pool->buffer_size();
+        LogBuffer *buf = large ? heap_buffer(len) : take_buffer();
+        // the buffers in flight reach the cap, the backend is behind
+        if (!buf && _overflow_policy == eOverflowBlock) {
+            _cond.signal();
+            while (_is_running && len <= _max_buffer_bytes &&
+                   !(buf = large ? heap_buffer(len) : take_buffer())) {
+                _space_cond.wait(_mutex, Timespan(_flush_interval*1000000));
+            }
+        }
+        if (buf) {
+            switch_buffer(buf, line, len);
+            return;
+        }
+        if (_overflow_policy != eOverflowSpill) {
+            _dropped_bytes += len;
+            ++_dropped_lines;
+            return;
+        }
+    }
+    spill(line, len);
+}
+
+void LogAsync::puts_level(int level, const char* line, size_t len)
+{
+    if (__builtin_expect(level >= _priority_level, 0)) {
+        puts_urgent(line, len);
+    } else {
+        puts(line, len);
+    }
+}
+
+// formats the next sequence number and a blank into out
+size_t LogAsync::next_sequence(char* out)
+{
+    uint64_t seq = _sequence_next.fetch_add(1, std::memory_order_relaxed);
+    size_t n = detail::format_decimal(out, seq);
+    out[n] = ' ';
+    return n + 1;
+}
+
+// puts() with the sequence number in front, _mutex held. The
+// line always fits in a buffer, a full pool blocks or drops it.
+void LogAsync::puts_sequenced(const char* line, size_t len)
+{
+    char seq[32];
+    size_t seqLen = next_sequence(seq);
+    size_t total = seqLen + len;
+    LogBuffer *buf = NULL;
+    if (total >= _current_buffer->avail()) {
+        const bool large = total >= _pool->buffer_size();
+        buf = large ? heap_buffer(total) : take_buffer();
+        if (!buf && _overflow_policy == eOverflowBlock) {
+            _cond.signal();
+            while (_is_running && total <= _max_buffer_bytes &&
+                   !(buf = large ? heap_buffer(total) : take_buffer())) {
+                _space_cond.wait(_mutex, Timespan(_flush_interval*1000000));
+            }
+        }
+        if (!buf) {
+            _dropped_bytes += len;
+            ++_dropped_lines;
+            return;
+        }
+        _buffers.push_back(_current_buffer);
+        _queued_lines += _current_lines;
+        _current_buffer = buf;
+        _current_lines = 0;
+        _cond.signal();
+    }
+    _current_buffer->append(seq, seqLen);
+    _current_buffer->append(line, len);
+    ++_current_lines;
+}
+
+void LogAsync::puts_urgent(const char* line, size_t len)
+{
+    if (!_is_running.load(std::memory_order_relaxed)) {
+        return ;
+    }
+    {
+        ScopedMutex lock(_mutex);
+        char seq[32];
+        size_t seqLen = _sequence ? next_sequence(seq) : 0;
+        if (urgent_room(seqLen + len)) {
+            _urgent_buffer->append(seq, seqLen);
+            _urgent_buffer->append(line, len);
+            ++_urgent_lines;
+            _urgent_pending = true;
+            _cond.signal();
+            return;
+        }
+        if (_overflow_policy != eOverflowSpill || _sequence) {
+            _dropped_bytes += len;
+            ++_dropped_lines;
+            return;
+        }
+    }
+    spill(line, len);
+}
+
+// makes room for len bytes in _urgent_buffer, _mutex held. The
+// urgent buffers come from the bulk pool, false once it is empty
+// and the overflow policy does not block.
+bool LogAsync::urgent_room(size_t len)
+{
+    while (!_urgent_buffer || len >= _urgent_buffer->avail()) {
+        LogBuffer *buf = len >= _pool->buffer_size() ? heap_buffer(len) : _pool->get();
+        if (buf) {
+            if (_urgent_buffer && _urgent_buffer->size() > 0) {
+                _urgent_buffers.push_back(_urgent_buffer);
+            } else if (_urgent_buffer) {
+                _pool->put(_urgent_buffer);
+            }
+            _urgent_buffer = buf;
+            return true;
+        }
+        if (_overflow_policy != eOverflowBlock || !_is_running || len > _max_buffer_bytes) {
+            return false;
+        }
+        _urgent_pending = true;
+        _cond.signal();
+        _space_cond.wait(_mutex, Timespan(_flush_interval * 1000000));
+    }
+    return true;
+}
+
+// writes and flushes the urgent lines, false if there were none
+bool LogAsync::write_urgent(LogFile<NullMutex> *output)
+{
+    uint64_t lines = 0;
+    {
+        ScopedMutex lock(_mutex);
+        if (_urgent_lines == 0) {
+            return false;
+        }
+        if (_urgent_buffer && _urgent_buffer->size() > 0) {
+            _urgent_buffers.push_back(_urgent_buffer);
+            _urgent_buffer = NULL;
+        }
+        _urgent_buffers.take_all(_urgent_drain);
+        lines = _urgent_lines;
+        _urgent_lines = 0;
+    }
+    write(output, _urgent_drain);
+    for (size_t i = 0; i < _urgent_drain.size(); ++i) {
+        _pool->put(_urgent_drain[i]);
+    }
+    _urgent_drain.clear();
+    detail::LogWriterCounters::add(_counters.written_lines, lines);
+    _schedule.flush(output, _counters);
+    return true;
+}
+
+LogBuffer* LogAsync::take_buffer()
+{
+    if (_next_buffer) {
+        LogBuffer *buf = _next_buffer;
+        _next_buffer = NULL;
+        return buf;
+    }
+    return _pool->get(); // Rarely happens
+}
+
+// a buffer of its own for a line larger than a pool buffer, NULL
+// if it would take the buffers in flight past the cap
+LogBuffer* LogAsync::heap_buffer(size_t len)
+{
+    if (_pool->bytes_in_use() + len > _max_buffer_bytes) {
+        return NULL;
+    }
+    return _pool->get_heap(len);
+}
+
+void LogAsync::switch_buffer(LogBuffer *buf, const char* line, size_t len)
+{
+    _buffers.push_back(_current_buffer);
+    _queued_lines += _current_lines;
+    _current_buffer = buf;
+    _current_buffer->append(line, len);
+    _current_lines = 1;
+    _cond.signal();
+}
+
+void LogAsync::overflow_ring(SpscRing *ring, const char* line, size_t len)
+{
+    OverflowPolicy policy = _overflow_policy;
+    // a line larger than the ring never fits, waiting for room is no use
+    if (policy == eOverflowBlock && len > ring->max_record()) {
+        policy = eOverflowDrop;
+    }
+    switch (policy) {
+        case eOverflowDrop: {
+            ScopedMutex lock(_mutex);
+            _dropped_bytes += len;
+            ++_dropped_lines;
+            _ring_wakeup = true;
+            _cond.signal();
+            break;
+        }
+        case eOverflowSpill:
+            spill(line, len);
+            wakeup();
+            break;
+        default:
+            wait_ring(ring, line, len);
+            break;
+    }
+}
+
+void LogAsync::spill(const char* line, size_t len)
+{
+    if (!_binary) {
+        _overflow.append(line, len);
+        return;
+    }
+    LogRecordDecoder decoder;
+    LogStream::Buffer text;
+    decoder.decode(line, len, text);
+    _overflow.append(text.data(), text.size());
+}
+
+void LogAsync::write_dropped(LogFile<NullMutex> *output)
+{
+    uint64_t bytes = 0;
+    uint64_t lines = 0;
+    {
+        ScopedMutex lock(_mutex);
+        bytes = _dropped_bytes;
+        lines = _dropped_lines;
+        _dropped_bytes = 0;
+        _dropped_lines = 0;
+    }
+    _schedule.dropped(output, bytes, lines, _counters);
 }
 
 void LogAsync::run()
 {
-    _state.set_to(1);
     std::cout<<"start async log"<<std::endl;
     LogFile<NullMutex> output(_base_name, _roll_size);
-    BufferPtr newBuffer1(new Buffer);
-    BufferPtr newBuffer2(new Buffer);
-    newBuffer1->bzero();
-    newBuffer2->bzero();
+    output.set_roll_listener(_roll_listener);
+    output.set_sync_policy(_schedule.sync_policy());
+    _crash_file.store(&output, std::memory_order_release);
+    // start() returns once crash_flush() has a file to write to
+    _state.set_to(1);
+    if (_mode == eThreadRing) {
+        run_rings(&output);
+        _crash_file.store(NULL, std::memory_order_release);
+        _state.set_to(2);
+        return;
+    }
+    LogBuffer *newBuffer1 = _pool->get();
+    LogBuffer *newBuffer2 = _pool->get();
     BufferVector buffersToWrite;
     buffersToWrite.reserve(16);
+    Timestamp lastReport;
     while (_is_running) {
-        assert(newBuffer1 && newBuffer1->size() == 0);
-        assert(newBuffer2 && newBuffer2->size() == 0);
         assert(buffersToWrite.empty());
 
+        uint64_t lines = 0;
+        {
+            ScopedMutex lock(_mutex);
+            if (_buffers.empty() && !_urgent_pending) {
+                _cond.wait(_mutex, _schedule.wait_interval());
+            }
+            _urgent_pending = false;
+        }
+        // the heap buffers of the last round are out of crash_flush()'s reach
+        _pool->reclaim();
+        write_urgent(&output);
         {
             ScopedMutex lock(_mutex);
-            if (_buffers.empty()) {
-                _cond.wait(_mutex, Timespan(_flush_interval*1000000));
+            // without a spare the current buffer waits for the next round
+            if (newBuffer1) {
+                _buffers.push_back(_current_buffer);
+                _queued_lines += _current_lines;
+                _current_lines = 0;
+                _current_buffer = newBuffer1;
+                newBuffer1 = NULL;
             }
-            _buffers.push_back(_current_buffer);
-            _current_buffer = newBuffer1;
-	        newBuffer1.reset();
-            buffersToWrite.swap(_buffers);
-            if (!_next_buffer) {
+            lines = _queued_lines;
+            _queued_lines = 0;
+            _buffers.take_all(buffersToWrite);
+            if (!_next_buffer && newBuffer2) {
                 _next_buffer = newBuffer2;
-		        newBuffer2.reset();
+                newBuffer2 = NULL;
             }
         }
-        /*
-        if (buffersToWrite.size() > 25) {
-            char buf[256];
-            snprintf(buf, sizeof buf, "Dropped log messages at %s, %zd larger buffers\n",
-               Timestamp().data_time().c_str(),
-               buffersToWrite.size()-2);
-            fputs(buf, stderr);
-            output.append(buf, static_cast<int>(strlen(buf)));
-	        buffersToWrite.resize(2);
-        }
-        */
-        size_t s = buffersToWrite.size();
-        for (size_t i = 0; i < s; ++i) {
-            // FIXME: use unbuffered stdio FILE ? or use ::writev ?
-            output.append(buffersToWrite[i]->data(), buffersToWrite[i]->size());
-        }
-
-        buffersToWrite.resize(2);
+        write(&output, buffersToWrite);
+        detail::LogWriterCounters::add(_counters.written_lines, lines);
+        detail::LogWriterCounters::add(_counters.loops, 1);
+        write_dropped(&output);
+        write_repeats(&output, false);
+        _schedule.report(&output, lastReport, _log_name.c_str(),
+                         [this]() { return stats(); }, _counters);
 
+        // the pool hands the buffers just written back first, they
+        // are still in cache
+        for (size_t i = 0; i < buffersToWrite.size(); ++i) {
+            _pool->put(buffersToWrite[i]);
+        }
+        buffersToWrite.clear();
         if (!newBuffer1) {
-            assert(!buffersToWrite.empty());
-            newBuffer1 = buffersToWrite[0];
-            newBuffer1->bzero();
+            newBuffer1 = _pool->get();
         }
-
         if (!newBuffer2) {
-            assert(buffersToWrite.size() == 2);
-            newBuffer2 = buffersToWrite[1];
-            newBuffer2->bzero();
+            newBuffer2 = _pool->get();
         }
-
-        buffersToWrite.clear();
-        output.flush();
+        {
+            ScopedMutex lock(_mutex);
+            _space_cond.broadcast();
+        }
+        _schedule.flush(&output, _counters);
+        _overflow.flush();
     } //while
   
     flush_all(&output);
+    _overflow.flush();
+    if (newBuffer1) {
+        _pool->put(newBuffer1);
+    }
+    if (newBuffer2) {
+        _pool->put(newBuffer2);
+    }
+    _crash_file.store(NULL, std::memory_order_release);
     _state.set_to(2);
 }
 
+void LogAsync::run_rings(LogFile<NullMutex> *output)
+{
+    Timestamp lastReport;
+    while (_is_running) {
+        {
+            ScopedMutex lock(_mutex);
+            if (!_ring_wakeup && !_urgent_pending) {
+                _cond.wait(_mutex, _schedule.wait_interval());
+            }
+            _ring_wakeup = false;
+            _urgent_pending = false;
+        }
+        _pool->reclaim();
+        write_urgent(output);
+        drain_rings(output);
+        {
+            ScopedMutex lock(_mutex);
+            _space_cond.broadcast();
+        }
+        detail::LogWriterCounters::add(_counters.loops, 1);
+        write_dropped(output);
+        write_repeats(output, false);
+        _schedule.report(output, lastReport, _log_name.c_str(),
+                         [this]() { return stats(); }, _counters);
+        _schedule.flush(output, _counters);
+        _overflow.flush();
+    }
+    write_urgent(output);
+    drain_rings(output);
+    write_dropped(output);
+    write_repeats(output, true);
+    _schedule.flush(output, _counters);
+    _overflow.flush();
+}
+
+void LogAsync::drain_rings(LogFile<NullMutex> *output)
+{
+    size_t lines = 0;
+    detail::LogRing *head = _ring_head.load(std::memory_order_acquire);
+    if (_binary || _dedup) {
+        // the decoder and the filter need whole records
+        _drain_buffer.clear();
+        for (detail::LogRing *r = head; r; r = r->next) {
+            lines += r->ring.pop_to(_drain_buffer);
+        }
+        detail::LogWriterCounters::add(_counters.written_lines, lines);
+        if (_drain_buffer.size() > 0) {
+            write(output, _drain_buffer.data(), _drain_buffer.size());
+        }
+        return;
+    }
+    // the records are written straight from the rings, which keep
+    // their space until the writev returns
+    _iov.clear();
+    for (detail::LogRing *r = head; r; r = r->next) {
+        lines += r->ring.read([this](const char* data, size_t len) {
+            struct iovec iov;
+            iov.iov_base = const_cast<char*>(data);
+            iov.iov_len = len;
+            _iov.push_back(iov);
+        });
+    }
+    detail::LogWriterCounters::add(_counters.written_lines, lines);
+    if (!_iov.empty()) {
+        append(output, &_iov[0], static_cast<int>(_iov.size()));
+    }
+    for (detail::LogRing *r = head; r; r = r->next) {
+        r->ring.release();
+    }
+}
+
 void LogAsync::flush()
 {
 
 }
+
+int LogAsync::crash_flush()
+{
+    LogFile<NullMutex> *file = _crash_file.load(std::memory_order_acquire);
+    int fd = file ? file->fd() : -1;
+    if (fd < 0 || _binary) {
+        return fd;
+    }
+    for (LogBuffer *b = _urgent_buffers.front(); b; b = LogBufferList::next(b)) {
+        LogCrashHandler::write_fully(fd, b->data(), b->size());
+    }
+    if (LogBuffer *urgent = _urgent_buffer) {
+        LogCrashHandler::write_fully(fd, urgent->data(), urgent->size());
+    }
+    if (_mode == eThreadRing) {
+        detail::LogRing *r = _ring_head.load(std::memory_order_acquire);
+        for (; r; r = r->next) {
+            r->ring.peek([fd](const char* data, size_t len) {
+                LogCrashHandler::write_fully(fd, data, len);
+            });
+        }
+        return fd;
+    }
+    for (LogBuffer *b = _buffers.front(); b; b = LogBufferList::next(b)) {
+        LogCrashHandler::write_fully(fd, b->data(), b->size());
+    }
+    if (LogBuffer *current = _current_buffer) {
+        LogCrashHandler::write_fully(fd, current->data(), current->size());
+    }
+    return fd;
+}
 void LogAsync::flush_all(LogFile<NullMutex> *output)
 {
-    ScopedMutex lock(_mutex);
-	_buffers.push_back(_current_buffer);
-	_current_buffer.reset();
-	if (!_buffers.empty()) {
-	    for (size_t i = 0; i <_buffers.size(); i++) {
-		    output->append(_buffers[i]->data(), _buffers[i]->size());
-		}
-	}
-	output->flush();
+    write_urgent(output);
+    {
+        ScopedMutex lock(_mutex);
+        _buffers.push_back(_current_buffer);
+        _current_buffer = NULL;
+        BufferVector buffers;
+        _buffers.take_all(buffers);
+        write(output, buffers);
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            _pool->put(buffers[i]);
+        }
+        detail::LogWriterCounters::add(_counters.written_lines, _queued_lines + _current_lines);
+        _queued_lines = 0;
+        _current_lines = 0;
+    }
+    // write_dropped() takes _mutex itself
+    write_dropped(output);
+    write_repeats(output, true);
+    _schedule.flush(output, _counters);
 }
 
 bool LogAsync::start()
 {
     if(_is_running) {
         return true;
+    }
+    if (!_pool) {
+        // the two producer buffers, the two backend spares and one
+        // for urgent lines at least; in eThreadRing mode only urgent
+        // lines take buffers
+        size_t size = LogBufferPool::buffer_size(_buffer_size);
+        size_t count = std::max<size_t>(5, _max_buffer_bytes / size);
+        _pool.reset(new LogBufferPool(_buffer_size, count, _huge_pages));
+        if (_mode == eLockedQueue) {
+            _next_buffer = _pool->get();
+        }
+    }
+    if (_mode == eLockedQueue && !_current_buffer) {
+        _current_buffer = _pool->get();
+    }
+    if (_binary || _mode != eLockedQueue) {
+        _sequence = false;
+    }
+    if (_dedup_window.total_micro_seconds() > 0 && !_dedup) {
+        _dedup.reset(new LogDedup(_dedup_window));
     }
      _is_running = true;
     _thread.start(std::bind(&LogAsync::run, this));
@@ -152,6 +888,11 @@ void LogAsync::stop()
         return;
     }
     _is_running = false;
+    wakeup();
+    {
+        ScopedMutex lock(_mutex);
+        _space_cond.broadcast();
+    }
     _state.wait_for(2);
     _thread.join();
 }
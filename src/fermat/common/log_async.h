@@ -6,23 +6,211 @@
 #include <fermat/common/shared_state.h>
 #include <fermat/common/stack_buffer.h>
 #include <fermat/common/log_file.h>
+#include <fermat/common/spsc_ring.h>
+#include <fermat/common/log_record.h>
+#include <fermat/common/log_async_stats.h>
+#include <fermat/common/log_buffer.h>
+#include <fermat/common/log_dedup.h>
+#include <fermat/common/timespan.h>
 #include <memory>
 #include <cstddef>
 #include <vector>
+#include <atomic>
 
 namespace fermat {
 
+namespace detail {
+
+/*!
+* The ring of one producer thread in LogAsync::eThreadRing mode.
+* The rings form a list that only grows, so the backend and
+* crash_flush() walk it without a lock; a ring whose thread
+* exited is handed to the next new thread, lines it still holds
+* are written before that thread's.
+*/
+struct LogRing {
+    explicit LogRing(size_t size)
+        : ring(size), owned(true), next(NULL)
+    {}
+
+    SpscRing           ring;
+    std::atomic<bool>  owned;  //!< false once its thread exited
+    LogRing           *next;
+};
+
+}
+
 class LogAsync : public LogOutput {
 public:
+    /*!
+    * How producers hand lines to the backend thread.
+    * eLockedQueue: every puts() takes one shared mutex.
+    * eThreadRing:  each producer thread owns a lock-free SPSC ring,
+    *               taken on its first puts() and given back when it
+    *               exits, that the backend drains; lines stay in
+    *               per-thread order. Text lines are written from the
+    *               rings in place, binary records and lines through
+    *               set_dedup_window() are copied out first.
+    */
+    enum QueueMode {
+        eLockedQueue,
+        eThreadRing
+    };
+
+    /*!
+    * What puts() does once the in-flight buffers reach the cap.
+    * eOverflowBlock: wait until the backend frees a buffer.
+    * eOverflowDrop:  discard the line; the backend writes one
+    *                 "Dropped N bytes" line for the lost data.
+    * eOverflowSpill: write the line synchronously to the
+    *                 secondary file baseName.overflow.
+    * In eThreadRing mode the policy applies when a ring is full.
+    * Urgent lines, see set_priority_level, and lines larger than
+    * a buffer follow it in both modes once the buffers in flight
+    * reach the cap.
+    */
+    enum OverflowPolicy {
+        eOverflowBlock,
+        eOverflowDrop,
+        eOverflowSpill
+    };
+
+    static const size_t kDefaultRingSize = 256 * 1024;
+    static const size_t kDefaultBufferSize = 64 * 1024;
+    static const size_t kDefaultMaxBufferBytes = 64 * 1024 * 1024;
+
     LogAsync(const std::string &baseName,
              size_t rollSize,
-             int flushInterval = 3);
+             int flushInterval = 3,
+             QueueMode mode = eLockedQueue);
     virtual ~LogAsync();
 
+    /*!
+    * Sets the per-thread ring size in bytes for eThreadRing mode.
+    * Lines are copied into the ring whatever their size, one
+    * larger than the ring is dropped, or spilled with
+    * eOverflowSpill. Must be called before start().
+    */
+    void set_ring_size(size_t size);
+
+    /*!
+    * Sets the overflow policy, eOverflowDrop by default.
+    */
+    void set_overflow_policy(OverflowPolicy policy);
+
+    /*!
+    * Caps the memory of all buffers in flight, urgent lines
+    * included, kDefaultMaxBufferBytes by default. The buffers are
+    * preallocated in a LogBufferPool of that size at start(); in
+    * eThreadRing mode only the urgent lines use them. A line
+    * larger than a buffer gets a heap buffer of its own, counted
+    * against the cap too; one larger than the cap is dropped, or
+    * spilled with eOverflowSpill. Must be called before start().
+    */
+    void set_max_buffer_bytes(size_t bytes);
+
+    /*!
+    * Sets the size of one buffer in eLockedQueue mode,
+    * kDefaultBufferSize by default; producers hand a buffer to
+    * the backend each time one fills. Must be called before
+    * start().
+    */
+    void set_buffer_size(size_t size);
+
+    /*!
+    * Backs the buffer pool with huge pages, see LogBufferPool.
+    * Must be called before start().
+    */
+    void set_huge_pages(bool on);
+
+    /*!
+    * Takes binary log records instead of text lines and formats
+    * them on the backend thread. Must be called before start()
+    * and before this output is passed to Logging::set_output().
+    */
+    void set_binary(bool on);
+
+    /*!
+    * Passes every rolled log file to listener on the backend
+    * thread, e.g. LogCompressor::listener(). Must be called
+    * before start().
+    */
+    void set_roll_listener(const LogRollListener &listener);
+
+    /*!
+    * See detail::LogWriterSchedule::set_report_interval(). Must
+    * be called before start().
+    */
+    void set_report_interval(Timespan interval);
+
+    /*!
+    * See detail::LogWriterSchedule::set_sync_policy(). Must be
+    * called before start().
+    */
+    void set_sync_policy(const LogSyncPolicy &policy);
+
+    /*!
+    * Sends lines at level and above, eERROR by default, through
+    * a separate queue that the backend writes and flushes as
+    * soon as it is woken, ahead of the bulk queue. The urgent
+    * lines may therefore precede older bulk lines in the file.
+    * Their buffers come from the same pool as the bulk ones and
+    * the overflow policy applies once the buffers in flight reach
+    * the cap, see set_max_buffer_bytes.
+    * eNUM_LOG_LEVELS turns the lane off.
+    */
+    void set_priority_level(Logging::LogLevel level);
+
+    /*!
+    * Coalesces repeated lines on the backend thread, see
+    * LogDedup: a line equal to one written less than window ago,
+    * time and thread id aside, is dropped and counted in a
+    * "Message repeated" line. 0 (the default) turns it off.
+    * Must be called before start().
+    */
+    void set_dedup_window(Timespan window);
+
+    /*!
+    * Starts every line with its sequence number and a blank,
+    * counting from 0 in the order the lines enter the queue, so
+    * the lines of several outputs can be merged back in order,
+    * see LogShardedAsync. Text eLockedQueue mode only; with the
+    * eOverflowSpill policy a line that does not fit is dropped.
+    * Must be called before start().
+    */
+    void set_sequence(bool on);
+
+    /*!
+    * @return a snapshot of the counters. extra_buffers counts
+    * the pool buffers in use beyond the two of the producers and
+    * the two spares of the backend. In eThreadRing mode
+    * queued_bytes is what the rings hold, frames included, and
+    * queued_buffers and extra_buffers are 0.
+    */
+    LogAsyncStats stats();
+
+    /*!
+    * @return the rings created so far in eThreadRing mode, at
+    * most the number of threads that logged at the same time.
+    */
+    size_t ring_count();
+
+    virtual bool binary() const;
+
     virtual void puts(const char* line, size_t len);
 
+    virtual void puts_level(int level, const char* line, size_t len);
+
     virtual void flush();
 
+    /*!
+    * Writes the lines still queued to the current log file,
+    * without the locks the producers take, for LogCrashHandler.
+    * Lines the backend is writing at that moment are not
+    * repeated. Binary records are skipped, decoding them allocates.
+    */
+    virtual int crash_flush();
+
     bool start();
 
     void stop();
@@ -30,19 +218,79 @@ public:
     void run();
 private:
     void flush_all(LogFile<NullMutex> *out);
+    void run_rings(LogFile<NullMutex> *out);
+    void drain_rings(LogFile<NullMutex> *out);
+    SpscRing* thread_ring();
+    detail::LogRing* register_ring();
+    void wait_ring(SpscRing *ring, const char* line, size_t len);
+    void wakeup();
+    LogBuffer* take_buffer();
+    LogBuffer* heap_buffer(size_t len);
+    void switch_buffer(LogBuffer *buf, const char* line, size_t len);
+    void overflow_ring(SpscRing *ring, const char* line, size_t len);
+    void spill(const char* line, size_t len);
+    void write_dropped(LogFile<NullMutex> *out);
+    void puts_urgent(const char* line, size_t len);
+    bool urgent_room(size_t len);
+    void puts_sequenced(const char* line, size_t len);
+    size_t next_sequence(char* out);
+    bool write_urgent(LogFile<NullMutex> *out);
+    void append(LogFile<NullMutex> *out, const struct iovec *iov, int cnt);
+    void append_lines(LogFile<NullMutex> *out, const struct iovec *iov, int cnt);
+    void write_repeats(LogFile<NullMutex> *out, bool all);
     typedef StackBuffer<char, 4096>   Buffer; 
-    typedef std::shared_ptr<Buffer>   BufferPtr;
-    typedef std::vector<BufferPtr>    BufferVector;   
+    typedef std::vector<LogBuffer*>   BufferVector;
+    typedef std::shared_ptr<detail::LogRing> RingPtr;
+    void write(LogFile<NullMutex> *out, const char* data, size_t len);
+    void write(LogFile<NullMutex> *out, const BufferVector &buffers);
     const int                        _flush_interval;
-    bool                             _is_running;
+    const QueueMode                  _mode;
+    const uint64_t                   _id;
+    std::atomic<bool>                _is_running;
     std::string                      _base_name;
     size_t                           _roll_size;
     SharedState<int>                 _state;
     Mutex                            _mutex;
     Cond                             _cond;
-    BufferPtr                        _current_buffer;
-    BufferPtr                        _next_buffer;
-    BufferVector                     _buffers;
+    LogBuffer                       *_current_buffer;
+    LogBuffer                       *_next_buffer;
+    LogBufferList                    _buffers;        //!< walked by crash_flush()
+    uint64_t                         _queued_lines;   //!< in _buffers
+    uint64_t                         _current_lines;  //!< in _current_buffer
+    size_t                           _ring_size;
+    bool                             _ring_wakeup;
+    Mutex                            _ring_mutex;
+    std::vector<RingPtr>             _rings;      //!< under _ring_mutex
+    std::atomic<detail::LogRing*>    _ring_head;
+    Buffer                           _drain_buffer;
+    bool                             _binary;
+    LogRecordDecoder                 _decoder;
+    Buffer                           _decode_buffer;
+    std::vector<struct iovec>        _iov;
+    OverflowPolicy                   _overflow_policy;
+    size_t                           _max_buffer_bytes;
+    size_t                           _buffer_size;
+    bool                             _huge_pages;
+    std::unique_ptr<LogBufferPool>   _pool;
+    Cond                             _space_cond;
+    uint64_t                         _dropped_bytes;  //!< under _mutex, with _dropped_lines
+    uint64_t                         _dropped_lines;
+    detail::LogOverflowFile          _overflow;
+    LogRollListener                  _roll_listener;
+    std::atomic<LogFile<NullMutex>*> _crash_file;
+    detail::LogWriterSchedule        _schedule;
+    int                              _priority_level;
+    LogBuffer                       *_urgent_buffer;  //!< under _mutex, being filled
+    LogBufferList                    _urgent_buffers; //!< under _mutex, walked by crash_flush()
+    uint64_t                         _urgent_lines;   //!< in the two above
+    bool                             _urgent_pending; //!< under _mutex, wakes the backend
+    BufferVector                     _urgent_drain;
+    Timespan                         _dedup_window;
+    std::unique_ptr<LogDedup>        _dedup;
+    std::vector<struct iovec>        _dedup_iov;
+    bool                             _sequence;
+    std::atomic<uint64_t>            _sequence_next;
+    detail::LogWriterCounters        _counters;
     Thread                           _thread;
 };
 }
@@ -0,0 +1,128 @@
+#include <fermat/common/log_async_stats.h>
+#include <fermat/common/clock.h>
+#include <fermat/common/logging.h>
+
+namespace fermat {
+
+size_t LogAsyncStats::format(const char* name, char *buf, size_t size) const
+{
+    return Logging::format_note(buf, size, Timestamp().total_micro_seconds(),
+                                "%s stats: queued_buffers=%llu"
+                                " queued_bytes=%llu written_lines=%llu written_bytes=%llu"
+                                " extra_buffers=%llu loops=%llu append_us=%llu flush_us=%llu"
+                                " dropped_lines=%llu dropped_bytes=%llu"
+                                " coalesced_lines=%llu coalesced_bytes=%llu"
+                                " syncs=%llu sync_us=%llu\n",
+                                name,
+                                static_cast<unsigned long long>(queued_buffers),
+                                static_cast<unsigned long long>(queued_bytes),
+                                static_cast<unsigned long long>(written_lines),
+                                static_cast<unsigned long long>(written_bytes),
+                                static_cast<unsigned long long>(extra_buffers),
+                                static_cast<unsigned long long>(loops),
+                                static_cast<unsigned long long>(append_micro_seconds),
+                                static_cast<unsigned long long>(flush_micro_seconds),
+                                static_cast<unsigned long long>(dropped_lines),
+                                static_cast<unsigned long long>(dropped_bytes),
+                                static_cast<unsigned long long>(coalesced_lines),
+                                static_cast<unsigned long long>(coalesced_bytes),
+                                static_cast<unsigned long long>(syncs),
+                                static_cast<unsigned long long>(sync_micro_seconds));
+}
+
+namespace detail {
+
+void LogWriterCounters::copy_to(LogAsyncStats *stats) const
+{
+    stats->written_lines = written_lines.load(std::memory_order_relaxed);
+    stats->written_bytes = written_bytes.load(std::memory_order_relaxed);
+    stats->loops = loops.load(std::memory_order_relaxed);
+    stats->append_micro_seconds = append_micro_seconds.load(std::memory_order_relaxed);
+    stats->flush_micro_seconds = flush_micro_seconds.load(std::memory_order_relaxed);
+    stats->dropped_lines = dropped_lines.load(std::memory_order_relaxed);
+    stats->dropped_bytes = dropped_bytes.load(std::memory_order_relaxed);
+    stats->coalesced_lines = coalesced_lines.load(std::memory_order_relaxed);
+    stats->coalesced_bytes = coalesced_bytes.load(std::memory_order_relaxed);
+    stats->syncs = syncs.load(std::memory_order_relaxed);
+    stats->sync_micro_seconds = sync_micro_seconds.load(std::memory_order_relaxed);
+}
+
+Timespan LogWriterSchedule::wait_interval() const
+{
+    int64_t interval = _flush_interval * 1000000LL;
+    int64_t report = _report_interval.total_micro_seconds();
+    if (report > 0 && report < interval) {
+        interval = report;
+    }
+    int64_t sync = _sync_policy.interval.total_micro_seconds();
+    if (_sync_policy.mode == LogSyncPolicy::eSyncInterval && sync > 0 && sync < interval) {
+        interval = sync;
+    }
+    return Timespan(interval);
+}
+
+void LogWriterSchedule::flush(LogFile<NullMutex> *out, LogWriterCounters &counters) const
+{
+    Clock begin;
+    out->flush();
+    LogWriterCounters::add(counters.flush_micro_seconds, begin.elapsed());
+    counters.syncs.store(out->syncs(), std::memory_order_relaxed);
+    counters.sync_micro_seconds.store(out->sync_micro_seconds(), std::memory_order_relaxed);
+}
+
+void LogWriterSchedule::report(LogFile<NullMutex> *out, Timestamp &last, const char* name,
+                               const std::function<LogAsyncStats()> &stats,
+                               LogWriterCounters &counters) const
+{
+    if (_report_interval.total_micro_seconds() <= 0 ||
+        !last.is_elapsed(_report_interval.total_micro_seconds())) {
+        return;
+    }
+    last.update();
+    char buf[512];
+    size_t len = stats().format(name, buf, sizeof buf);
+    Clock begin;
+    out->append(buf, len);
+    LogWriterCounters::add(counters.append_micro_seconds, begin.elapsed());
+    LogWriterCounters::add(counters.written_bytes, len);
+}
+
+void LogWriterSchedule::dropped(LogFile<NullMutex> *out, uint64_t bytes, uint64_t lines,
+                                LogWriterCounters &counters) const
+{
+    if (lines == 0) {
+        return;
+    }
+    LogWriterCounters::add(counters.dropped_bytes, bytes);
+    LogWriterCounters::add(counters.dropped_lines, lines);
+    char buf[256];
+    size_t len = Logging::format_note(buf, sizeof buf, Timestamp().total_micro_seconds(),
+                                      "Dropped %llu bytes (%llu lines) of log messages\n",
+                                      static_cast<unsigned long long>(bytes),
+                                      static_cast<unsigned long long>(lines));
+    Clock begin;
+    out->append(buf, len);
+    LogWriterCounters::add(counters.append_micro_seconds, begin.elapsed());
+    LogWriterCounters::add(counters.written_bytes, len);
+}
+
+void LogOverflowFile::append(const char* line, size_t len)
+{
+    ScopedMutex lock(_mutex);
+    if (!_file) {
+        _file.reset(new LogFile<NullMutex>(_base_name + ".overflow", _roll_size));
+    }
+    _file->append(line, len);
+}
+
+void LogOverflowFile::flush()
+{
+    ScopedMutex lock(_mutex);
+    if (_file) {
+        _file->flush();
+    }
+}
+
+}
+
+} //namespace fermat
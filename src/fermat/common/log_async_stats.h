@@ -0,0 +1,175 @@
+#ifndef FERMAT_COMMON_LOG_ASYNC_STATS_H_
+#define FERMAT_COMMON_LOG_ASYNC_STATS_H_
+#include <fermat/common/log_file.h>
+#include <fermat/common/mutex.h>
+#include <fermat/common/timespan.h>
+#include <fermat/common/timestamp.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace fermat {
+
+/*!
+* Snapshot of the counters of an async log output, taken by
+* LogAsync::stats() and LogMultiAsync::stats(). The queued_*
+* and extra_buffers fields are gauges, the others are totals
+* since the output was created.
+*/
+struct LogAsyncStats {
+    uint64_t  queued_buffers;        //!< full buffers waiting for the backend
+    uint64_t  queued_bytes;          //!< logged but not written yet
+    uint64_t  written_lines;
+    uint64_t  written_bytes;         //!< passed to the log file
+    uint64_t  extra_buffers;         //!< allocated beyond the fixed spares
+    uint64_t  loops;                 //!< backend loop iterations
+    uint64_t  append_micro_seconds;  //!< backend time in LogFile::append
+    uint64_t  flush_micro_seconds;   //!< backend time in LogFile::flush
+    uint64_t  dropped_lines;
+    uint64_t  dropped_bytes;
+    uint64_t  coalesced_lines;       //!< repeats not written, see LogDedup
+    uint64_t  coalesced_bytes;
+    uint64_t  syncs;                 //!< see LogSyncPolicy
+    uint64_t  sync_micro_seconds;    //!< backend time syncing, part of flush_micro_seconds
+
+    /*!
+    * Formats the snapshot as one log line, with the time prefix
+    * of Logging and "name stats: key=value ...", into buf.
+    * @return the length written, newline included.
+    */
+    size_t format(const char* name, char *buf, size_t size) const;
+};
+
+namespace detail {
+
+/*!
+* The counters the backend thread of an async output keeps.
+* Only that thread writes them, so add() is a plain load and
+* store instead of a locked read-modify-write; stats() reads
+* them from any thread.
+*/
+struct LogWriterCounters {
+    LogWriterCounters()
+        : written_lines(0),
+          written_bytes(0),
+          loops(0),
+          append_micro_seconds(0),
+          flush_micro_seconds(0),
+          dropped_lines(0),
+          dropped_bytes(0),
+          coalesced_lines(0),
+          coalesced_bytes(0),
+          syncs(0),
+          sync_micro_seconds(0)
+    {}
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+    }
+
+    void copy_to(LogAsyncStats *stats) const;
+
+    std::atomic<uint64_t>  written_lines;
+    std::atomic<uint64_t>  written_bytes;
+    std::atomic<uint64_t>  loops;
+    std::atomic<uint64_t>  append_micro_seconds;
+    std::atomic<uint64_t>  flush_micro_seconds;
+    std::atomic<uint64_t>  dropped_lines;
+    std::atomic<uint64_t>  dropped_bytes;
+    std::atomic<uint64_t>  coalesced_lines;
+    std::atomic<uint64_t>  coalesced_bytes;
+    std::atomic<uint64_t>  syncs;
+    std::atomic<uint64_t>  sync_micro_seconds;
+};
+
+/*!
+* When the backend thread of an async output wakes up, flushes
+* and reports, shared by LogAsync and LogMultiAsync. The setters
+* are called before start(), the rest on the backend thread.
+*/
+class LogWriterSchedule {
+public:
+    explicit LogWriterSchedule(int flushInterval)
+        : _flush_interval(flushInterval),
+          _report_interval(0),
+          _sync_policy()
+    {}
+
+    /*!
+    * Writes a LogAsyncStats line to the log file every interval,
+    * 0 (the default) turns it off. The backend wakes up for it
+    * even when no line comes.
+    */
+    void set_report_interval(Timespan interval) { _report_interval = interval; }
+
+    /*!
+    * Sets how the log files are synced, see LogSyncPolicy. The
+    * backend checks whether a sync is due once per batch, in
+    * flush(), and with eSyncInterval wakes up at least once per
+    * interval.
+    */
+    void set_sync_policy(const LogSyncPolicy &policy) { _sync_policy = policy; }
+    const LogSyncPolicy& sync_policy() const { return _sync_policy; }
+
+    /*!
+    * @return the longest the backend waits for lines: the flush
+    * interval, or the report or sync interval if shorter.
+    */
+    Timespan wait_interval() const;
+
+    /*!
+    * Flushes out and adds the time taken, and the syncs out has
+    * done so far, to counters.
+    */
+    void flush(LogFile<NullMutex> *out, LogWriterCounters &counters) const;
+
+    /*!
+    * Appends the stats line of name to out if the report interval
+    * passed since last; stats is only called then.
+    */
+    void report(LogFile<NullMutex> *out, Timestamp &last, const char* name,
+                const std::function<LogAsyncStats()> &stats,
+                LogWriterCounters &counters) const;
+
+    /*!
+    * Appends the "Dropped N bytes (M lines)" line for the lines
+    * the overflow policy discarded, if any, and adds them to
+    * counters.
+    */
+    void dropped(LogFile<NullMutex> *out, uint64_t bytes, uint64_t lines,
+                 LogWriterCounters &counters) const;
+private:
+    const int      _flush_interval;
+    Timespan       _report_interval;
+    LogSyncPolicy  _sync_policy;
+};
+
+/*!
+* The secondary file baseName.overflow that the eOverflowSpill
+* policy writes to synchronously, opened on the first line.
+*/
+class LogOverflowFile {
+public:
+    LogOverflowFile(const std::string &baseName, size_t rollSize)
+        : _base_name(baseName), _roll_size(rollSize), _mutex(), _file()
+    {}
+
+    void append(const char* line, size_t len);
+
+    void flush();
+private:
+    const std::string                     _base_name;
+    const size_t                          _roll_size;
+    Mutex                                 _mutex;
+    std::unique_ptr<LogFile<NullMutex> >  _file;  //!< under _mutex
+};
+
+}
+
+}
+#endif
@@ -0,0 +1,161 @@
+#include <fermat/common/log_buffer.h>
+#include <sys/mman.h>
+#include <new>
+
+namespace fermat {
+
+static const size_t kPageSize = 4096;
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+size_t LogBufferPool::buffer_size(size_t bufferSize)
+{
+    if (bufferSize < kMinBufferSize) {
+        bufferSize = kMinBufferSize;
+    } else if (bufferSize > kMaxBufferSize) {
+        bufferSize = kMaxBufferSize;
+    }
+    return round_up(bufferSize, kPageSize);
+}
+
+LogBufferPool::LogBufferPool(size_t bufferSize, size_t count, bool hugePages)
+    : _buffer_size(buffer_size(bufferSize)),
+      _count(count),
+      _huge_pages(false),
+      _region(NULL),
+      _region_size(0),
+      _buffers(NULL),
+      _mutex(),
+      _free(NULL),
+      _retired(NULL),
+      _in_use(0),
+      _heap_in_use(0),
+      _heap_bytes(0)
+{
+    if (_count == 0) {
+        return;
+    }
+    _region_size = _buffer_size * _count;
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugePages) {
+        // reserved up front: a huge page missing at fault time is a SIGBUS
+        size_t size = round_up(_region_size, kHugePageSize);
+        p = ::mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            _region_size = size;
+            _huge_pages = true;
+        }
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = ::mmap(NULL, _region_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugePages) {
+            ::madvise(p, _region_size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    _region = static_cast<char*>(p);
+    _buffers = new LogBuffer[_count];
+    // linked back to front so get() hands out the lowest addresses first
+    for (size_t i = _count; i > 0; --i) {
+        LogBuffer &b = _buffers[i - 1];
+        b._data = _region + (i - 1) * _buffer_size;
+        b._capacity = _buffer_size;
+        b._next = _free;
+        _free = &b;
+    }
+}
+
+LogBufferPool::~LogBufferPool()
+{
+    reclaim();
+    delete [] _buffers;
+    if (_region) {
+        ::munmap(_region, _region_size);
+    }
+}
+
+LogBuffer* LogBufferPool::get()
+{
+    ScopedMutex lock(_mutex);
+    LogBuffer *b = _free;
+    if (b) {
+        _free = b->_next;
+        b->_next = NULL;
+        ++_in_use;
+    }
+    return b;
+}
+
+LogBuffer* LogBufferPool::get_heap(size_t capacity)
+{
+    size_t size = capacity > _buffer_size ? capacity : _buffer_size;
+    LogBuffer *b = new LogBuffer;
+    b->_data = new char[size];
+    b->_capacity = size;
+    b->_heap = true;
+    ScopedMutex lock(_mutex);
+    ++_in_use;
+    ++_heap_in_use;
+    _heap_bytes += size;
+    return b;
+}
+
+void LogBufferPool::put(LogBuffer *buf)
+{
+    if (buf->_heap) {
+        ScopedMutex lock(_mutex);
+        buf->_next = _retired;
+        _retired = buf;
+        --_in_use;
+        --_heap_in_use;
+        _heap_bytes -= buf->_capacity;
+        return;
+    }
+    buf->_size = 0;
+    ScopedMutex lock(_mutex);
+    buf->_next = _free;
+    _free = buf;
+    --_in_use;
+}
+
+void LogBufferPool::reclaim()
+{
+    LogBuffer *b = NULL;
+    {
+        ScopedMutex lock(_mutex);
+        b = _retired;
+        _retired = NULL;
+    }
+    while (b) {
+        LogBuffer *next = b->_next;
+        delete [] b->_data;
+        delete b;
+        b = next;
+    }
+}
+
+size_t LogBufferPool::in_use()
+{
+    ScopedMutex lock(_mutex);
+    return _in_use;
+}
+
+size_t LogBufferPool::bytes_in_use()
+{
+    ScopedMutex lock(_mutex);
+    return (_in_use - _heap_in_use) * _buffer_size + _heap_bytes;
+}
+
+}
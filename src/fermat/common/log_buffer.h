@@ -0,0 +1,203 @@
+#ifndef FERMAT_COMMON_LOG_BUFFER_H_
+#define FERMAT_COMMON_LOG_BUFFER_H_
+#include <fermat/common/mutex.h>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+
+namespace fermat {
+
+class LogBufferPool;
+class LogBufferList;
+
+/*!
+* A fixed size block of log lines handed from producers to the
+* backend of an async output. It never grows, callers check
+* avail() before append(). Buffers belong to a LogBufferPool and
+* go back to it with their contents left as they are: clear()
+* only resets the size.
+*/
+class LogBuffer {
+public:
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    size_t avail() const { return _capacity - _size; }
+
+    void append(const char* line, size_t len)
+    {
+        memcpy(_data + _size, line, len);
+        _size += len;
+    }
+
+    void clear() { _size = 0; }
+private:
+    friend class LogBufferPool;
+    friend class LogBufferList;
+
+    LogBuffer() : _data(NULL), _size(0), _capacity(0), _heap(false), _next(NULL), _link(NULL) {}
+    LogBuffer(const LogBuffer&);
+    LogBuffer& operator=(const LogBuffer&);
+
+    char       *_data;
+    size_t      _size;
+    size_t      _capacity;
+    bool        _heap;   //!< made by get_heap(), freed by reclaim()
+    LogBuffer  *_next;   //!< free list link
+    std::atomic<LogBuffer*> _link;  //!< LogBufferList link
+};
+
+/*!
+* First in first out list of LogBuffers, linked through the
+* buffers, for the queues of the async outputs. It is changed
+* under the owner's mutex only, but the links are atomic and set
+* before a buffer is reachable, so crash_flush() may walk it from
+* a signal handler without the lock: there is no array to be
+* reallocated under the walk. A walk racing take_all() may read
+* buffers the backend is writing or has given back to the pool;
+* pool buffers stay mapped until the pool goes, heap ones until
+* the backend's next LogBufferPool::reclaim().
+*/
+class LogBufferList {
+public:
+    LogBufferList() : _head(NULL), _tail(NULL), _size(0) {}
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+
+    void push_back(LogBuffer *buf)
+    {
+        buf->_link.store(NULL, std::memory_order_relaxed);
+        if (_tail) {
+            _tail->_link.store(buf, std::memory_order_release);
+        } else {
+            _head.store(buf, std::memory_order_release);
+        }
+        _tail = buf;
+        ++_size;
+    }
+
+    /*!
+    * Moves every buffer, oldest first, to the back of out.
+    */
+    void take_all(std::vector<LogBuffer*> &out)
+    {
+        for (LogBuffer *b = front(); b; b = next(b)) {
+            out.push_back(b);
+        }
+        _head.store(NULL, std::memory_order_release);
+        _tail = NULL;
+        _size = 0;
+    }
+
+    /*!
+    * Walk with front() and next(), from a signal handler too.
+    */
+    LogBuffer* front() const { return _head.load(std::memory_order_acquire); }
+    static LogBuffer* next(const LogBuffer *buf)
+    {
+        return buf->_link.load(std::memory_order_acquire);
+    }
+private:
+    LogBufferList(const LogBufferList&);
+    LogBufferList& operator=(const LogBufferList&);
+private:
+    std::atomic<LogBuffer*>  _head;
+    LogBuffer               *_tail;
+    size_t                   _size;
+};
+
+/*!
+* Preallocated LogBuffers, carved out of one mmap'ed region.
+* The region is only reserved: the kernel backs a page when a
+* buffer first touches it, so a large pool costs memory only as
+* far as it is used. Free buffers are reused last in first out,
+* which keeps the recently used, already faulted in ones hot.
+* With huge pages the region is first mapped with MAP_HUGETLB,
+* then, if no huge pages are reserved, as normal pages with
+* madvise(MADV_HUGEPAGE). get() and put() take a mutex, they
+* run once per buffer, not per line.
+*/
+class LogBufferPool {
+public:
+    static const size_t kMinBufferSize = 4096;
+    static const size_t kMaxBufferSize = 64 * 1024 * 1024;
+
+    /*!
+    * @param bufferSize clamped to [kMinBufferSize, kMaxBufferSize]
+    *        and rounded up to a multiple of 4096.
+    */
+    LogBufferPool(size_t bufferSize, size_t count, bool hugePages = false);
+    ~LogBufferPool();
+
+    /*!
+    * @return a preallocated buffer, NULL if all are in use.
+    */
+    LogBuffer* get();
+
+    /*!
+    * @return a buffer of at least capacity bytes on the heap,
+    * for lines larger than buffer_size() or a pool run dry.
+    */
+    LogBuffer* get_heap(size_t capacity);
+
+    /*!
+    * Takes back a buffer of get() or get_heap(). A heap buffer is
+    * only retired: crash_flush() may still be walking it, it is
+    * freed by the next reclaim().
+    */
+    void put(LogBuffer *buf);
+
+    /*!
+    * Frees the heap buffers put() since the last call. The
+    * backend calls it once per round, before it writes the
+    * round's buffers, so a buffer is freed a round after it left
+    * the list crash_flush() walks.
+    */
+    void reclaim();
+
+    size_t buffer_size() const { return _buffer_size; }
+
+    /*!
+    * @return the buffer size a pool made with bufferSize has.
+    */
+    static size_t buffer_size(size_t bufferSize);
+    size_t count() const { return _count; }
+
+    /*!
+    * @return the buffers given out and not put back, heap ones
+    * included.
+    */
+    size_t in_use();
+
+    /*!
+    * @return the capacity of the buffers given out and not put
+    * back, heap ones included.
+    */
+    size_t bytes_in_use();
+
+    /*!
+    * @return true if the region is mapped with MAP_HUGETLB.
+    */
+    bool huge_pages() const { return _huge_pages; }
+private:
+    LogBufferPool(const LogBufferPool&);
+    LogBufferPool& operator=(const LogBufferPool&);
+private:
+    const size_t   _buffer_size;
+    const size_t   _count;
+    bool           _huge_pages;
+    char          *_region;
+    size_t         _region_size;
+    LogBuffer     *_buffers;
+    Mutex          _mutex;
+    LogBuffer     *_free;
+    LogBuffer     *_retired;  //!< heap buffers waiting for reclaim()
+    size_t         _in_use;
+    size_t         _heap_in_use;
+    size_t         _heap_bytes;  //!< capacity of the heap buffers in use
+};
+
+}
+#endif
@@ -0,0 +1,218 @@
+#include <fermat/common/log_compressor.h>
+#include <fermat/common/this_thread.h>
+#include <fermat/common/timespan.h>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <memory>
+#ifdef FERMAT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace fermat {
+
+LogCompressor::LogCompressor()
+    : _level(1),
+      _rate_limit(kDefaultRateLimit),
+      _is_running(false),
+      _mutex(),
+      _cond(),
+      _files(),
+      _stats(),
+      _done_listener(),
+      _throttle_start(),
+      _throttle_bytes(0),
+      _guard(std::bind(&LogCompressor::add, this, std::placeholders::_1)),
+      _thread("log-compress")
+{
+}
+
+LogCompressor::~LogCompressor()
+{
+    _guard.reset();
+    stop();
+}
+
+bool LogCompressor::available()
+{
+#ifdef FERMAT_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LogCompressor::set_level(int level)
+{
+    _level = level < 1 ? 1 : (level > 9 ? 9 : level);
+}
+
+void LogCompressor::set_rate_limit(size_t bytesPerSecond)
+{
+    _rate_limit = bytesPerSecond;
+}
+
+bool LogCompressor::start()
+{
+    if (_is_running) {
+        return true;
+    }
+    _is_running = true;
+    _thread.start(std::bind(&LogCompressor::run, this));
+    return true;
+}
+
+void LogCompressor::stop()
+{
+    {
+        ScopedMutex lock(_mutex);
+        if (!_is_running) {
+            return;
+        }
+        _is_running = false;
+        _cond.signal();
+    }
+    _thread.join();
+}
+
+void LogCompressor::add(const std::string &fileName)
+{
+    ScopedMutex lock(_mutex);
+    _files.push_back(fileName);
+    _cond.signal();
+}
+
+LogRollListener LogCompressor::listener()
+{
+    return _guard.listener();
+}
+
+void LogCompressor::set_done_listener(const LogRollListener &listener)
+{
+    _done_listener = listener;
+}
+
+LogCompressor::Stats LogCompressor::stats()
+{
+    ScopedMutex lock(_mutex);
+    return _stats;
+}
+
+void LogCompressor::run()
+{
+    // nice 19 for this thread only, Linux keeps nice per thread
+    ::setpriority(PRIO_PROCESS, this_thread::thread_id(), 19);
+    while (true) {
+        std::string fileName;
+        {
+            ScopedMutex lock(_mutex);
+            while (_files.empty() && _is_running) {
+                _cond.wait(_mutex);
+            }
+            if (_files.empty()) {
+                break;
+            }
+            fileName.swap(_files.front());
+            _files.pop_front();
+        }
+        bool ok = compress(fileName);
+        if (_done_listener) {
+            _done_listener(ok ? fileName + ".gz" : fileName);
+        }
+    }
+}
+
+void LogCompressor::throttle(size_t bytes)
+{
+    if (_rate_limit == 0) {
+        return;
+    }
+    _throttle_bytes += bytes;
+    int64_t expect = static_cast<int64_t>(_throttle_bytes * 1000000 / _rate_limit);
+    int64_t ahead = expect - _throttle_start.elapsed();
+    if (ahead > 0) {
+        this_thread::sleep_for(Timespan(ahead));
+    }
+}
+
+#ifdef FERMAT_HAVE_ZLIB
+
+bool LogCompressor::compress(const std::string &fileName)
+{
+    static const size_t kChunk = 256 * 1024;
+    std::string gzName = fileName + ".gz";
+    std::string tmpName = gzName + ".tmp";
+    FILE *in = ::fopen(fileName.c_str(), "rb");
+    if (!in) {
+        ScopedMutex lock(_mutex);
+        ++_stats.failed;
+        return false;
+    }
+    char mode[4] = {'w', 'b', static_cast<char>('0' + _level), '\0'};
+    gzFile out = ::gzopen(tmpName.c_str(), mode);
+    if (!out) {
+        ::fclose(in);
+        ScopedMutex lock(_mutex);
+        ++_stats.failed;
+        return false;
+    }
+    ::gzbuffer(out, kChunk);
+
+    std::unique_ptr<char[]> buf(new char[kChunk]);
+    uint64_t inBytes = 0;
+    int64_t throttled = 0;
+    bool ok = true;
+    _throttle_start.update();
+    _throttle_bytes = 0;
+    Timestamp begin;
+    size_t n;
+    while ((n = ::fread(buf.get(), 1, kChunk, in)) > 0) {
+        if (::gzwrite(out, buf.get(), static_cast<unsigned>(n)) != static_cast<int>(n)) {
+            ok = false;
+            break;
+        }
+        inBytes += n;
+        Timestamp sleepBegin;
+        throttle(n);
+        throttled += sleepBegin.elapsed();
+    }
+    ok = !::ferror(in) && ok;
+    ::fclose(in);
+    ok = ::gzclose(out) == Z_OK && ok;
+    if (ok) {
+        ok = ::rename(tmpName.c_str(), gzName.c_str()) == 0 &&
+             ::unlink(fileName.c_str()) == 0;
+    }
+    if (!ok) {
+        ::unlink(tmpName.c_str());
+    }
+
+    struct stat st;
+    uint64_t outBytes = ok && ::stat(gzName.c_str(), &st) == 0 ? st.st_size : 0;
+    ScopedMutex lock(_mutex);
+    if (ok) {
+        ++_stats.files;
+        _stats.in_bytes += inBytes;
+        _stats.out_bytes += outBytes;
+        _stats.micro_seconds += begin.elapsed() - throttled;
+    } else {
+        ++_stats.failed;
+    }
+    return ok;
+}
+
+#else
+
+bool LogCompressor::compress(const std::string &fileName)
+{
+    (void)fileName;
+    ScopedMutex lock(_mutex);
+    ++_stats.failed;
+    return false;
+}
+
+#endif
+
+} //namespace fermat
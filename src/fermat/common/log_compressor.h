@@ -0,0 +1,112 @@
+#ifndef FERMAT_COMMON_LOG_COMPRESSOR_H_
+#define FERMAT_COMMON_LOG_COMPRESSOR_H_
+#include <fermat/common/log_file.h>
+#include <fermat/common/mutex.h>
+#include <fermat/common/cond.h>
+#include <fermat/common/thread.h>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <string>
+
+namespace fermat {
+
+/*!
+* Gzips rolled log files on a background thread and removes
+* the originals: name.log becomes name.log.gz. The thread runs
+* at the lowest nice level and reads no more than the rate
+* limit, so it does not compete with the threads that log.
+* Needs zlib at build time (FERMAT_HAVE_ZLIB), without it
+* available() is false and files are left as they are.
+*
+* Typical use:
+*   LogCompressor compressor;
+*   compressor.start();
+*   async->set_roll_listener(compressor.listener());
+*/
+class LogCompressor {
+public:
+    static const size_t kDefaultRateLimit = 32 * 1024 * 1024;
+
+    struct Stats {
+        uint64_t  files;
+        uint64_t  failed;
+        uint64_t  in_bytes;
+        uint64_t  out_bytes;
+        int64_t   micro_seconds;  //!< spent compressing, throttling excluded
+    };
+
+    LogCompressor();
+    ~LogCompressor();
+
+    /*!
+    * @return true if the library was built with zlib.
+    */
+    static bool available();
+
+    /*!
+    * Sets the zlib level, 1 (fastest, default) to 9.
+    */
+    void set_level(int level);
+
+    /*!
+    * Caps the bytes read per second, kDefaultRateLimit by
+    * default, 0 means no limit.
+    */
+    void set_rate_limit(size_t bytesPerSecond);
+
+    bool start();
+
+    /*!
+    * Compresses the files still queued, then stops the thread.
+    */
+    void stop();
+
+    /*!
+    * Queues fileName for compression, callable from any thread.
+    */
+    void add(const std::string &fileName);
+
+    /*!
+    * @return a roll listener that queues rolled files here. It
+    * may outlive the compressor, files rolled after that are
+    * left uncompressed.
+    */
+    LogRollListener listener();
+
+    /*!
+    * Sets the listener told about every file the thread is done
+    * with: name.gz once compressed, or name if compression
+    * failed. Used to chain a LogRetention. Must be called before
+    * start().
+    */
+    void set_done_listener(const LogRollListener &listener);
+
+    /*!
+    * Compresses fileName to fileName.gz on the calling thread,
+    * and removes fileName on success.
+    */
+    bool compress(const std::string &fileName);
+
+    Stats stats();
+
+    void run();
+private:
+    void throttle(size_t bytes);
+private:
+    int                      _level;
+    size_t                   _rate_limit;
+    bool                     _is_running;
+    Mutex                    _mutex;
+    Cond                     _cond;
+    std::deque<std::string>  _files;
+    Stats                    _stats;
+    LogRollListener          _done_listener;
+    Timestamp                _throttle_start;
+    uint64_t                 _throttle_bytes;
+    LogRollGuard             _guard;
+    Thread                   _thread;
+};
+
+}
+#endif
@@ -0,0 +1,137 @@
+#include <fermat/common/log_crash.h>
+#include <fermat/common/logging.h>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <execinfo.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fermat {
+
+static const int kSignals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+static const int kSignalCount = sizeof(kSignals) / sizeof(kSignals[0]);
+static const int kMaxFrames = 64;
+static const size_t kAltStackSize = 64 * 1024;
+
+static char g_alt_stack[kAltStackSize];
+static std::atomic<int> g_crashing(0);
+
+static const char* signal_name(int sig)
+{
+    switch (sig) {
+        case SIGSEGV: return "SIGSEGV";
+        case SIGBUS:  return "SIGBUS";
+        case SIGILL:  return "SIGILL";
+        case SIGFPE:  return "SIGFPE";
+        case SIGABRT: return "SIGABRT";
+        default:      return "signal";
+    }
+}
+
+// "*** SIGSEGV (11) received by thread 1234, backtrace:\n"
+static size_t format_header(char *buf, int sig, pid_t tid)
+{
+    char *p = buf;
+    const char* parts[] = {"*** ", signal_name(sig), " ("};
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+        size_t len = strlen(parts[i]);
+        memcpy(p, parts[i], len);
+        p += len;
+    }
+    int values[] = {sig, static_cast<int>(tid)};
+    const char* after[] = {") received by thread ", ", backtrace:\n"};
+    for (int i = 0; i < 2; ++i) {
+        char digits[16];
+        int n = 0;
+        unsigned int v = static_cast<unsigned int>(values[i]);
+        do {
+            digits[n++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v);
+        while (n > 0) {
+            *p++ = digits[--n];
+        }
+        size_t len = strlen(after[i]);
+        memcpy(p, after[i], len);
+        p += len;
+    }
+    return static_cast<size_t>(p - buf);
+}
+
+static void crash_handler(int sig, siginfo_t*, void*)
+{
+    // a second thread crashing meanwhile waits for the first to
+    // take the process down
+    if (g_crashing.exchange(1) != 0) {
+        while (true) {
+            ::pause();
+        }
+    }
+    int fd = Logging::crash_flush();
+
+    char header[128];
+    size_t len = format_header(header, sig, static_cast<pid_t>(::syscall(SYS_gettid)));
+    void *frames[kMaxFrames];
+    int n = ::backtrace(frames, kMaxFrames);
+    if (fd >= 0 && fd != STDERR_FILENO) {
+        LogCrashHandler::write_fully(fd, header, len);
+        ::backtrace_symbols_fd(frames, n, fd);
+        ::fsync(fd);
+    }
+    LogCrashHandler::write_fully(STDERR_FILENO, header, len);
+    ::backtrace_symbols_fd(frames, n, STDERR_FILENO);
+
+    ::signal(sig, SIG_DFL);
+    ::raise(sig);
+}
+
+bool LogCrashHandler::install()
+{
+    // the first backtrace() loads libgcc, which allocates
+    void *frames[1];
+    ::backtrace(frames, 1);
+
+    stack_t ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_sp = g_alt_stack;
+    ss.ss_size = sizeof(g_alt_stack);
+    ::sigaltstack(&ss, NULL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = crash_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    bool ok = true;
+    for (int i = 0; i < kSignalCount; ++i) {
+        ok = ::sigaction(kSignals[i], &sa, NULL) == 0 && ok;
+    }
+    return ok;
+}
+
+void LogCrashHandler::uninstall()
+{
+    for (int i = 0; i < kSignalCount; ++i) {
+        ::signal(kSignals[i], SIG_DFL);
+    }
+}
+
+bool LogCrashHandler::write_fully(int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,42 @@
+#ifndef FERMAT_COMMON_LOG_CRASH_H_
+#define FERMAT_COMMON_LOG_CRASH_H_
+#include <cstddef>
+
+namespace fermat {
+
+/*!
+* Handler for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT that
+* saves what the async log outputs still hold in memory: it calls
+* Logging::crash_flush(), so the current output writes its
+* pending lines to its log file with raw write(2), then writes
+* the signal and a backtrace to that file and to stderr, and
+* re-raises the signal with the default action. The handler takes
+* no lock and allocates nothing. Function names in the backtrace
+* need the program linked with -rdynamic.
+*
+* Typical use, once at startup:
+*   LogCrashHandler::install();
+*/
+class LogCrashHandler {
+public:
+    /*!
+    * Installs the handler, and an alternate signal stack for
+    * the calling thread so a stack overflow there is caught too.
+    * @return false if a sigaction call failed.
+    */
+    static bool install();
+
+    /*!
+    * Restores the default action of the handled signals.
+    */
+    static void uninstall();
+
+    /*!
+    * write(2) until len bytes are written or it fails,
+    * async-signal-safe.
+    */
+    static bool write_fully(int fd, const char* data, size_t len);
+};
+
+}
+#endif
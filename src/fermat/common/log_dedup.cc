@@ -0,0 +1,182 @@
+#include <fermat/common/log_dedup.h>
+#include <fermat/common/logging.h>
+#include <fermat/common/timestamp.h>
+#include <cstring>
+
+namespace fermat {
+
+// the time prefix "YYYYMMDD HH:MM:SS.uuuuuuZ "
+static const size_t kTimeSize = 26;
+
+LogDedup::LogDedup(Timespan window, size_t slots)
+    : _window(window.total_micro_seconds()),
+      _slots(),
+      _mask(0),
+      _notes(),
+      _dropped_lines(0),
+      _dropped_bytes(0)
+{
+    size_t count = 1;
+    while (count < slots) {
+        count <<= 1;
+    }
+    Slot empty = {0, 0, 0, std::string()};
+    _slots.assign(count, empty);
+    _mask = count - 1;
+}
+
+// where the part of a line that repeats starts, 0 if the line
+// has no prefix this knows
+size_t LogDedup::key_offset(const char* line, size_t len)
+{
+    if (len > kTimeSize && line[kTimeSize - 2] == 'Z' && line[kTimeSize - 1] == ' ') {
+        // text: the time, then the thread id and a blank
+        const char* p = static_cast<const char*>(memchr(line + kTimeSize, ' ', len - kTimeSize));
+        return p ? static_cast<size_t>(p + 1 - line) : 0;
+    }
+    if (len > 0 && line[0] == '{') {
+        // JSON: {"time":"...","tid":N,
+        static const char kTid[] = "\"tid\":";
+        const char* end = line + len;
+        const char* p = static_cast<const char*>(memchr(line, ',', len));
+        if (p && static_cast<size_t>(end - p) > sizeof(kTid) &&
+            memcmp(p + 1, kTid, sizeof(kTid) - 1) == 0) {
+            p = static_cast<const char*>(memchr(p + 1, ',', static_cast<size_t>(end - p - 1)));
+            return p ? static_cast<size_t>(p + 1 - line) : 0;
+        }
+    }
+    return 0;
+}
+
+// eight bytes per multiply
+uint64_t LogDedup::hash(const char* data, size_t len)
+{
+    const uint64_t kMul = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = len * kMul;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, data, 8);
+        h = (h ^ w) * kMul;
+        h ^= h >> 29;
+        data += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, data, len);
+    h = (h ^ w) * kMul;
+    return h ^ (h >> 32);
+}
+
+void LogDedup::note(Slot &slot, int64_t now, std::vector<struct iovec> &iov)
+{
+    char buf[128];
+    size_t n = Logging::format_note(buf, sizeof buf, now,
+                                    "Message repeated %llu times in the last %lld ms: ",
+                                    static_cast<unsigned long long>(slot.count),
+                                    static_cast<long long>((now - slot.first) / 1000));
+    _notes.push_back(std::string());
+    std::string &text = _notes.back();
+    text.reserve(n + slot.line.size());
+    text.append(buf, n);
+    text.append(slot.line);
+    struct iovec v;
+    v.iov_base = const_cast<char*>(text.data());
+    v.iov_len = text.size();
+    iov.push_back(v);
+    slot.count = 0;
+}
+
+// the slot holding h inside its window, else a slot to take for
+// h: empty or out of its window; NULL if both candidates are busy
+LogDedup::Slot* LogDedup::find(uint64_t h, int64_t now)
+{
+    Slot *first = &_slots[h & _mask];
+    Slot *second = &_slots[(h >> 32) & _mask];
+    Slot *candidates[2] = {first, second};
+    Slot *free = NULL;
+    for (int i = 0; i < 2; ++i) {
+        Slot *slot = candidates[i];
+        bool live = !slot->line.empty() && now - slot->first < _window;
+        if (live && slot->hash == h) {
+            return slot;
+        }
+        if (!live && !free) {
+            free = slot;
+        }
+    }
+    return free;
+}
+
+void LogDedup::filter(const char* data, size_t len, int64_t now, std::vector<struct iovec> &iov)
+{
+    const char* end = data + len;
+    const char* run = data;   // start of the lines kept not in iov yet
+    const char* line = data;
+    while (line < end) {
+        const char* nl = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+        const char* next = nl ? nl + 1 : end;
+        size_t lineLen = static_cast<size_t>(next - line);
+        size_t key = key_offset(line, lineLen);
+        if (key == 0) {
+            line = next;
+            continue;
+        }
+        uint64_t h = hash(line + key, lineLen - key);
+        Slot *slot = find(h, now);
+        if (slot && slot->hash == h && !slot->line.empty()) {
+            // a repeat: close the run before it and skip it
+            if (line > run) {
+                struct iovec v;
+                v.iov_base = const_cast<char*>(run);
+                v.iov_len = static_cast<size_t>(line - run);
+                iov.push_back(v);
+            }
+            ++slot->count;
+            ++_dropped_lines;
+            _dropped_bytes += lineLen;
+            run = next;
+        } else if (slot) {
+            if (slot->count > 0) {
+                // the note goes before the line that takes the slot
+                if (line > run) {
+                    struct iovec v;
+                    v.iov_base = const_cast<char*>(run);
+                    v.iov_len = static_cast<size_t>(line - run);
+                    iov.push_back(v);
+                    run = line;
+                }
+                note(*slot, now, iov);
+            }
+            slot->hash = h;
+            slot->first = now;
+            size_t keep = lineLen - key < kMaxNoteLine ? lineLen - key : kMaxNoteLine;
+            slot->line.assign(line + key, keep);
+            if (slot->line[slot->line.size() - 1] != '\n') {
+                slot->line.push_back('\n');
+            }
+        }
+        line = next;
+    }
+    if (end > run) {
+        struct iovec v;
+        v.iov_base = const_cast<char*>(run);
+        v.iov_len = static_cast<size_t>(end - run);
+        iov.push_back(v);
+    }
+}
+
+void LogDedup::expire(int64_t now, std::vector<struct iovec> &iov, bool all)
+{
+    for (size_t i = 0; i < _slots.size(); ++i) {
+        Slot &slot = _slots[i];
+        if (!slot.line.empty() && (all || now - slot.first >= _window)) {
+            if (slot.count > 0) {
+                note(slot, now, iov);
+            }
+            // the next one is written, not counted
+            slot.line.clear();
+        }
+    }
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef FERMAT_COMMON_LOG_DEDUP_H_
+#define FERMAT_COMMON_LOG_DEDUP_H_
+#include <fermat/common/timespan.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+namespace fermat {
+
+/*!
+* The repeated-line filter of an async backend. Each line is
+* hashed without its time and thread id, so what remains is the
+* level, the call site and the message. A line whose hash was
+* seen less than the window ago is dropped and counted; once the
+* window of the first one is over, one line
+* "Message repeated N times in the last T ms: <line>" replaces
+* the dropped ones. Each line has two candidate slots in a fixed
+* table and takes one only when it is free or its window is over,
+* so a storm keeps its slot while other lines go by; a line with
+* both slots busy is written and not tracked.
+*
+* It reads text lines as Logging writes them, in the text or the
+* JSON format; other lines pass through.
+*/
+class LogDedup {
+public:
+    static const size_t kDefaultSlots = 256;
+    static const size_t kMaxNoteLine = 256;
+
+    explicit LogDedup(Timespan window, size_t slots = kDefaultSlots);
+
+    /*!
+    * Appends to iov the parts of data, whole lines, to write:
+    * the runs of lines kept and the notes of repeats that ended.
+    * @param now micro seconds since the epoch.
+    */
+    void filter(const char* data, size_t len, int64_t now, std::vector<struct iovec> &iov);
+
+    /*!
+    * Appends to iov the notes of the repeats whose window is
+    * over, or of all repeats if all is set.
+    */
+    void expire(int64_t now, std::vector<struct iovec> &iov, bool all = false);
+
+    /*!
+    * Frees the notes, once the iovecs pointing to them are written.
+    */
+    void clear_notes() { _notes.clear(); }
+
+    uint64_t dropped_lines() const { return _dropped_lines; }
+    uint64_t dropped_bytes() const { return _dropped_bytes; }
+private:
+    struct Slot {
+        uint64_t     hash;
+        uint64_t     count;      //!< lines dropped since first
+        int64_t      first;
+        std::string  line;       //!< the key part of the line, cut
+    };
+
+    Slot* find(uint64_t h, int64_t now);
+    static size_t key_offset(const char* line, size_t len);
+    static uint64_t hash(const char* data, size_t len);
+    void note(Slot &slot, int64_t now, std::vector<struct iovec> &iov);
+private:
+    const int64_t            _window;
+    std::vector<Slot>        _slots;
+    size_t                   _mask;
+    std::deque<std::string>  _notes;   //!< stable addresses for iov
+    uint64_t                 _dropped_lines;
+    uint64_t                 _dropped_bytes;
+};
+
+}
+#endif
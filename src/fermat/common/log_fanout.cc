@@ -0,0 +1,251 @@
+#include <fermat/common/log_fanout.h>
+#include <fermat/common/log_crash.h>
+#include <cstdio>
+
+namespace fermat {
+
+LogFanout::LogFanout()
+    : LogOutput("fanout_log"),
+      _sinks(),
+      _min_level(Logging::eNUM_LOG_LEVELS)
+{
+
+}
+
+LogFanout::~LogFanout()
+{
+
+}
+
+bool LogFanout::add_sink(const LogOutputPtr &sink, Logging::LogLevel level)
+{
+    if (!sink || sink->binary()) {
+        return false;
+    }
+    Sink s;
+    s.output = sink;
+    s.level = level;
+    _sinks.push_back(s);
+    if (level < _min_level) {
+        _min_level = level;
+    }
+    return true;
+}
+
+void LogFanout::puts(const char* line, size_t len)
+{
+    puts_level(Logging::eINFO, line, len);
+}
+
+void LogFanout::puts_level(int level, const char* line, size_t len)
+{
+    if (level < _min_level) {
+        return;
+    }
+    for (size_t i = 0; i < _sinks.size(); ++i) {
+        if (level >= _sinks[i].level) {
+            _sinks[i].output->puts_level(level, line, len);
+        }
+    }
+}
+
+void LogFanout::flush()
+{
+    for (size_t i = 0; i < _sinks.size(); ++i) {
+        _sinks[i].output->flush();
+    }
+}
+
+int LogFanout::crash_flush()
+{
+    int fd = -1;
+    for (size_t i = 0; i < _sinks.size(); ++i) {
+        int sinkFd = _sinks[i].output->crash_flush();
+        if (fd < 0) {
+            fd = sinkFd;
+        }
+    }
+    return fd;
+}
+
+LogFdOutput::LogFdOutput(int fd)
+    : LogOutput("fd_log"),
+      _fd(fd)
+{
+
+}
+
+void LogFdOutput::puts(const char* line, size_t len)
+{
+    LogCrashHandler::write_fully(_fd, line, len);
+}
+
+void LogFdOutput::flush()
+{
+
+}
+
+int LogFdOutput::crash_flush()
+{
+    return _fd;
+}
+
+LogQueueOutput::LogQueueOutput(const LogOutputPtr &target,
+                               size_t bufferSize,
+                               size_t buffers,
+                               int flushInterval)
+    : LogOutput("queue_log"),
+      _target(target),
+      _flush_interval(flushInterval),
+      _is_running(false),
+      _pool(bufferSize, buffers > 2 ? buffers : 2),
+      _mutex(),
+      _cond(),
+      _current(NULL),
+      _buffers(),
+      _dropped_lines(0),
+      _reported_lines(0),
+      _thread("queue-log")
+{
+    _current = _pool.get();
+}
+
+LogQueueOutput::~LogQueueOutput()
+{
+    stop();
+    _pool.put(_current);
+}
+
+void LogQueueOutput::puts(const char* line, size_t len)
+{
+    if (!_is_running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    ScopedMutex lock(_mutex);
+    if (len < _current->avail()) {
+        _current->append(line, len);
+        return;
+    }
+    LogBuffer *buf = len < _pool.buffer_size() ? _pool.get() : _pool.get_heap(len);
+    if (!buf) {
+        _dropped_lines.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    _buffers.push_back(_current);
+    _current = buf;
+    _current->append(line, len);
+    _cond.signal();
+}
+
+void LogQueueOutput::flush()
+{
+    ScopedMutex lock(_mutex);
+    if (_current->size() == 0) {
+        return;
+    }
+    // with no buffer free the thread is busy and takes _current next
+    if (LogBuffer *buf = _pool.get()) {
+        _buffers.push_back(_current);
+        _current = buf;
+    }
+    _cond.signal();
+}
+
+int LogQueueOutput::crash_flush()
+{
+    int fd = _target->crash_flush();
+    if (fd < 0) {
+        return fd;
+    }
+    for (LogBuffer *b = _buffers.front(); b; b = LogBufferList::next(b)) {
+        LogCrashHandler::write_fully(fd, b->data(), b->size());
+    }
+    if (LogBuffer *current = _current) {
+        LogCrashHandler::write_fully(fd, current->data(), current->size());
+    }
+    return fd;
+}
+
+uint64_t LogQueueOutput::dropped_lines() const
+{
+    return _dropped_lines.load(std::memory_order_relaxed);
+}
+
+void LogQueueOutput::write_dropped()
+{
+    uint64_t dropped = _dropped_lines.load(std::memory_order_relaxed);
+    uint64_t reported = _reported_lines.load(std::memory_order_relaxed);
+    if (dropped == reported) {
+        return;
+    }
+    _reported_lines.store(dropped, std::memory_order_relaxed);
+    char buf[128];
+    int n = snprintf(buf, sizeof buf, "Dropped %llu lines, the output is behind\n",
+                     static_cast<unsigned long long>(dropped - reported));
+    _target->puts(buf, static_cast<size_t>(n));
+}
+
+void LogQueueOutput::run()
+{
+    BufferVector toWrite;
+    bool running = true;
+    while (running) {
+        {
+            ScopedMutex lock(_mutex);
+            if (_buffers.empty() && _is_running) {
+                _cond.wait(_mutex, Timespan(_flush_interval * 1000000LL));
+            }
+            running = _is_running;
+            // an idle queue still passes on what it has every interval
+            if (_current->size() > 0) {
+                LogBuffer *buf = _pool.get();
+                if (buf) {
+                    _buffers.push_back(_current);
+                    _current = buf;
+                }
+            }
+            _buffers.take_all(toWrite);
+        }
+        // heap buffers passed on last round, no longer on _buffers
+        _pool.reclaim();
+        for (size_t i = 0; i < toWrite.size(); ++i) {
+            _target->puts(toWrite[i]->data(), toWrite[i]->size());
+            _pool.put(toWrite[i]);
+        }
+        toWrite.clear();
+        write_dropped();
+        _target->flush();
+    }
+    // left when the pool had no buffer to swap in
+    ScopedMutex lock(_mutex);
+    if (_current->size() > 0) {
+        _target->puts(_current->data(), _current->size());
+        _current->clear();
+        _target->flush();
+    }
+}
+
+bool LogQueueOutput::start()
+{
+    if (_is_running) {
+        return true;
+    }
+    _is_running = true;
+    _thread.start(std::bind(&LogQueueOutput::run, this));
+    return true;
+}
+
+void LogQueueOutput::stop()
+{
+    {
+        ScopedMutex lock(_mutex);
+        if (!_is_running) {
+            return;
+        }
+        _is_running = false;
+        _cond.signal();
+    }
+    _thread.join();
+}
+
+}
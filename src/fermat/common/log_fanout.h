@@ -0,0 +1,139 @@
+#ifndef FERMAT_COMMON_LOG_FANOUT_H_
+#define FERMAT_COMMON_LOG_FANOUT_H_
+#include <fermat/common/logging.h>
+#include <fermat/common/log_buffer.h>
+#include <fermat/common/mutex.h>
+#include <fermat/common/cond.h>
+#include <fermat/common/thread.h>
+#include <memory>
+#include <vector>
+#include <atomic>
+
+namespace fermat {
+
+/*!
+* Passes every line to several sinks, each with its own minimum
+* level. Logging formats a line once and the same bytes go to
+* every sink that takes its level. Sinks must be text outputs.
+* The fan-out itself does not queue: give each sink its own
+* queue (a LogAsync, or a LogQueueOutput in front of a slow
+* sink) so one sink cannot hold up the others.
+*
+* Typical use:
+*   LogFanout *fan = new LogFanout();
+*   fan->add_sink(mainAsync, Logging::eTRACE);
+*   fan->add_sink(errorAsync, Logging::eERROR);
+*   fan->add_sink(stderrQueue, Logging::eWARN);
+*/
+class LogFanout : public LogOutput {
+public:
+    LogFanout();
+    virtual ~LogFanout();
+
+    /*!
+    * Adds sink for lines at level and above. Must be called
+    * before the fan-out is passed to Logging::set_output().
+    * @return false for a binary sink.
+    */
+    bool add_sink(const LogOutputPtr &sink, Logging::LogLevel level);
+
+    /*!
+    * A line with no level goes to the sinks that take eINFO.
+    */
+    virtual void puts(const char* line, size_t len);
+
+    virtual void puts_level(int level, const char* line, size_t len);
+
+    virtual void flush();
+
+    /*!
+    * Calls crash_flush() of every sink.
+    * @return the first descriptor a sink wrote to.
+    */
+    virtual int crash_flush();
+private:
+    struct Sink {
+        LogOutputPtr  output;
+        int           level;
+    };
+    std::vector<Sink>  _sinks;
+    int                _min_level;   //!< lowest level of all sinks
+};
+
+/*!
+* Writes lines to a file descriptor with write(2), stderr by
+* default. Meant to sit behind a LogQueueOutput.
+*/
+class LogFdOutput : public LogOutput {
+public:
+    explicit LogFdOutput(int fd = 2);
+
+    virtual void puts(const char* line, size_t len);
+    virtual void flush();
+    virtual int crash_flush();
+private:
+    int  _fd;
+};
+
+/*!
+* An async queue in front of any output: producers copy lines
+* into pooled buffers and a thread passes the full ones to the
+* target. It never blocks: when all buffers are queued the line
+* is dropped and counted, and the thread writes one "Dropped"
+* line to the target once it catches up.
+*/
+class LogQueueOutput : public LogOutput {
+public:
+    static const size_t kDefaultBufferSize = 64 * 1024;
+    static const size_t kDefaultBuffers = 16;
+
+    explicit LogQueueOutput(const LogOutputPtr &target,
+                            size_t bufferSize = kDefaultBufferSize,
+                            size_t buffers = kDefaultBuffers,
+                            int flushInterval = 1);
+    virtual ~LogQueueOutput();
+
+    virtual void puts(const char* line, size_t len);
+
+    /*!
+    * Hands the lines not yet queued to the thread and wakes it,
+    * without waiting for the target to get them.
+    */
+    virtual void flush();
+
+    /*!
+    * Calls the target's crash_flush(), then writes the queued
+    * lines to the descriptor it returned.
+    */
+    virtual int crash_flush();
+
+    bool start();
+
+    /*!
+    * Passes what is queued to the target, then stops the thread.
+    */
+    void stop();
+
+    uint64_t dropped_lines() const;
+
+    void run();
+private:
+    void write_dropped();
+private:
+    typedef std::vector<LogBuffer*> BufferVector;
+
+    LogOutputPtr           _target;
+    const int              _flush_interval;
+    std::atomic<bool>      _is_running;
+    LogBufferPool          _pool;
+    Mutex                  _mutex;
+    Cond                   _cond;
+    LogBuffer             *_current;
+    LogBufferList          _buffers;  //!< walked by crash_flush()
+    std::atomic<uint64_t>  _dropped_lines;
+    std::atomic<uint64_t>  _reported_lines;
+    Thread                 _thread;
+};
+
+}
+#endif
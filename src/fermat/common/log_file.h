@@ -2,13 +2,132 @@
 #define FERMAT_COMMON_LOG_FILE_H_
 #include <fermat/common/mutex.h>
 #include <fermat/common/timestamp.h>
+#include <fermat/common/timespan.h>
 #include <fermat/common/sequence_write_file.h>
+#include <fermat/common/mmap_write_file.h>
 #include <string>
 #include <memory>
+#include <functional>
+#include <atomic>
 
 namespace fermat {
 
-template <typename MUTEX>
+/*!
+* Called with the name of a log file after LogFile rolled away
+* from it and closed it.
+*/
+typedef std::function<void(const std::string &fileName)> LogRollListener;
+
+/*!
+* Hands out roll listeners that call target for an object the
+* LogFile may outlive, e.g. LogCompressor::add. The object calls
+* reset() in its destructor; it waits for a call in progress and
+* the listeners do nothing afterwards.
+*/
+class LogRollGuard {
+public:
+    explicit LogRollGuard(const LogRollListener &target)
+        : _state(std::make_shared<State>())
+    {
+        _state->target = target;
+    }
+
+    ~LogRollGuard() { reset(); }
+
+    LogRollListener listener() const
+    {
+        return std::bind(&LogRollGuard::call, _state, std::placeholders::_1);
+    }
+
+    void reset()
+    {
+        ScopedMutex lock(_state->mutex);
+        _state->target = LogRollListener();
+    }
+private:
+    struct State {
+        Mutex            mutex;
+        LogRollListener  target;
+    };
+
+    static void call(const std::shared_ptr<State> &state, const std::string &fileName)
+    {
+        ScopedMutex lock(state->mutex);
+        if (state->target) {
+            state->target(fileName);
+        }
+    }
+private:
+    std::shared_ptr<State>  _state;
+};
+
+/*!
+* How LogFile pushes what it wrote to the disk. flush() only
+* hands data to the kernel, which loses it on power failure.
+* eSyncNone:        leaves it to the kernel, the default.
+* eSyncInterval:    fdatasync(2) once interval passed since the
+*                   last one.
+* eSyncBytes:       fdatasync(2) once bytes were written since
+*                   the last one.
+* eSyncWriteBehind: starts writeback with sync_file_range(2) once
+*                   bytes were written, without waiting for it;
+*                   bounds the dirty pages, promises nothing.
+* Whether a sync is due is checked on flush(), after every
+* append(iov, cnt) batch and after append(line): every line for
+* the byte modes, every checkSize lines for eSyncInterval, which
+* reads the clock. The async outputs append and flush once per
+* batch, so one sync covers the batch. With eSyncInterval or
+* eSyncBytes a file is synced once more when it is rolled away
+* from or closed.
+*/
+struct LogSyncPolicy {
+    enum Mode {
+        eSyncNone,
+        eSyncInterval,
+        eSyncBytes,
+        eSyncWriteBehind
+    };
+
+    LogSyncPolicy()
+        : mode(eSyncNone), interval(0), bytes(0)
+    {}
+
+    LogSyncPolicy(Mode m, Timespan i, size_t b)
+        : mode(m), interval(i), bytes(b)
+    {}
+
+    static LogSyncPolicy every(Timespan interval)
+    {
+        return LogSyncPolicy(eSyncInterval, interval, 0);
+    }
+
+    static LogSyncPolicy every_bytes(size_t bytes)
+    {
+        return LogSyncPolicy(eSyncBytes, Timespan(0), bytes);
+    }
+
+    static LogSyncPolicy write_behind(size_t bytes)
+    {
+        return LogSyncPolicy(eSyncWriteBehind, Timespan(0), bytes);
+    }
+
+    /*!
+    * @return true if the data is waited for, not just sent.
+    */
+    bool durable() const { return mode == eSyncInterval || mode == eSyncBytes; }
+
+    Mode      mode;
+    Timespan  interval;
+    size_t    bytes;
+};
+
+/*!
+* WRITER is the file class written to, SequenceWriteFile
+* (stdio buffered) or MmapWriteFile (preallocated mapping);
+* both have the same append/flush/sync/write_behind/write_size/fd
+* interface.
+*/
+template <typename MUTEX, typename WRITER = SequenceWriteFile>
 class LogFile {
 public:
    LogFile(const std::string &name, 
@@ -19,11 +138,42 @@ public:
    ~LogFile();
    void append(const char* line, size_t len);
    void append(const std::string &line);
+   /*!
+   * Writes a batch of buffers with one writev(2) per file,
+   * rolling between buffers once the roll size is passed.
+   */
+   void append(const struct iovec *iov, int cnt);
    bool roll();
    void flush();
+   /*!
+   * Sets the listener told about every file this LogFile
+   * rolls away from, the file still being written is never
+   * passed. Called on the thread that appends.
+   */
+   void set_roll_listener(const LogRollListener &listener);
+
+   /*!
+   * Sets how written data is synced, see LogSyncPolicy.
+   */
+   void set_sync_policy(const LogSyncPolicy &policy);
+
+   /*!
+   * @return the syncs done and the time they took. Read without
+   * the lock, call them on the thread that appends.
+   */
+   uint64_t syncs() const { return _syncs; }
+   uint64_t sync_micro_seconds() const { return _sync_micro_seconds; }
+
+   /*!
+   * @return the descriptor of the file being written. Reads
+   * no lock, so a signal handler may call it; it may be a
+   * descriptor just closed if it runs while the file rolls.
+   */
+   int fd() const { return _fd.load(std::memory_order_relaxed); }
 
 private:
     void append_unlock(const char *line, size_t len);
+    void sync_unlock(bool force);
     std::string get_log_file_name(const Timestamp &stamp);
 private:
     const std::string                  _base_name;
@@ -34,10 +184,18 @@ private:
     MUTEX                              _mutex;
     Timestamp                          _last_roll;
     Timestamp                          _last_flush;
-    std::shared_ptr<SequenceWriteFile> _file;
+    std::shared_ptr<WRITER>            _file;
+    std::string                        _file_name;
+    LogRollListener                    _roll_listener;
+    std::atomic<int>                   _fd;
+    LogSyncPolicy                      _sync;
+    size_t                             _synced_size;  //!< write_size() at the last sync
+    Timestamp                          _last_sync;
+    uint64_t                           _syncs;
+    uint64_t                           _sync_micro_seconds;
 };
-template <typename MUTEX>
-inline LogFile<MUTEX>::LogFile(const std::string &name, 
+template <typename MUTEX, typename WRITER>
+inline LogFile<MUTEX, WRITER>::LogFile(const std::string &name, 
            const size_t rollSize,
            const int flushInterval,
            const int checkSize)
@@ -45,46 +203,91 @@ inline LogFile<MUTEX>::LogFile(const std::string &name,
       _roll_size(rollSize),
       _flush_step(flushInterval),
       _check_size(checkSize),
-      _count(0)
+      _count(0),
+      _fd(-1),
+      _sync(),
+      _synced_size(0),
+      _syncs(0),
+      _sync_micro_seconds(0)
 {
     roll();
 }
-template <typename MUTEX>
-inline LogFile<MUTEX>::~LogFile()
+template <typename MUTEX, typename WRITER>
+inline LogFile<MUTEX, WRITER>::~LogFile()
 {
-
+    if (_file && _sync.durable()) {
+        sync_unlock(true);
+    }
 }
 
-template <typename MUTEX>
-inline void LogFile<MUTEX>::append(const char* line, size_t len)
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::append(const char* line, size_t len)
 {
     ScopedLock<MUTEX> lock(_mutex);
     append_unlock(line, len);
 }
 
-template <typename MUTEX>
-inline void LogFile<MUTEX>::append(const std::string &line)
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::append(const std::string &line)
 {
     append(line.c_str(), line.length());
 }
 
-template <typename MUTEX>
-inline bool LogFile<MUTEX>::roll()
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::append(const struct iovec *iov, int cnt)
+{
+    ScopedLock<MUTEX> lock(_mutex);
+    int begin = 0;
+    size_t size = _file->write_size();
+    for (int i = 0; i < cnt; ++i) {
+        size += iov[i].iov_len;
+        if (size > _roll_size && i + 1 < cnt) {
+            _file->append(iov + begin, i + 1 - begin);
+            begin = i + 1;
+            roll();
+            size = _file->write_size();
+        }
+    }
+    _file->append(iov + begin, cnt - begin);
+    if (_file->write_size() > _roll_size) {
+        roll();
+    } else {
+        Timestamp now;
+        if (Timespan(now.total_micro_seconds()).days() != 
+            Timespan(_last_roll.total_micro_seconds()).days() ) {
+            roll();
+        }
+    }
+    sync_unlock(false);
+}
+
+template <typename MUTEX, typename WRITER>
+inline bool LogFile<MUTEX, WRITER>::roll()
 {
 	Timestamp t;
 	std::string filename = get_log_file_name(t);
 
 	if(t.seconds() > _last_roll.seconds() || !_file) {
+		if (_file && _sync.durable()) {
+			sync_unlock(true);
+		}
 		_last_roll = t;
 		_last_flush = t;
-		_file.reset(new SequenceWriteFile(filename));
+		_last_sync = t;
+		_file.reset(new WRITER(filename));
+		_synced_size = 0;
+		_fd.store(_file->fd(), std::memory_order_relaxed);
+		_file_name.swap(filename);
+		if (_roll_listener && !filename.empty()) {
+			_roll_listener(filename);
+		}
 		return true;
 	}
 	return false;	
 }
 
-template <typename MUTEX>
-inline void LogFile<MUTEX>::append_unlock(const char* logline, size_t len)
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::append_unlock(const char* logline, size_t len)
 {
 	_file->append(logline, len);
 	
@@ -102,19 +305,70 @@ inline void LogFile<MUTEX>::append_unlock(const char* logline, size_t len)
 				_last_flush = now;
 				_file->flush();
 		  	}
+		  	if (_sync.mode == LogSyncPolicy::eSyncInterval) {
+		  		sync_unlock(false);
+		  	}
 		}
 	}
+	if (_sync.mode == LogSyncPolicy::eSyncBytes ||
+	    _sync.mode == LogSyncPolicy::eSyncWriteBehind) {
+		sync_unlock(false);
+	}
 }
 
-template <typename MUTEX>
-inline void LogFile<MUTEX>::flush()
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::sync_unlock(bool force)
+{
+    size_t pending = _file->write_size() - _synced_size;
+    if (pending == 0 || _sync.mode == LogSyncPolicy::eSyncNone) {
+        return;
+    }
+    if (!force) {
+        if (_sync.mode == LogSyncPolicy::eSyncInterval) {
+            if (Timestamp() - _last_sync < _sync.interval.total_micro_seconds()) {
+                return;
+            }
+        } else if (pending < _sync.bytes) {
+            return;
+        }
+    }
+    Timestamp begin;
+    if (_sync.mode == LogSyncPolicy::eSyncWriteBehind) {
+        _file->write_behind();
+    } else {
+        _file->sync();
+    }
+    _last_sync.update();
+    _synced_size = _file->write_size();
+    ++_syncs;
+    _sync_micro_seconds += static_cast<uint64_t>(_last_sync - begin);
+}
+
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::flush()
 {
     ScopedLock<MUTEX> lock(_mutex);
 	_file->flush();
+	sync_unlock(false);
+}
+
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::set_roll_listener(const LogRollListener &listener)
+{
+    ScopedLock<MUTEX> lock(_mutex);
+    _roll_listener = listener;
+}
+
+template <typename MUTEX, typename WRITER>
+inline void LogFile<MUTEX, WRITER>::set_sync_policy(const LogSyncPolicy &policy)
+{
+    ScopedLock<MUTEX> lock(_mutex);
+    _sync = policy;
+    _last_sync.update();
 }
 
-template <typename MUTEX>
-inline std::string LogFile<MUTEX>::get_log_file_name(const Timestamp &stamp)
+template <typename MUTEX, typename WRITER>
+inline std::string LogFile<MUTEX, WRITER>::get_log_file_name(const Timestamp &stamp)
 {
     std::string filename;
 	filename.reserve(_base_name.size() + 64);
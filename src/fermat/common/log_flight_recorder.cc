@@ -0,0 +1,155 @@
+#include <fermat/common/log_flight_recorder.h>
+#include <fermat/common/log_crash.h>
+#include <fermat/common/log_stream.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fermat {
+
+LogFlightRecorder::LogFlightRecorder(const std::string &dumpName,
+                                     size_t slots,
+                                     size_t slotSize)
+    : LogOutput("flight_recorder"),
+      _dump_name(dumpName),
+      _slot_count(1),
+      _slot_size(slotSize < kMaxSlotSize ? slotSize : kMaxSlotSize),
+      _head(0),
+      _dumped(0),
+      _lost(0),
+      _dump_level(Logging::eERROR),
+      _fd(-1)
+{
+    while (_slot_count < slots) {
+        _slot_count <<= 1;
+    }
+    if (_slot_size < 2) {
+        _slot_size = 2;
+    }
+    _seqs.reset(new std::atomic<uint64_t>[_slot_count]);
+    for (size_t i = 0; i < _slot_count; ++i) {
+        _seqs[i].store(0, std::memory_order_relaxed);
+    }
+    _lens.reset(new uint32_t[_slot_count]);
+    _data.reset(new char[_slot_count * _slot_size]);
+    _fd = ::open(_dump_name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        fprintf(stderr, "LogFlightRecorder: open %s failed %d\n", _dump_name.c_str(), errno);
+    }
+}
+
+LogFlightRecorder::~LogFlightRecorder()
+{
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+void LogFlightRecorder::set_dump_level(Logging::LogLevel level)
+{
+    _dump_level.store(level, std::memory_order_relaxed);
+}
+
+void LogFlightRecorder::record(const char* line, size_t len)
+{
+    uint64_t seq = _head.fetch_add(1, std::memory_order_relaxed);
+    size_t idx = static_cast<size_t>(seq) & (_slot_count - 1);
+    // claim the slot, unless a thread a lap behind still writes
+    // it or one a lap ahead already took it
+    uint64_t prev = _seqs[idx].load(std::memory_order_relaxed);
+    if ((prev & 1) || prev > seq * 2 ||
+        !_seqs[idx].compare_exchange_strong(prev, seq * 2 + 1, std::memory_order_relaxed)) {
+        _lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    char* slot = _data.get() + idx * _slot_size;
+    if (len > _slot_size) {
+        // keep the line end
+        memcpy(slot, line, _slot_size - 1);
+        slot[_slot_size - 1] = '\n';
+        len = _slot_size;
+    } else {
+        memcpy(slot, line, len);
+    }
+    _lens[idx] = static_cast<uint32_t>(len);
+    _seqs[idx].store(seq * 2 + 2, std::memory_order_release);
+}
+
+void LogFlightRecorder::puts(const char* line, size_t len)
+{
+    puts_level(Logging::eINFO, line, len);
+}
+
+void LogFlightRecorder::puts_level(int level, const char* line, size_t len)
+{
+    record(line, len);
+    if (level >= _dump_level.load(std::memory_order_relaxed) || level == Logging::eFATAL) {
+        dump();
+    }
+}
+
+void LogFlightRecorder::flush()
+{
+}
+
+size_t LogFlightRecorder::dump()
+{
+    ScopedMutex lock(_dump_mutex);
+    return dump_unlocked();
+}
+
+// a seqlock read of every slot from the oldest line not dumped
+size_t LogFlightRecorder::dump_unlocked()
+{
+    if (_fd < 0) {
+        return 0;
+    }
+    uint64_t head = _head.load(std::memory_order_acquire);
+    uint64_t begin = _dumped.load(std::memory_order_relaxed);
+    if (head - begin > _slot_count) {
+        begin = head - _slot_count;
+    }
+    LogStream header;
+    header << "--- flight recorder: lines " << begin << " to " << head << " ---\n";
+    LogCrashHandler::write_fully(_fd, header.buffer().data(), header.buffer().size());
+    // lines are copied into batch, checked, and written in blocks
+    char batch[4 * kMaxSlotSize];
+    size_t used = 0;
+    size_t written = 0;
+    for (uint64_t seq = begin; seq < head; ++seq) {
+        size_t idx = static_cast<size_t>(seq) & (_slot_count - 1);
+        uint64_t before = _seqs[idx].load(std::memory_order_acquire);
+        if (before != seq * 2 + 2) {
+            continue;
+        }
+        size_t len = _lens[idx];
+        if (len > _slot_size) {
+            continue;
+        }
+        if (used + len > sizeof(batch)) {
+            LogCrashHandler::write_fully(_fd, batch, used);
+            used = 0;
+        }
+        memcpy(batch + used, _data.get() + idx * _slot_size, len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_seqs[idx].load(std::memory_order_relaxed) != before) {
+            continue;
+        }
+        used += len;
+        ++written;
+    }
+    LogCrashHandler::write_fully(_fd, batch, used);
+    _dumped.store(head, std::memory_order_relaxed);
+    return written;
+}
+
+int LogFlightRecorder::crash_flush()
+{
+    dump_unlocked();
+    return _fd;
+}
+
+}
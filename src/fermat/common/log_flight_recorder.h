@@ -0,0 +1,101 @@
+#ifndef FERMAT_COMMON_LOG_FLIGHT_RECORDER_H_
+#define FERMAT_COMMON_LOG_FLIGHT_RECORDER_H_
+#include <fermat/common/logging.h>
+#include <fermat/common/mutex.h>
+#include <memory>
+#include <string>
+#include <atomic>
+
+namespace fermat {
+
+/*!
+* Keeps the most recent lines in a fixed memory ring and does no
+* I/O until it is dumped. A line costs one fetch_add and a memcpy
+* into its slot; slots are fixed size, so longer lines are cut.
+* The lines not dumped yet are appended to the dump file when a
+* line at the dump level (eERROR by default) or eFATAL is logged,
+* when dump() is called, and from the fatal signal handler
+* through crash_flush().
+*
+* Set the global level to eTRACE so every line reaches the ring,
+* and put the recorder next to the usual output with a LogFanout:
+*   fan->add_sink(recorder, Logging::eTRACE);
+*   fan->add_sink(mainAsync, Logging::eWARN);
+*/
+class LogFlightRecorder : public LogOutput {
+public:
+    static const size_t kDefaultSlots = 16384;
+    static const size_t kDefaultSlotSize = 256;
+    static const size_t kMaxSlotSize = 4096;
+
+    /*!
+    * @param dumpName the file dumps are appended to.
+    * @param slots the lines kept, rounded up to a power of two.
+    * @param slotSize the longest line kept, at most kMaxSlotSize.
+    */
+    explicit LogFlightRecorder(const std::string &dumpName,
+                               size_t slots = kDefaultSlots,
+                               size_t slotSize = kDefaultSlotSize);
+    virtual ~LogFlightRecorder();
+
+    /*!
+    * Sets the level whose lines trigger a dump, eNUM_LOG_LEVELS
+    * for none but eFATAL.
+    */
+    void set_dump_level(Logging::LogLevel level);
+
+    /*!
+    * A line with no level is kept as eINFO.
+    */
+    virtual void puts(const char* line, size_t len);
+
+    virtual void puts_level(int level, const char* line, size_t len);
+
+    /*!
+    * Does nothing, the ring is only written out by a dump.
+    */
+    virtual void flush();
+
+    /*!
+    * Appends the lines recorded since the last dump to the dump
+    * file, a line overwritten or still being written is skipped.
+    * @return the number of lines written.
+    */
+    size_t dump();
+
+    /*!
+    * The dump of the fatal signal handler: no lock, no allocation.
+    * @return the descriptor of the dump file.
+    */
+    virtual int crash_flush();
+
+    /*!
+    * @return the lines recorded so far.
+    */
+    uint64_t recorded() const { return _head.load(std::memory_order_relaxed); }
+
+    /*!
+    * @return the lines not recorded because their slot was still
+    * being written by a thread one lap behind.
+    */
+    uint64_t lost() const { return _lost.load(std::memory_order_relaxed); }
+private:
+    void record(const char* line, size_t len);
+    size_t dump_unlocked();
+private:
+    const std::string                        _dump_name;
+    size_t                                   _slot_count;
+    size_t                                   _slot_size;
+    std::unique_ptr<std::atomic<uint64_t>[]> _seqs;   //!< 2*line+1 writing, 2*line+2 done
+    std::unique_ptr<uint32_t[]>              _lens;
+    std::unique_ptr<char[]>                  _data;
+    std::atomic<uint64_t>                    _head;
+    std::atomic<uint64_t>                    _dumped; //!< lines before it were dumped
+    std::atomic<uint64_t>                    _lost;
+    std::atomic<int>                         _dump_level;
+    Mutex                                    _dump_mutex;
+    int                                      _fd;
+};
+
+}
+#endif
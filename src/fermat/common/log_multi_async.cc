@@ -1,9 +1,36 @@
 #include <fermat/common/log_multi_async.h>
+#include <fermat/common/this_thread.h>
+#include <fermat/common/clock.h>
+#include <fermat/common/log_crash.h>
+#include <algorithm>
 #include <iostream>
 
 namespace fermat {
 
-__thread int myindex = -1;
+namespace detail {
+
+// the queues a thread holds, given back when the thread exits
+struct ThreadQueues {
+    typedef std::pair<uint64_t, std::shared_ptr<LogQueue> > Ref;
+
+    ~ThreadQueues()
+    {
+        for (size_t i = 0; i < refs.size(); ++i) {
+            refs[i].second->owners.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    std::vector<Ref> refs;
+};
+
+thread_local ThreadQueues t_queues;
+// the last queue looked up, keyed by LogMultiAsync id
+__thread uint64_t t_last_owner = 0;
+__thread LogQueue *t_last_queue = NULL;
+
+std::atomic<uint64_t> g_multi_id(0);
+
+}
 
 LogMultiAsync::LogMultiAsync(const std::string &baseName,
              size_t rollSize,
@@ -11,155 +38,492 @@ LogMultiAsync::LogMultiAsync(const std::string &baseName,
              int flushInterval)
     : LogOutput("async_log"),
       _flush_interval(flushInterval),
+      _id(++detail::g_multi_id),
+      _max_queues(queues > 0 ? queues : 1),
       _is_running(false),
       _base_name(baseName),
       _roll_size(rollSize),
       _state(0),
-      _notify(queues+1),
-      _mutexs(),
-      _current_buffer(),
-      _next_buffer(),
-      _buffers(),
+      _register_mutex(),
+      _queues(_max_queues),
+      _queue_count(0),
+      _pending(),
+      _pending_words((_max_queues + 63) / 64),
+      _wake_mutex(),
+      _cond(),
+      _iov(),
+      _roll_listener(),
+      _crash_file(NULL),
+      _schedule(flushInterval),
+      _buffer_size(kDefaultBufferSize),
+      _max_buffer_bytes(LogAsync::kDefaultMaxBufferBytes),
+      _huge_pages(false),
+      _pool(),
+      _overflow_policy(LogAsync::eOverflowDrop),
+      _space_mutex(),
+      _space_cond(),
+      _space_rounds(0),
+      _dropped_bytes(0),
+      _dropped_lines(0),
+      _overflow(baseName, rollSize),
+      _counters(),
       _thread("async-log")
 {
-    _current_buffer.reserve(queues);
-    _next_buffer.reserve(queues);
-    _buffers.reserve(queues);
+    _pending.reset(new std::atomic<uint64_t>[_pending_words]);
+    for (size_t i = 0; i < _pending_words; ++i) {
+        _pending[i].store(0, std::memory_order_relaxed);
+    }
+    _iov.reserve(16);
 }
 
 LogMultiAsync::~LogMultiAsync()
 {
+    // exited threads may still reference the queues, not the buffers
+    size_t count = _queue_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        Queue *q = _queues[i].get();
+        ScopedMutex lock(q->mutex);
+        LogBuffer *own[2] = {q->current, q->next};
+        for (int j = 0; j < 2; ++j) {
+            if (own[j]) {
+                _pool->put(own[j]);
+            }
+        }
+        BufferVector full;
+        q->full.take_all(full);
+        for (size_t j = 0; j < full.size(); ++j) {
+            _pool->put(full[j]);
+        }
+        q->current = NULL;
+        q->next = NULL;
+    }
+}
+
+void LogMultiAsync::set_buffer_size(size_t size)
+{
+    _buffer_size = size;
+}
+
+void LogMultiAsync::set_huge_pages(bool on)
+{
+    _huge_pages = on;
+}
+
+void LogMultiAsync::set_max_buffer_bytes(size_t bytes)
+{
+    _max_buffer_bytes = bytes;
+}
+
+void LogMultiAsync::set_overflow_policy(LogAsync::OverflowPolicy policy)
+{
+    _overflow_policy = policy;
+}
+
+LogMultiAsync::Queue* LogMultiAsync::thread_queue()
+{
+    if (__builtin_expect(detail::t_last_owner == _id, 1)) {
+        return detail::t_last_queue;
+    }
+    std::vector<detail::ThreadQueues::Ref> &refs = detail::t_queues.refs;
+    Queue *q = NULL;
+    for (size_t i = 0; i < refs.size(); ++i) {
+        if (refs[i].first == _id) {
+            q = refs[i].second.get();
+            break;
+        }
+    }
+    if (!q) {
+        q = register_queue();
+    }
+    detail::t_last_owner = _id;
+    detail::t_last_queue = q;
+    return q;
+}
+
+LogMultiAsync::Queue* LogMultiAsync::register_queue()
+{
+    ScopedMutex lock(_register_mutex);
+    QueuePtr q;
+    size_t count = _queue_count.load(std::memory_order_relaxed);
+    // a queue whose threads all exited is taken over as it is, lines
+    // it still holds are written before the ones of the new thread
+    for (size_t i = 0; i < count && !q; ++i) {
+        if (_queues[i]->owners.load(std::memory_order_acquire) == 0) {
+            q = _queues[i];
+        }
+    }
+    if (!q && count < _max_queues) {
+        q.reset(new Queue(count));
+        // a queue always has a buffer to fill, past the cap too
+        q->current = new_buffer(0);
+        if (!q->current) {
+            q->current = _pool->get_heap(0);
+        }
+        q->next = new_buffer(0);
+        _queues[count] = q;
+        _queue_count.store(count + 1, std::memory_order_release);
+    } else if (!q) {
+        // more threads than queues, share one
+        q = _queues[static_cast<size_t>(this_thread::thread_id()) % _max_queues];
+    }
+    q->owners.fetch_add(1, std::memory_order_relaxed);
+    detail::t_queues.refs.push_back(std::make_pair(_id, q));
+    return q.get();
+}
+
+size_t LogMultiAsync::queue_count() const
+{
+    return _queue_count.load(std::memory_order_acquire);
+}
+
+// a pool buffer, else a heap one while the buffers in flight stay
+// under the cap, else NULL
+LogBuffer* LogMultiAsync::new_buffer(size_t len)
+{
+    LogBuffer *buf = len < _pool->buffer_size() ? _pool->get() : NULL;
+    if (buf) {
+        return buf;
+    }
+    size_t size = std::max(len, _pool->buffer_size());
+    if (_pool->bytes_in_use() + size > _max_buffer_bytes) {
+        return NULL;
+    }
+    return _pool->get_heap(len);
+}
+
+void LogMultiAsync::set_report_interval(Timespan interval)
+{
+    _schedule.set_report_interval(interval);
+}
 
+void LogMultiAsync::set_sync_policy(const LogSyncPolicy &policy)
+{
+    _schedule.set_sync_policy(policy);
 }
-int LogMultiAsync::get_thread_index()
+
+LogAsyncStats LogMultiAsync::stats()
 {
-    static std::atomic<int> g_index;
-    if(__builtin_expect(myindex == -1, 0)) {
-        myindex = g_index++;
+    LogAsyncStats s;
+    _counters.copy_to(&s);
+    s.queued_buffers = 0;
+    s.queued_bytes = 0;
+    size_t count = _queue_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        Queue *q = _queues[i].get();
+        ScopedMutex lock(q->mutex);
+        s.queued_buffers += q->full.size();
+        for (LogBuffer *b = q->full.front(); b; b = LogBufferList::next(b)) {
+            s.queued_bytes += b->size();
+        }
+        if (q->current) {
+            s.queued_bytes += q->current->size();
+        }
     }
-    return myindex;
+    size_t used = _pool ? _pool->in_use() : 0;
+    s.extra_buffers = used > 2 * count ? used - 2 * count : 0;
+    // dropped since the backend last wrote the "Dropped" line
+    ScopedMutex lock(_space_mutex);
+    s.dropped_lines += _dropped_lines;
+    s.dropped_bytes += _dropped_bytes;
+    return s;
 }
+
 void LogMultiAsync::puts(const char* line, size_t len)
 {
-    if(!_is_running) {
+    if (!_is_running.load(std::memory_order_relaxed)) {
         return ;
     }
-    int index = get_thread_index();
-    ScopedMutex lock(_mutexs[index]);
-  	if ((_current_buffer[index]->size() + len) < _current_buffer[index]->stack_size()) {
-	    _current_buffer[index]->append(line, len);
-  	} else {
-    	_buffers[index].push_back(_current_buffer[index]);
-		_current_buffer[index].reset();
-    	if (_next_buffer[index])  {
-     		_current_buffer[index] = _next_buffer[index];
-	  		_next_buffer[index].reset();
-		} else {
-      		_current_buffer[index].reset(new Buffer); // Rarely happens
-		}	
-    	_current_buffer[index]->append(line, len);
-   	 	_notify.set_to(index);
-  	}
+    Queue *q = thread_queue();
+    bool full = false;
+    if (__builtin_expect(!append(q, line, len, &full), 0)) {
+        overflow(q, line, len);
+        return;
+    }
+    if (full) {
+        handoff(q);
+    }
 }
 
-
-void LogMultiAsync::run()
+// appends the line to q, false if it needs a new buffer and the
+// buffers in flight reach the cap; full is set when the current
+// buffer of q was handed over
+bool LogMultiAsync::append(Queue *q, const char* line, size_t len, bool *full)
 {
-    _state.set_to(1);
-    std::cout<<"start async log"<<std::endl;
-    LogFile<NullMutex> output(_base_name, _roll_size);
-    BufferPtr newBuffer1(new Buffer);
-    BufferPtr newBuffer2(new Buffer);
-    newBuffer1->bzero();
-    newBuffer2->bzero();
-    BufferVector buffersToWrite;
-    buffersToWrite.reserve(16);
-    size_t max_queue = _buffers.size();
-    size_t index = 0;
-    size_t emptyQueues = 0;
-    while (_is_running) {
-        assert(newBuffer1 && newBuffer1->size() == 0);
-        assert(newBuffer2 && newBuffer2->size() == 0);
-        assert(buffersToWrite.empty());
+    ScopedMutex lock(q->mutex);
+    if (len < q->current->avail()) {
+        q->current->append(line, len);
+        ++q->lines;
+        return true;
+    }
+    LogBuffer *buf = NULL;
+    if (q->next && len < q->next->capacity()) {
+        buf = q->next;
+        q->next = NULL;
+    } else {
+        // Rarely happens, a line larger than a buffer gets its own
+        buf = new_buffer(len);
+    }
+    if (!buf) {
+        return false;
+    }
+    q->full.push_back(q->current);
+    q->full_lines += q->lines;
+    q->current = buf;
+    q->current->append(line, len);
+    q->lines = 1;
+    *full = true;
+    return true;
+}
 
-        {
-            index %= max_queue;
-            if(emptyQueues >= max_queue) {
-                bool ret = _notify.wait_less(max_queue + 1, Timespan(_flush_interval*1000000));
-                if(ret) {
-                    index = _notify.get();
-                    _notify.set_to(max_queue + 1);
-                    emptyQueues = 0;
+void LogMultiAsync::overflow(Queue *q, const char* line, size_t len)
+{
+    if (_overflow_policy == LogAsync::eOverflowBlock && len <= _max_buffer_bytes) {
+        // wait for the backend to give buffers back, one round at a time
+        for (;;) {
+            uint64_t round = 0;
+            {
+                ScopedMutex lock(_space_mutex);
+                round = _space_rounds;
+            }
+            handoff(q);
+            bool full = false;
+            if (append(q, line, len, &full)) {
+                if (full) {
+                    handoff(q);
                 }
+                return;
             }
-            ScopedMutex lock(_mutexs[index]);
-            if(_buffers[index].empty()) {
-                emptyQueues++;   
+            ScopedMutex lock(_space_mutex);
+            while (_is_running && _space_rounds == round) {
+                _space_cond.wait(_space_mutex, Timespan(_flush_interval * 1000000));
             }
-            _buffers[index].push_back(_current_buffer[index]);
-            _current_buffer[index] = newBuffer1;
-	        newBuffer1.reset();
-            buffersToWrite.swap(_buffers[index]);
-            if (!_next_buffer[index]) {
-                _next_buffer[index] = newBuffer2;
-		        newBuffer2.reset();
+            if (!_is_running) {
+                break;
             }
-            ++index;
         }
-        
-        size_t s = buffersToWrite.size();
-        for (size_t i = 0; i < s; ++i) {
-            // FIXME: use unbuffered stdio FILE ? or use ::writev ?
-            output.append(buffersToWrite[i]->data(), buffersToWrite[i]->size());
+    }
+    if (_overflow_policy == LogAsync::eOverflowSpill) {
+        _overflow.append(line, len);
+        return;
+    }
+    ScopedMutex lock(_space_mutex);
+    _dropped_bytes += len;
+    ++_dropped_lines;
+}
+
+void LogMultiAsync::handoff(Queue *q)
+{
+    uint64_t bit = 1ULL << (q->slot % 64);
+    uint64_t old = _pending[q->slot / 64].fetch_or(bit, std::memory_order_release);
+    if (!(old & bit)) {
+        ScopedMutex lock(_wake_mutex);
+        _cond.signal();
+    }
+}
+
+bool LogMultiAsync::has_pending() const
+{
+    for (size_t i = 0; i < _pending_words; ++i) {
+        if (_pending[i].load(std::memory_order_relaxed) != 0) {
+            return true;
         }
+    }
+    return false;
+}
 
-        buffersToWrite.resize(2);
+void LogMultiAsync::drain(Queue *q, bool all, BufferVector &out, uint64_t &lines)
+{
+    ScopedMutex lock(q->mutex);
+    q->full.take_all(out);
+    lines += q->full_lines;
+    q->full_lines = 0;
+    if (!q->next) {
+        q->next = new_buffer(0);
+    }
+    // the current buffer goes too when there is one to replace it
+    if (all && q->current->size() > 0 && q->next) {
+        out.push_back(q->current);
+        q->current = q->next;
+        q->next = new_buffer(0);
+        lines += q->lines;
+        q->lines = 0;
+    }
+}
 
-        if (!newBuffer1) {
-            assert(!buffersToWrite.empty());
-            newBuffer1 = buffersToWrite[0];
-            newBuffer1->bzero();
+void LogMultiAsync::drain_pending(LogFile<NullMutex> *output)
+{
+    BufferVector buffers;
+    uint64_t lines = 0;
+    for (size_t w = 0; w < _pending_words; ++w) {
+        uint64_t bits = _pending[w].exchange(0, std::memory_order_acquire);
+        while (bits) {
+            size_t slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            drain(_queues[slot].get(), false, buffers, lines);
         }
+    }
+    write(output, buffers, lines);
+}
+
+void LogMultiAsync::sweep(LogFile<NullMutex> *output)
+{
+    BufferVector buffers;
+    uint64_t lines = 0;
+    size_t count = _queue_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        drain(_queues[i].get(), true, buffers, lines);
+    }
+    write(output, buffers, lines);
+}
 
-        if (!newBuffer2) {
-            assert(buffersToWrite.size() == 2);
-            newBuffer2 = buffersToWrite[1];
-            newBuffer2->bzero();
+void LogMultiAsync::write(LogFile<NullMutex> *output, BufferVector &buffers, uint64_t lines)
+{
+    _iov.clear();
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        if (buffers[i]->size() == 0) {
+            continue;
         }
+        struct iovec v;
+        v.iov_base = const_cast<char*>(buffers[i]->data());
+        v.iov_len = buffers[i]->size();
+        bytes += v.iov_len;
+        _iov.push_back(v);
+    }
+    if (!_iov.empty()) {
+        Clock begin;
+        output->append(&_iov[0], static_cast<int>(_iov.size()));
+        detail::LogWriterCounters::add(_counters.append_micro_seconds, begin.elapsed());
+        detail::LogWriterCounters::add(_counters.written_bytes, bytes);
+    }
+    detail::LogWriterCounters::add(_counters.written_lines, lines);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        _pool->put(buffers[i]);
+    }
+    buffers.clear();
+    // wakes the producers the overflow policy blocks
+    ScopedMutex lock(_space_mutex);
+    ++_space_rounds;
+    _space_cond.broadcast();
+}
 
-        buffersToWrite.clear();
-        output.flush();
+void LogMultiAsync::write_dropped(LogFile<NullMutex> *output)
+{
+    uint64_t bytes = 0;
+    uint64_t lines = 0;
+    {
+        ScopedMutex lock(_space_mutex);
+        bytes = _dropped_bytes;
+        lines = _dropped_lines;
+        _dropped_bytes = 0;
+        _dropped_lines = 0;
+    }
+    _schedule.dropped(output, bytes, lines, _counters);
+}
+
+void LogMultiAsync::run()
+{
+    std::cout<<"start async log"<<std::endl;
+    LogFile<NullMutex> output(_base_name, _roll_size);
+    output.set_roll_listener(_roll_listener);
+    output.set_sync_policy(_schedule.sync_policy());
+    _crash_file.store(&output, std::memory_order_release);
+    // start() returns once crash_flush() has a file to write to
+    _state.set_to(1);
+    Timestamp lastSweep;
+    Timestamp lastReport;
+    const Timespan wait = _schedule.wait_interval();
+    while (_is_running) {
+        bool timeout = false;
+        {
+            ScopedMutex lock(_wake_mutex);
+            if (!has_pending() && _is_running) {
+                timeout = !_cond.wait(_wake_mutex, wait);
+            }
+        }
+        // heap buffers written last round, no longer on a queue
+        _pool->reclaim();
+        drain_pending(&output);
+        if ((timeout && wait.total_micro_seconds() == _flush_interval*1000000LL) ||
+            lastSweep.is_elapsed(_flush_interval*1000000)) {
+            sweep(&output);
+            lastSweep.update();
+        }
+        detail::LogWriterCounters::add(_counters.loops, 1);
+        write_dropped(&output);
+        _schedule.report(&output, lastReport, _log_name.c_str(),
+                         [this]() { return stats(); }, _counters);
+        _schedule.flush(&output, _counters);
+        _overflow.flush();
     } //while
-  
+
     flush_all(&output);
+    _crash_file.store(NULL, std::memory_order_release);
     _state.set_to(2);
 }
 
 
+void LogMultiAsync::set_roll_listener(const LogRollListener &listener)
+{
+    _roll_listener = listener;
+}
+
 void LogMultiAsync::flush()
 {
 
 }
+
+int LogMultiAsync::crash_flush()
+{
+    LogFile<NullMutex> *file = _crash_file.load(std::memory_order_acquire);
+    int fd = file ? file->fd() : -1;
+    if (fd < 0) {
+        return fd;
+    }
+    size_t count = _queue_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        Queue *q = _queues[i].get();
+        for (LogBuffer *b = q->full.front(); b; b = LogBufferList::next(b)) {
+            LogCrashHandler::write_fully(fd, b->data(), b->size());
+        }
+        if (LogBuffer *current = q->current) {
+            LogCrashHandler::write_fully(fd, current->data(), current->size());
+        }
+    }
+    return fd;
+}
+
 void LogMultiAsync::flush_all(LogFile<NullMutex> *output)
 {
-    size_t idx = 0;
-    while(idx < _buffers.size()) {
-        ScopedMutex lock(_mutexs[idx]);
-        _buffers[idx].push_back(_current_buffer[idx]);
-        _current_buffer[idx].reset();
-        if (!_buffers[idx].empty()) {
-            for (size_t i = 0; i <_buffers.size(); i++) {
-                output->append(_buffers[idx][i]->data(), _buffers[idx][i]->size());
-            }
+    sweep(output);
+    // left when the cap gave no buffer to swap in
+    uint64_t lines = 0;
+    size_t count = _queue_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        Queue *q = _queues[i].get();
+        ScopedMutex lock(q->mutex);
+        if (q->current->size() > 0) {
+            output->append(q->current->data(), q->current->size());
+            detail::LogWriterCounters::add(_counters.written_bytes, q->current->size());
+            q->current->clear();
+            lines += q->lines;
+            q->lines = 0;
         }
-        output->flush();
     }
+    detail::LogWriterCounters::add(_counters.written_lines, lines);
+    write_dropped(output);
+    _schedule.flush(output, _counters);
+    _overflow.flush();
 }
 
 bool LogMultiAsync::start()
 {
     if(_is_running) {
         return true;
+    }
+    // two buffers in each queue and two on their way to the backend
+    if (!_pool) {
+        _pool.reset(new LogBufferPool(_buffer_size, 4 * _max_queues, _huge_pages));
     }
      _is_running = true;
     _thread.start(std::bind(&LogMultiAsync::run, this));
@@ -173,9 +537,17 @@ void LogMultiAsync::stop()
         return;
     }
     _is_running = false;
+    {
+        ScopedMutex lock(_wake_mutex);
+        _cond.signal();
+    }
+    {
+        ScopedMutex lock(_space_mutex);
+        _space_cond.broadcast();
+    }
     _state.wait_for(2);
     _thread.join();
 }
 
 
-}
\ No newline at end of file
+}
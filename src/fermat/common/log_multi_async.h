@@ -3,53 +3,195 @@
 
 #include <fermat/common/logging.h>
 #include <fermat/common/mutex.h>
+#include <fermat/common/cond.h>
 #include <fermat/common/thread.h>
 #include <fermat/common/shared_state.h>
-#include <fermat/common/stack_buffer.h>
 #include <fermat/common/log_file.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_async_stats.h>
+#include <fermat/common/log_buffer.h>
+#include <fermat/common/timespan.h>
 #include <memory>
 #include <cstddef>
 #include <vector>
+#include <atomic>
 
 namespace fermat {
 
+namespace detail {
+
+/*!
+* One producer queue of LogMultiAsync. owners counts the threads
+* holding it, it is 1 unless more threads log than there are
+* queues; a queue with no owner goes to the next new thread.
+*/
+struct LogQueue {
+    typedef std::vector<LogBuffer*>   BufferVector;
+
+    explicit LogQueue(size_t index)
+        : slot(index), owners(0), current(NULL), next(NULL), lines(0), full_lines(0)
+    {}
+
+    const size_t      slot;
+    std::atomic<int>  owners;
+    Mutex             mutex;
+    LogBuffer        *current;
+    LogBuffer        *next;
+    LogBufferList     full;        //!< walked by crash_flush()
+    uint64_t          lines;       //!< in current
+    uint64_t          full_lines;  //!< in full
+};
+
+}
+
+/*!
+* Async log output with one queue per producer thread. A thread
+* gets a queue on its first puts() and gives it back when it
+* exits, new threads take given back queues before new ones are
+* made, so any number of short-lived threads fit in a fixed
+* number of queues. Producers flag queues with a
+* full buffer in a bitmap and the backend only visits those,
+* plus every queue once per flush interval.
+*/
 class LogMultiAsync : public LogOutput {
 public:
-LogMultiAsync(const std::string &baseName,
-             size_t rollSize,
-             size_t queues,
-             int flushInterval = 3);
+    static const size_t kDefaultBufferSize = 64 * 1024;
+
+    /*!
+    * @param queues the most queues in use at once; when more
+    *        threads log at the same time they share queues.
+    */
+    LogMultiAsync(const std::string &baseName,
+                  size_t rollSize,
+                  size_t queues,
+                  int flushInterval = 3);
     virtual ~LogMultiAsync();
 
+    /*!
+    * Sets the size of one buffer, kDefaultBufferSize by
+    * default. Four buffers per queue are preallocated in a
+    * LogBufferPool at start(), more come from the heap up to
+    * set_max_buffer_bytes. Must be called before start().
+    */
+    void set_buffer_size(size_t size);
+
+    /*!
+    * Caps the memory of all buffers in flight, the preallocated
+    * ones included, LogAsync::kDefaultMaxBufferBytes by default.
+    * A line that needs a heap buffer past the cap is handled by
+    * the overflow policy; one larger than the cap is dropped, or
+    * spilled. Must be called before start().
+    */
+    void set_max_buffer_bytes(size_t bytes);
+
+    /*!
+    * Sets the overflow policy, see LogAsync::OverflowPolicy,
+    * eOverflowDrop by default.
+    */
+    void set_overflow_policy(LogAsync::OverflowPolicy policy);
+
+    /*!
+    * Backs the buffer pool with huge pages, see LogBufferPool.
+    * Must be called before start().
+    */
+    void set_huge_pages(bool on);
+
     virtual void puts(const char* line, size_t len);
 
     virtual void flush();
 
+    /*!
+    * Writes the lines still queued to the current log file,
+    * without the locks the producers take, for LogCrashHandler.
+    * Lines the backend is writing at that moment are not
+    * repeated.
+    */
+    virtual int crash_flush();
+
+    /*!
+    * Passes every rolled log file to listener on the backend
+    * thread. Must be called before start().
+    */
+    void set_roll_listener(const LogRollListener &listener);
+
+    /*!
+    * See detail::LogWriterSchedule::set_report_interval(). Must
+    * be called before start().
+    */
+    void set_report_interval(Timespan interval);
+
+    /*!
+    * See detail::LogWriterSchedule::set_sync_policy(). Must be
+    * called before start().
+    */
+    void set_sync_policy(const LogSyncPolicy &policy);
+
+    /*!
+    * @return the number of queues created so far.
+    */
+    size_t queue_count() const;
+
+    /*!
+    * @return a snapshot of the counters, extra_buffers counts
+    * the buffers beyond the two each queue starts with.
+    */
+    LogAsyncStats stats();
+
     bool start();
 
     void stop();
 
     void run();
 private:
+    typedef detail::LogQueue          Queue;
+    typedef std::shared_ptr<Queue>    QueuePtr;
+    typedef Queue::BufferVector       BufferVector;
+
+    Queue* thread_queue();
+    Queue* register_queue();
+    void handoff(Queue *q);
+    bool has_pending() const;
+    bool append(Queue *q, const char* line, size_t len, bool *full);
+    void overflow(Queue *q, const char* line, size_t len);
+    void drain(Queue *q, bool all, BufferVector &out, uint64_t &lines);
+    LogBuffer* new_buffer(size_t len);
+    void write_dropped(LogFile<NullMutex> *out);
+    void drain_pending(LogFile<NullMutex> *out);
+    void sweep(LogFile<NullMutex> *out);
+    void write(LogFile<NullMutex> *out, BufferVector &buffers, uint64_t lines);
     void flush_all(LogFile<NullMutex> *out);
-    int get_thread_index();
 private:
-    typedef StackBuffer<char, 4096>   Buffer; 
-    typedef std::shared_ptr<Buffer>   BufferPtr;
-    typedef std::vector<BufferPtr>    BufferVector;
-    typedef std::vector<BufferVector> BufferMatrix;
-
     const int                        _flush_interval;
-    bool                             _is_running;
+    const uint64_t                   _id;
+    const size_t                     _max_queues;
+    std::atomic<bool>                _is_running;
     std::string                      _base_name;
     size_t                           _roll_size;
     SharedState<int>                 _state;
-    SharedState<size_t>                 _notify;
-    std::vector<Mutex>               _mutexs;
-    BufferVector                     _current_buffer;
-    BufferVector                     _next_buffer;
-    BufferMatrix                     _buffers;
+    Mutex                            _register_mutex;
+    std::vector<QueuePtr>            _queues;
+    std::atomic<size_t>              _queue_count;
+    std::unique_ptr<std::atomic<uint64_t>[]> _pending;
+    size_t                           _pending_words;
+    Mutex                            _wake_mutex;
+    Cond                             _cond;
+    std::vector<struct iovec>        _iov;
+    LogRollListener                  _roll_listener;
+    std::atomic<LogFile<NullMutex>*> _crash_file;
+    detail::LogWriterSchedule        _schedule;
+    size_t                           _buffer_size;
+    size_t                           _max_buffer_bytes;
+    bool                             _huge_pages;
+    std::unique_ptr<LogBufferPool>   _pool;
+    LogAsync::OverflowPolicy         _overflow_policy;
+    Mutex                            _space_mutex;
+    Cond                             _space_cond;
+    uint64_t                         _space_rounds;   //!< under _space_mutex, backend rounds
+    uint64_t                         _dropped_bytes;  //!< under _space_mutex, with _dropped_lines
+    uint64_t                         _dropped_lines;
+    detail::LogOverflowFile          _overflow;
+    detail::LogWriterCounters        _counters;
     Thread                           _thread;
 };
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,103 @@
+#include <fermat/common/log_record.h>
+#include <cstring>
+
+namespace fermat {
+
+LogRecordDecoder::LogRecordDecoder()
+    : _stream()
+{
+}
+
+template <typename T>
+static inline T read_arg(const char* p)
+{
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+bool LogRecordDecoder::decode_args(const char* data, size_t len)
+{
+    const char* p = data;
+    const char* end = data + len;
+    while (p < end) {
+        char tag = *p++;
+        switch (tag) {
+            case LogStream::eArgInt32:
+                _stream << read_arg<int32_t>(p);
+                p += sizeof(int32_t);
+                break;
+            case LogStream::eArgUInt32:
+                _stream << read_arg<uint32_t>(p);
+                p += sizeof(uint32_t);
+                break;
+            case LogStream::eArgInt64:
+                _stream << static_cast<long long>(read_arg<int64_t>(p));
+                p += sizeof(int64_t);
+                break;
+            case LogStream::eArgUInt64:
+                _stream << static_cast<unsigned long long>(read_arg<uint64_t>(p));
+                p += sizeof(uint64_t);
+                break;
+            case LogStream::eArgDouble:
+                _stream << read_arg<double>(p);
+                p += sizeof(double);
+                break;
+            case LogStream::eArgChar:
+                _stream << *p;
+                p += 1;
+                break;
+            case LogStream::eArgString: {
+                uint32_t size = read_arg<uint32_t>(p);
+                p += sizeof(uint32_t);
+                if (size > static_cast<size_t>(end - p)) {
+                    return false;
+                }
+                _stream.append(p, size);
+                p += size;
+                break;
+            }
+            case LogStream::eArgPointer:
+                _stream << reinterpret_cast<const void*>(read_arg<uintptr_t>(p));
+                p += sizeof(uintptr_t);
+                break;
+            default:
+                return false;
+        }
+    }
+    return p == end;
+}
+
+size_t LogRecordDecoder::decode(const char* data, size_t len, BasicBuffer<char> &out)
+{
+    size_t pos = 0;
+    char tid[16];
+    while (len - pos >= sizeof(LogRecordHeader)) {
+        LogRecordHeader header;
+        memcpy(&header, data + pos, sizeof(header));
+        if (header.size < sizeof(header) || header.size > len - pos) {
+            break;
+        }
+        const char* body = data + pos + sizeof(header);
+        size_t bodyLen = header.size - sizeof(header);
+        pos += header.size;
+        if (!header.site) {
+            out.append(body, bodyLen);
+            continue;
+        }
+
+        _stream.reset_bufffer();
+        size_t tidLen = sizeof(tid);
+        uint_to_str(static_cast<uint32_t>(header.tid), 10, tid, tidLen);
+        Logging::format_prefix(_stream, header.micro_seconds, tid, tidLen,
+                               header.site, header.saved_errno);
+        if (!decode_args(body, bodyLen)) {
+            _stream << "<bad log record>";
+        }
+        _stream << '\n';
+        out.append(_stream.buffer().data(), _stream.buffer().size());
+    }
+    return pos;
+}
+
+} //namespace fermat
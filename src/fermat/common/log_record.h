@@ -0,0 +1,46 @@
+#ifndef FERMAT_COMMON_LOG_RECORD_H_
+#define FERMAT_COMMON_LOG_RECORD_H_
+#include <fermat/common/logging.h>
+#include <fermat/common/basic_buffer.h>
+#include <cstdint>
+#include <cstddef>
+
+namespace fermat {
+
+/*!
+* Header of a binary log record. A record is the header followed
+* by the LogStream argument encoding (see LogStream::ArgTag), or,
+* when site is NULL, by an already formatted text line.
+*/
+struct LogRecordHeader {
+    uint32_t        size;        //!< bytes of the whole record
+    int32_t         saved_errno;
+    int64_t         micro_seconds;
+    const LogSite  *site;
+    int32_t         tid;
+    int32_t         reserved;
+};
+
+/*!
+* Turns binary log records back into the text lines the text
+* path of Logging produces.
+*/
+class LogRecordDecoder {
+public:
+    LogRecordDecoder();
+
+    /*!
+    * Decodes every whole record in [data, data + len) and
+    * appends the text to out.
+    * @return the number of bytes consumed.
+    */
+    size_t decode(const char* data, size_t len, BasicBuffer<char> &out);
+
+private:
+    bool decode_args(const char* data, size_t len);
+private:
+    LogStream _stream;
+};
+
+} //namespace fermat
+#endif
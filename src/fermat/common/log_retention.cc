@@ -0,0 +1,239 @@
+#include <fermat/common/log_retention.h>
+#include <fermat/common/this_thread.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace fermat {
+
+// the age limit is checked at least this often when no file rolls
+static const int64_t kAgeCheckSeconds = 60;
+
+LogRetention::LogRetention(const std::string &baseName)
+    : _dir("."),
+      _prefix(baseName),
+      _max_files(0),
+      _max_bytes(0),
+      _max_age(0),
+      _delete_interval(100 * 1000),
+      _is_running(false),
+      _mutex(),
+      _cond(),
+      _pending(),
+      _entries(),
+      _stats(),
+      _guard(std::bind(&LogRetention::add, this, std::placeholders::_1)),
+      _thread("log-retention")
+{
+    size_t slash = baseName.rfind('/');
+    if (slash != std::string::npos) {
+        _dir = slash == 0 ? "/" : baseName.substr(0, slash);
+        _prefix = baseName.substr(slash + 1);
+    }
+    _prefix += '.';
+}
+
+LogRetention::~LogRetention()
+{
+    _guard.reset();
+    stop();
+}
+
+void LogRetention::set_max_files(size_t count)
+{
+    _max_files = count;
+}
+
+void LogRetention::set_max_bytes(uint64_t bytes)
+{
+    _max_bytes = bytes;
+}
+
+void LogRetention::set_max_age(Timespan age)
+{
+    _max_age = age.total_seconds();
+}
+
+void LogRetention::set_delete_interval(Timespan interval)
+{
+    _delete_interval = interval;
+}
+
+bool LogRetention::start()
+{
+    if (_is_running) {
+        return true;
+    }
+    scan();
+    _is_running = true;
+    _thread.start(std::bind(&LogRetention::run, this));
+    return true;
+}
+
+void LogRetention::stop()
+{
+    {
+        ScopedMutex lock(_mutex);
+        if (!_is_running) {
+            return;
+        }
+        _is_running = false;
+        _cond.signal();
+    }
+    _thread.join();
+}
+
+void LogRetention::add(const std::string &fileName)
+{
+    ScopedMutex lock(_mutex);
+    _pending.push_back(fileName);
+    _cond.signal();
+}
+
+LogRollListener LogRetention::listener()
+{
+    return _guard.listener();
+}
+
+LogRetention::Stats LogRetention::stats()
+{
+    ScopedMutex lock(_mutex);
+    return _stats;
+}
+
+bool LogRetention::match(const std::string &name) const
+{
+    // prefix YYYYmmdd-HHMMSS.log[.gz]
+    static const char kStamp[] = "dddddddd-dddddd.log";
+    static const size_t kStampSize = sizeof(kStamp) - 1;
+    if (name.size() < _prefix.size() + kStampSize ||
+        name.compare(0, _prefix.size(), _prefix) != 0) {
+        return false;
+    }
+    const char* p = name.data() + _prefix.size();
+    for (size_t i = 0; i < kStampSize; ++i) {
+        bool ok = kStamp[i] == 'd' ? (p[i] >= '0' && p[i] <= '9') : p[i] == kStamp[i];
+        if (!ok) {
+            return false;
+        }
+    }
+    size_t rest = name.size() - _prefix.size() - kStampSize;
+    return rest == 0 || (rest == 3 && name.compare(name.size() - 3, 3, ".gz") == 0);
+}
+
+void LogRetention::scan()
+{
+    DIR *dir = ::opendir(_dir.c_str());
+    if (!dir) {
+        return;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *de = ::readdir(dir)) {
+        if (match(de->d_name)) {
+            names.push_back(_dir + "/" + de->d_name);
+        }
+    }
+    ::closedir(dir);
+    // the time stamp in the name sorts the files oldest first
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); ++i) {
+        index(names[i]);
+    }
+}
+
+void LogRetention::index(const std::string &fileName)
+{
+    struct stat st;
+    if (::stat(fileName.c_str(), &st) != 0) {
+        return;
+    }
+    Entry e;
+    e.name = fileName;
+    e.size = static_cast<uint64_t>(st.st_size);
+    e.mtime = st.st_mtime;
+    // a compressed file replaces the original in the index
+    if (fileName.size() > 3 && fileName.compare(fileName.size() - 3, 3, ".gz") == 0) {
+        std::string original = fileName.substr(0, fileName.size() - 3);
+        // the original is one of the newest files, search from the back
+        for (std::deque<Entry>::reverse_iterator it = _entries.rbegin();
+             it != _entries.rend(); ++it) {
+            if (it->name == original) {
+                ScopedMutex lock(_mutex);
+                _stats.bytes -= it->size;
+                _stats.bytes += e.size;
+                it->name.swap(e.name);
+                it->size = e.size;
+                return;
+            }
+        }
+    }
+    _entries.push_back(e);
+    ScopedMutex lock(_mutex);
+    ++_stats.files;
+    _stats.bytes += e.size;
+}
+
+bool LogRetention::over_limit(time_t now) const
+{
+    if (_entries.empty()) {
+        return false;
+    }
+    return (_max_files > 0 && _entries.size() > _max_files) ||
+           (_max_bytes > 0 && _stats.bytes > _max_bytes) ||
+           (_max_age > 0 && now - _entries.front().mtime > _max_age);
+}
+
+Timespan LogRetention::next_expiry(time_t now) const
+{
+    int64_t seconds = kAgeCheckSeconds;
+    if (_max_age > 0 && !_entries.empty()) {
+        seconds = std::min(seconds, _entries.front().mtime + _max_age - now + 1);
+    }
+    return Timespan(std::max<int64_t>(seconds, 1) * 1000000);
+}
+
+void LogRetention::run()
+{
+    std::vector<std::string> added;
+    while (true) {
+        bool running;
+        {
+            ScopedMutex lock(_mutex);
+            if (_pending.empty() && _is_running) {
+                _cond.wait(_mutex, next_expiry(::time(NULL)));
+            }
+            added.swap(_pending);
+            running = _is_running;
+        }
+        for (size_t i = 0; i < added.size(); ++i) {
+            index(added[i]);
+        }
+        added.clear();
+
+        while (over_limit(::time(NULL))) {
+            Entry e = _entries.front();
+            _entries.pop_front();
+            bool removed = ::unlink(e.name.c_str()) == 0 || errno == ENOENT;
+            {
+                ScopedMutex lock(_mutex);
+                --_stats.files;
+                _stats.bytes -= e.size;
+                if (removed) {
+                    ++_stats.deleted_files;
+                    _stats.deleted_bytes += e.size;
+                }
+            }
+            if (running && over_limit(::time(NULL))) {
+                this_thread::sleep_for(_delete_interval);
+            }
+        }
+        if (!running) {
+            break;
+        }
+    }
+}
+
+} //namespace fermat
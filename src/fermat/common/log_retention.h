@@ -0,0 +1,122 @@
+#ifndef FERMAT_COMMON_LOG_RETENTION_H_
+#define FERMAT_COMMON_LOG_RETENTION_H_
+#include <fermat/common/log_file.h>
+#include <fermat/common/mutex.h>
+#include <fermat/common/cond.h>
+#include <fermat/common/thread.h>
+#include <fermat/common/timespan.h>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include <string>
+
+namespace fermat {
+
+/*!
+* Keeps the rolled files of one LogFile base name within a file
+* count, a total size and an age. The directory is scanned once
+* by start(), after that the index is kept from the rolled files
+* passed to add() (or listener()), and the oldest files are
+* removed on a background thread, one unlink every delete
+* interval, so a large backlog never turns into a burst of
+* deletions. Files of the base name are baseName.YYYYmmdd-HHMMSS.log
+* and the same name with .gz appended.
+*
+* Typical use, after compression:
+*   LogRetention retention("./log/app");
+*   retention.set_max_bytes(10ULL << 30);
+*   retention.start();
+*   compressor.set_done_listener(retention.listener());
+*/
+class LogRetention {
+public:
+    struct Stats {
+        uint64_t  files;          //!< files in the index
+        uint64_t  bytes;          //!< bytes of the files in the index
+        uint64_t  deleted_files;
+        uint64_t  deleted_bytes;
+    };
+
+    explicit LogRetention(const std::string &baseName);
+    ~LogRetention();
+
+    /*!
+    * Keeps at most count rolled files, 0 (default) for no limit.
+    */
+    void set_max_files(size_t count);
+
+    /*!
+    * Keeps at most bytes in rolled files, 0 (default) for no limit.
+    */
+    void set_max_bytes(uint64_t bytes);
+
+    /*!
+    * Removes files last modified more than age ago, 0 (default)
+    * for no limit.
+    */
+    void set_max_age(Timespan age);
+
+    /*!
+    * Sets the pause between two unlinks, 100ms by default.
+    */
+    void set_delete_interval(Timespan interval);
+
+    /*!
+    * Scans the directory and starts the thread. Call it before
+    * the LogFile it watches opens its first file, or that file
+    * is indexed as a rolled one.
+    */
+    bool start();
+
+    /*!
+    * Applies the limits to the files added so far, then stops.
+    */
+    void stop();
+
+    /*!
+    * Adds a file that is done being written, callable from any
+    * thread.
+    */
+    void add(const std::string &fileName);
+
+    /*!
+    * @return a roll listener that calls add(), and does nothing
+    * once this is destroyed.
+    */
+    LogRollListener listener();
+
+    Stats stats();
+
+    void run();
+private:
+    struct Entry {
+        std::string  name;
+        uint64_t     size;
+        time_t       mtime;
+    };
+    bool match(const std::string &name) const;
+    void scan();
+    void index(const std::string &fileName);
+    bool over_limit(time_t now) const;
+    Timespan next_expiry(time_t now) const;
+private:
+    std::string              _dir;
+    std::string              _prefix;
+    size_t                   _max_files;
+    uint64_t                 _max_bytes;
+    int64_t                  _max_age;
+    Timespan                 _delete_interval;
+    bool                     _is_running;
+    Mutex                    _mutex;
+    Cond                     _cond;
+    std::vector<std::string> _pending;
+    std::deque<Entry>        _entries;
+    Stats                    _stats;
+    LogRollGuard             _guard;
+    Thread                   _thread;
+};
+
+}
+#endif
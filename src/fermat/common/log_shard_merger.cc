@@ -0,0 +1,258 @@
+#include <fermat/common/log_shard_merger.h>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <dirent.h>
+
+namespace fermat {
+
+// "YYYYMMDD HH:MM:SS.uuuuuuZ"
+static const size_t kTimeSize = 25;
+static const char kJsonTime[] = "{\"time\":\"";
+
+static bool is_time(const char* p, size_t len)
+{
+    return len >= kTimeSize && p[8] == ' ' && p[11] == ':' && p[14] == ':' &&
+           p[17] == '.' && p[24] == 'Z';
+}
+
+// the time of a text or JSON line starting at p, NULL if none
+static const char* line_time(const char* p, size_t len)
+{
+    if (is_time(p, len)) {
+        return p;
+    }
+    size_t json = sizeof(kJsonTime) - 1;
+    if (len > json && memcmp(p, kJsonTime, json) == 0 && is_time(p + json, len - json)) {
+        return p + json;
+    }
+    return NULL;
+}
+
+LogShardMerger::LogShardMerger(size_t window)
+    : _window(window > 0 ? window : 1),
+      _readers(),
+      _lines(0)
+{
+}
+
+LogShardMerger::~LogShardMerger()
+{
+}
+
+bool LogShardMerger::Later::operator()(const Entry &a, const Entry &b) const
+{
+    int c = a.time.compare(b.time);
+    if (c != 0) {
+        return c > 0;
+    }
+    if (a.shard != b.shard) {
+        return a.shard > b.shard;
+    }
+    if (a.seq != b.seq) {
+        return a.seq > b.seq;
+    }
+    return a.order > b.order;
+}
+
+void LogShardMerger::add_shard(const std::vector<std::string> &files)
+{
+    std::unique_ptr<Reader> r(new Reader());
+    r->files = files;
+    r->next_file = 0;
+    r->has_pending = false;
+    r->last_seq = 0;
+    r->order = 0;
+    r->failed = false;
+    _readers.push_back(std::move(r));
+}
+
+size_t LogShardMerger::add_shards(const std::string &baseName)
+{
+    std::string dir(".");
+    std::string prefix(baseName);
+    size_t slash = baseName.rfind('/');
+    if (slash != std::string::npos) {
+        dir = baseName.substr(0, slash);
+        prefix = baseName.substr(slash + 1);
+    }
+    prefix += '.';
+    std::vector<std::vector<std::string> > shards;
+    DIR *d = ::opendir(dir.c_str());
+    if (!d) {
+        return 0;
+    }
+    while (struct dirent *de = ::readdir(d)) {
+        std::string name(de->d_name);
+        if (name.size() <= prefix.size() + 4 ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - 4, 4, ".log") != 0) {
+            continue;
+        }
+        // <i>. after the prefix
+        size_t pos = prefix.size();
+        size_t index = 0;
+        while (pos < name.size() && isdigit(static_cast<unsigned char>(name[pos]))) {
+            index = index * 10 + static_cast<size_t>(name[pos] - '0');
+            ++pos;
+        }
+        if (pos == prefix.size() || pos >= name.size() || name[pos] != '.') {
+            continue;
+        }
+        if (shards.size() <= index) {
+            shards.resize(index + 1);
+        }
+        shards[index].push_back(dir + "/" + name);
+    }
+    ::closedir(d);
+    size_t found = 0;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (shards[i].empty()) {
+            continue;
+        }
+        std::sort(shards[i].begin(), shards[i].end());
+        add_shard(shards[i]);
+        ++found;
+    }
+    return found;
+}
+
+bool LogShardMerger::parse_head(const std::string &line, std::string &time,
+                                uint64_t &seq, bool &hasSeq, size_t &textStart)
+{
+    const char* p = line.data();
+    size_t len = line.size();
+    hasSeq = false;
+    textStart = 0;
+    const char* t = line_time(p, len);
+    if (!t) {
+        // "<seq> " in front of the line
+        size_t i = 0;
+        uint64_t v = 0;
+        while (i < len && isdigit(static_cast<unsigned char>(p[i]))) {
+            v = v * 10 + static_cast<uint64_t>(p[i] - '0');
+            ++i;
+        }
+        if (i == 0 || i >= len || p[i] != ' ') {
+            return false;
+        }
+        t = line_time(p + i + 1, len - i - 1);
+        if (!t) {
+            return false;
+        }
+        hasSeq = true;
+        seq = v;
+        textStart = i + 1;
+    }
+    time.assign(t, kTimeSize);
+    return true;
+}
+
+bool LogShardMerger::read_line(Reader &r, std::string &line)
+{
+    for (;;) {
+        if (r.in.is_open() && std::getline(r.in, line)) {
+            return true;
+        }
+        if (r.in.is_open()) {
+            r.in.close();
+        }
+        if (r.next_file >= r.files.size()) {
+            return false;
+        }
+        r.in.clear();
+        r.in.open(r.files[r.next_file++].c_str());
+        if (!r.in.is_open()) {
+            r.failed = true;
+        }
+    }
+}
+
+// the next line of the shard with its continuation lines
+bool LogShardMerger::read_entry(size_t shard, Entry &entry)
+{
+    Reader &r = *_readers[shard];
+    std::string line;
+    while (read_line(r, line)) {
+        std::string time;
+        uint64_t seq = r.last_seq;
+        bool hasSeq = false;
+        size_t textStart = 0;
+        if (!parse_head(line, time, seq, hasSeq, textStart)) {
+            if (!r.has_pending) {
+                // continuation at the start of the shard
+                r.pending.time.clear();
+                r.pending.seq = r.last_seq;
+                r.pending.order = r.order++;
+                r.pending.shard = shard;
+                r.pending.text.clear();
+                r.pending.lines = 0;
+                r.has_pending = true;
+            }
+            r.pending.text.append(line).push_back('\n');
+            ++r.pending.lines;
+            continue;
+        }
+        // lines the backend writes itself have no number, they
+        // stay after the line before them
+        r.last_seq = seq;
+        bool ready = r.has_pending;
+        if (ready) {
+            entry = std::move(r.pending);
+        }
+        r.pending.time.swap(time);
+        r.pending.seq = seq;
+        r.pending.order = r.order++;
+        r.pending.shard = shard;
+        r.pending.text.assign(line, textStart, std::string::npos);
+        r.pending.text.push_back('\n');
+        r.pending.lines = 1;
+        r.has_pending = true;
+        if (ready) {
+            return true;
+        }
+    }
+    if (r.has_pending) {
+        entry = std::move(r.pending);
+        r.has_pending = false;
+        return true;
+    }
+    return false;
+}
+
+bool LogShardMerger::merge(FILE *out)
+{
+    std::vector<Entry> heap;
+    heap.reserve(std::min<size_t>(_window * _readers.size(), 64 * 1024));
+    Later later;
+    for (size_t i = 0; i < _readers.size(); ++i) {
+        Entry e;
+        for (size_t n = 0; n < _window && read_entry(i, e); ++n) {
+            heap.push_back(std::move(e));
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    bool ok = true;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Entry e = std::move(heap.back());
+        heap.pop_back();
+        if (fwrite(e.text.data(), 1, e.text.size(), out) != e.text.size()) {
+            ok = false;
+            break;
+        }
+        _lines += e.lines;
+        // keep window lines of that shard in the heap
+        Entry next;
+        if (read_entry(e.shard, next)) {
+            heap.push_back(std::move(next));
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    for (size_t i = 0; i < _readers.size(); ++i) {
+        ok = ok && !_readers[i]->failed;
+    }
+    return ok;
+}
+
+}
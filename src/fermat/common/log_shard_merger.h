@@ -0,0 +1,88 @@
+#ifndef FERMAT_COMMON_LOG_SHARD_MERGER_H_
+#define FERMAT_COMMON_LOG_SHARD_MERGER_H_
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fermat {
+
+/*!
+* Merges the shard files of a LogShardedAsync into one log ordered
+* by time. Each shard is read in file order, a line is taken with
+* the lines after it that have no time prefix (continuations), and
+* the sequence number in front of it is removed. Lines of one shard
+* are not quite in time order, a thread takes the time before it
+* queues the line and may be preempted in between, so up to window
+* lines per shard are held and sorted; ties go by shard, then
+* sequence number. A line queued more than window lines late in
+* its shard comes out late. Text and JSON lines are understood.
+*/
+class LogShardMerger {
+public:
+    static const size_t kDefaultWindow = 4096;
+
+    explicit LogShardMerger(size_t window = kDefaultWindow);
+    ~LogShardMerger();
+
+    /*!
+    * Adds a shard as its files, oldest first.
+    */
+    void add_shard(const std::vector<std::string> &files);
+
+    /*!
+    * Finds the files baseName.<i>.*.log and adds one shard per i,
+    * each with its files sorted by name, which is by time.
+    * @return the number of shards found.
+    */
+    size_t add_shards(const std::string &baseName);
+
+    /*!
+    * Writes the merged log to out.
+    * @return false if a file could not be read or out failed.
+    */
+    bool merge(FILE *out);
+
+    /*!
+    * @return the lines written by merge(), continuations included.
+    */
+    uint64_t lines() const { return _lines; }
+private:
+    struct Entry {
+        std::string  time;
+        uint64_t     seq;
+        uint64_t     order;   //!< read order within the shard
+        size_t       shard;
+        std::string  text;    //!< the lines, newlines included
+        uint64_t     lines;
+    };
+
+    struct Reader {
+        std::vector<std::string>  files;
+        size_t                    next_file;
+        std::ifstream             in;
+        Entry                     pending;
+        bool                      has_pending;
+        uint64_t                  last_seq;
+        uint64_t                  order;
+        bool                      failed;
+    };
+
+    struct Later {
+        bool operator()(const Entry &a, const Entry &b) const;
+    };
+
+    bool read_line(Reader &r, std::string &line);
+    bool read_entry(size_t shard, Entry &entry);
+    static bool parse_head(const std::string &line, std::string &time,
+                           uint64_t &seq, bool &hasSeq, size_t &textStart);
+private:
+    const size_t                          _window;
+    std::vector<std::unique_ptr<Reader> > _readers;
+    uint64_t                              _lines;
+};
+
+}
+#endif
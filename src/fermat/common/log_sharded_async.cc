@@ -0,0 +1,111 @@
+#include <fermat/common/log_sharded_async.h>
+#include <fermat/common/this_thread.h>
+#include <cstring>
+
+namespace fermat {
+
+LogShardedAsync::LogShardedAsync(const std::string &baseName,
+                                 size_t rollSize,
+                                 size_t shards,
+                                 int flushInterval)
+    : LogOutput("sharded_async_log"),
+      _shards()
+{
+    if (shards == 0) {
+        shards = 1;
+    }
+    for (size_t i = 0; i < shards; ++i) {
+        LogAsync *shard = new LogAsync(baseName + "." + std::to_string(i), rollSize,
+                                       flushInterval, LogAsync::eLockedQueue);
+        shard->set_sequence(true);
+        _shards.push_back(std::unique_ptr<LogAsync>(shard));
+    }
+}
+
+LogShardedAsync::~LogShardedAsync()
+{
+    stop();
+}
+
+LogAsync* LogShardedAsync::thread_shard()
+{
+    return _shards[static_cast<size_t>(this_thread::thread_id()) % _shards.size()].get();
+}
+
+void LogShardedAsync::puts(const char* line, size_t len)
+{
+    thread_shard()->puts(line, len);
+}
+
+void LogShardedAsync::puts_level(int level, const char* line, size_t len)
+{
+    thread_shard()->puts_level(level, line, len);
+}
+
+void LogShardedAsync::flush()
+{
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        _shards[i]->flush();
+    }
+}
+
+int LogShardedAsync::crash_flush()
+{
+    int fd = -1;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        int shardFd = _shards[i]->crash_flush();
+        if (fd < 0) {
+            fd = shardFd;
+        }
+    }
+    return fd;
+}
+
+LogAsyncStats LogShardedAsync::stats()
+{
+    LogAsyncStats total;
+    memset(&total, 0, sizeof(total));
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        LogAsyncStats s = _shards[i]->stats();
+        total.queued_buffers += s.queued_buffers;
+        total.queued_bytes += s.queued_bytes;
+        total.written_lines += s.written_lines;
+        total.written_bytes += s.written_bytes;
+        total.extra_buffers += s.extra_buffers;
+        total.loops += s.loops;
+        total.append_micro_seconds += s.append_micro_seconds;
+        total.flush_micro_seconds += s.flush_micro_seconds;
+        total.dropped_lines += s.dropped_lines;
+        total.dropped_bytes += s.dropped_bytes;
+        total.coalesced_lines += s.coalesced_lines;
+        total.coalesced_bytes += s.coalesced_bytes;
+        total.syncs += s.syncs;
+        total.sync_micro_seconds += s.sync_micro_seconds;
+    }
+    return total;
+}
+
+void LogShardedAsync::set_sync_policy(const LogSyncPolicy &policy)
+{
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        _shards[i]->set_sync_policy(policy);
+    }
+}
+
+bool LogShardedAsync::start()
+{
+    bool ok = true;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        ok = _shards[i]->start() && ok;
+    }
+    return ok;
+}
+
+void LogShardedAsync::stop()
+{
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        _shards[i]->stop();
+    }
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef FERMAT_COMMON_LOG_SHARDED_ASYNC_H_
+#define FERMAT_COMMON_LOG_SHARDED_ASYNC_H_
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_async_stats.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fermat {
+
+/*!
+* Async log output with several LogAsync shards, each with its own
+* backend thread and files baseName.<i>.<time>.log, so formatting
+* and writing spread over cores and disks. A thread always logs to
+* shard thread_id % shards, which keeps its lines in order. Every
+* line starts with its sequence number in the shard (see
+* LogAsync::set_sequence); LogShardMerger, or the log_merge tool,
+* puts the shards back into one file ordered by time.
+*/
+class LogShardedAsync : public LogOutput {
+public:
+    LogShardedAsync(const std::string &baseName,
+                    size_t rollSize,
+                    size_t shards,
+                    int flushInterval = 3);
+    virtual ~LogShardedAsync();
+
+    size_t shard_count() const { return _shards.size(); }
+
+    /*!
+    * The LogAsync of shard i, to configure before start().
+    */
+    LogAsync& shard(size_t i) { return *_shards[i]; }
+
+    virtual void puts(const char* line, size_t len);
+
+    virtual void puts_level(int level, const char* line, size_t len);
+
+    virtual void flush();
+
+    /*!
+    * Calls crash_flush() of every shard.
+    * @return the descriptor of the first shard.
+    */
+    virtual int crash_flush();
+
+    /*!
+    * @return the counters of all shards added up.
+    */
+    LogAsyncStats stats();
+
+    /*!
+    * Sets the sync policy of every shard, see
+    * detail::LogWriterSchedule::set_sync_policy(). Must be
+    * called before start().
+    */
+    void set_sync_policy(const LogSyncPolicy &policy);
+
+    bool start();
+
+    void stop();
+private:
+    LogAsync* thread_shard();
+private:
+    std::vector<std::unique_ptr<LogAsync> >  _shards;
+};
+
+}
+#endif
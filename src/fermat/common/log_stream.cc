@@ -1,9 +1,48 @@
 #include <fermat/common/log_stream.h>
+#include <fermat/common/double-conversion/double-conversion.h>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
+#include <cmath>
 
 namespace fermat {
 
+namespace detail {
+
+const char kDigitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char kHexDigits[] = "0123456789ABCDEF";
+
+const char kEscape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    1,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\', 0,  0,   0
+    // the rest, DEL and bytes >= 0x80, is 0
+};
+
+// same flags as double_to_str(), built once
+static const double_conversion::DoubleToStringConverter kDoubleConverter(
+    double_conversion::DoubleToStringConverter::UNIQUE_ZERO |
+    double_conversion::DoubleToStringConverter::EMIT_POSITIVE_EXPONENT_SIGN,
+    kFltInf, kFltNan, kFltExp,
+    -std::numeric_limits<double>::digits10,
+    std::numeric_limits<double>::digits10, 0, 0);
+
+}
+
 LogStream& LogStream::operator<<(short v)
 {
 	*this<<static_cast<int>(v);
@@ -18,71 +57,365 @@ LogStream& LogStream::operator<<(unsigned short v)
 
 LogStream& LogStream::operator<<(int v)
 {
+    if(_binary) {
+        int32_t b = static_cast<int32_t>(v);
+        encode(eArgInt32, &b, sizeof(b));
+        return *this;
+    }
 	append_int(v);
 	return *this;
 }
 
 LogStream& LogStream::operator<<(unsigned int v)
 {
-	append_int(v);
+    if(_binary) {
+        uint32_t b = static_cast<uint32_t>(v);
+        encode(eArgUInt32, &b, sizeof(b));
+        return *this;
+    }
+	append_uint(v);
 	return *this;
 }
 
 LogStream& LogStream::operator<<(long v)
 {
+    if(_binary) {
+        int64_t b = static_cast<int64_t>(v);
+        encode(eArgInt64, &b, sizeof(b));
+        return *this;
+    }
     append_int(v);
 	return *this;
 }
 
 LogStream& LogStream::operator<<(unsigned long v)
 {
-	append_int(v);
+    if(_binary) {
+        uint64_t b = static_cast<uint64_t>(v);
+        encode(eArgUInt64, &b, sizeof(b));
+        return *this;
+    }
+	append_uint(v);
 	return *this;
 }
 
 LogStream& LogStream::operator<<(long long v)
 {
+    if(_binary) {
+        int64_t b = static_cast<int64_t>(v);
+        encode(eArgInt64, &b, sizeof(b));
+        return *this;
+    }
 	append_int(v);
 	return *this;
 }
 
 LogStream& LogStream::operator<<(unsigned long long v) 
 {
-	append_int(v);
+    if(_binary) {
+        uint64_t b = static_cast<uint64_t>(v);
+        encode(eArgUInt64, &b, sizeof(b));
+        return *this;
+    }
+	append_uint(v);
 	return *this;
 }
 
 LogStream& LogStream::operator<<(const void* p)
 {	
     uintptr_t v = reinterpret_cast<uintptr_t>(p);
-    std::string ret;
-    uint_to_str(v, 0x10, ret, true,  18, '0');
-    _buffer.append(ret.c_str(), ret.length());
+    if(_binary) {
+        encode(eArgPointer, &v, sizeof(v));
+        return *this;
+    }
+    append_pointer(_buffer, v);
 	return *this;
 }
 
+// "0x" and 16 zero padded upper case hex digits
+void LogStream::append_pointer(BasicBuffer<char> &buf, uintptr_t v)
+{
+    buf.reserve(buf.size() + kMaxNumericSize);
+    char* out = buf.current();
+    out[0] = '0';
+    out[1] = 'x';
+    for (int i = 17; i >= 2; --i) {
+        out[i] = detail::kHexDigits[v & 0xF];
+        v >>= 4;
+    }
+    buf.resize(buf.size() + 18);
+}
+
 LogStream& LogStream::operator<<(double v)
 {
-    std::string result; 
-    double_to_str(result, v);
-	*this<<result;
+    if(_binary) {
+        encode(eArgDouble, &v, sizeof(v));
+        return *this;
+    }
+    _buffer.reserve(_buffer.size() + kMaxNumericSize);
+    double_conversion::StringBuilder builder(_buffer.current(), kMaxNumericSize);
+    detail::kDoubleConverter.ToShortest(v, &builder);
+    _buffer.drain(builder.position());
 	return *this;
 }
 
-/*
+void LogStream::append_escaped(BasicBuffer<char> &buf, const char* data, size_t len)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    for (;;) {
+        // copy the run of bytes that need no escape in one go
+        const unsigned char* run = p;
+        while (p + 4 <= end && detail::kEscape[p[0]] <= 1 && detail::kEscape[p[1]] <= 1 &&
+               detail::kEscape[p[2]] <= 1 && detail::kEscape[p[3]] <= 1) {
+            p += 4;
+        }
+        while (p < end && detail::kEscape[*p] <= 1) {
+            ++p;
+        }
+        buf.append(reinterpret_cast<const char*>(run), static_cast<size_t>(p - run));
+        if (p == end) {
+            return;
+        }
+        char e = detail::kEscape[*p];
+        if (e == 'u') {
+            char esc[6] = {'\\', 'u', '0', '0',
+                           detail::kHexDigits[*p >> 4], detail::kHexDigits[*p & 0xF]};
+            buf.append(esc, sizeof(esc));
+        } else {
+            char esc[2] = {'\\', e};
+            buf.append(esc, sizeof(esc));
+        }
+        ++p;
+    }
+}
+
+void LogStream::finish_json()
+{
+    _json = false;
+    _buffer.push_back('"');
+    _buffer.append(_fields.data(), _fields.size());
+    _fields.clear();
+    _buffer.push_back('}');
+}
+
+BasicBuffer<char>& LogStream::begin_field(const char* key)
+{
+    if (_json) {
+        _fields.push_back(',');
+        _fields.push_back('"');
+        append_escaped(_fields, key, strlen(key));
+        _fields.push_back('"');
+        _fields.push_back(':');
+        return _fields;
+    }
+    _buffer.append(key, strlen(key));
+    _buffer.push_back('=');
+    return _buffer;
+}
+
+void LogStream::end_field(BasicBuffer<char> &buf)
+{
+    if (!_json) {
+        buf.push_back(' ');
+    }
+}
+
+void LogStream::append_double(BasicBuffer<char> &buf, double v)
+{
+    buf.reserve(buf.size() + kMaxNumericSize);
+    double_conversion::StringBuilder builder(buf.current(), kMaxNumericSize);
+    detail::kDoubleConverter.ToShortest(v, &builder);
+    buf.resize(buf.size() + builder.position());
+}
+
+LogStream& LogStream::kv_int(const char* key, long long v)
+{
+    if (_binary) {
+        *this << key << '=' << v << ' ';
+        return *this;
+    }
+    BasicBuffer<char> &buf = begin_field(key);
+    append_int(buf, v);
+    end_field(buf);
+    return *this;
+}
+
+LogStream& LogStream::kv_uint(const char* key, unsigned long long v)
+{
+    if (_binary) {
+        *this << key << '=' << v << ' ';
+        return *this;
+    }
+    BasicBuffer<char> &buf = begin_field(key);
+    append_uint(buf, v);
+    end_field(buf);
+    return *this;
+}
+
+LogStream& LogStream::kv(const char* key, bool v)
+{
+    if (_binary) {
+        *this << key << '=' << (v ? "true" : "false") << ' ';
+        return *this;
+    }
+    BasicBuffer<char> &buf = begin_field(key);
+    if (v) {
+        buf.append("true", 4);
+    } else {
+        buf.append("false", 5);
+    }
+    end_field(buf);
+    return *this;
+}
+
+LogStream& LogStream::kv(const char* key, char v)
+{
+    return kv_string(key, &v, 1);
+}
+
+LogStream& LogStream::kv(const char* key, double v)
+{
+    if (_binary) {
+        *this << key << '=' << v << ' ';
+        return *this;
+    }
+    BasicBuffer<char> &buf = begin_field(key);
+    if (_json && !std::isfinite(v)) {
+        // JSON has no inf or nan
+        buf.append("null", 4);
+    } else {
+        append_double(buf, v);
+    }
+    end_field(buf);
+    return *this;
+}
+
+LogStream& LogStream::kv(const char* key, const void* v)
+{
+    if (_binary) {
+        *this << key << '=' << v << ' ';
+        return *this;
+    }
+    BasicBuffer<char> &buf = begin_field(key);
+    if (_json) {
+        buf.push_back('"');
+        append_pointer(buf, reinterpret_cast<uintptr_t>(v));
+        buf.push_back('"');
+        return *this;
+    }
+    append_pointer(buf, reinterpret_cast<uintptr_t>(v));
+    end_field(buf);
+    return *this;
+}
+
+LogStream& LogStream::kv_string(const char* key, const char* v, size_t len)
+{
+    bool quote = _json || len == 0;
+    for (size_t i = 0; !quote && i < len; ++i) {
+        quote = detail::kEscape[static_cast<unsigned char>(v[i])] != 0;
+    }
+    if (_binary) {
+        // stored as the text line would quote it, the decoder
+        // only copies strings
+        *this << key << '=';
+        if (quote) {
+            Buffer quoted;
+            quoted.push_back('"');
+            append_escaped(quoted, v, len);
+            quoted.push_back('"');
+            append(quoted.data(), quoted.size());
+        } else {
+            append(v, len);
+        }
+        *this << ' ';
+        return *this;
+    }
+    BasicBuffer<char> &buf = begin_field(key);
+    if (quote) {
+        buf.push_back('"');
+        append_escaped(buf, v, len);
+        buf.push_back('"');
+    } else {
+        buf.append(v, len);
+    }
+    end_field(buf);
+    return *this;
+}
+
 LogStream& LogStream::sprintf(const char *fmt, ...)
 {
-	if(_buffer.avaible() <= 2) {
-		return *this;
-	}
-	va_list args;
-	va_start(args, fmt);
-	int size = vsnprintf(_buffer.current(), _buffer.avaible() -2, fmt, args);
-	va_end(args);
-	if(size > 0) {
-		_buffer.drain(size);
-	}
-	return *this;
+    va_list args;
+    va_start(args, fmt);
+    if (_binary || _json) {
+        append_formatted(fmt, args);
+    } else if (_buffer.avaible() > 2) {
+        int size = vsnprintf(_buffer.current(), _buffer.avaible() - 2, fmt, args);
+        if (size > 0) {
+            _buffer.drain(std::min(static_cast<size_t>(size), _buffer.avaible() - 3));
+        }
+    }
+    va_end(args);
+    return *this;
+}
+
+// formats straight into the buffer, after room for the string
+// header in binary mode; in JSON mode the text is then escaped in
+// place, back to front
+void LogStream::append_formatted(const char *fmt, va_list args)
+{
+    const size_t header = _binary ? 1 + sizeof(uint32_t) : 0;
+    const size_t mark = _buffer.size();
+    va_list again;
+    va_copy(again, args);
+    _buffer.reserve(mark + header + kMaxNumericSize);
+    size_t room = _buffer.capacity() - mark - header;
+    int size = vsnprintf(&_buffer[mark + header], room, fmt, args);
+    if (size >= 0 && static_cast<size_t>(size) >= room) {
+        _buffer.reserve(mark + header + size + 1);
+        size = vsnprintf(&_buffer[mark + header], size + 1, fmt, again);
+    }
+    va_end(again);
+    if (size <= 0) {
+        return;
+    }
+    size_t len = static_cast<size_t>(size);
+    if (_binary) {
+        uint32_t n = static_cast<uint32_t>(len);
+        _buffer[mark] = static_cast<char>(eArgString);
+        memcpy(&_buffer[mark + 1], &n, sizeof(n));
+        _buffer.drain(header + len);
+        return;
+    }
+    size_t extra = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char e = detail::kEscape[static_cast<unsigned char>(_buffer[mark + i])];
+        extra += e == 'u' ? 5 : (e > 1 ? 1 : 0);
+    }
+    // the text becomes part of the buffer before it may grow
+    _buffer.resize(mark + len);
+    if (extra == 0) {
+        return;
+    }
+    _buffer.resize(mark + len + extra);
+    char* text = &_buffer[mark];
+    size_t out = len + extra;
+    for (size_t i = len; i > 0; --i) {
+        unsigned char c = static_cast<unsigned char>(text[i - 1]);
+        char e = detail::kEscape[c];
+        if (e <= 1) {
+            text[--out] = static_cast<char>(c);
+        } else if (e == 'u') {
+            text[--out] = detail::kHexDigits[c & 0xF];
+            text[--out] = detail::kHexDigits[c >> 4];
+            text[--out] = '0';
+            text[--out] = '0';
+            text[--out] = 'u';
+            text[--out] = '\\';
+        } else {
+            text[--out] = e;
+            text[--out] = '\\';
+        }
+    }
 }
-*/
 }
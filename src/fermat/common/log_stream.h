@@ -5,22 +5,100 @@
 #include <fermat/common/string.h>
 #include <fermat/common/numeric_string.h>
 #include <string>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdint>
+#include <type_traits>
 namespace fermat {
 
+namespace detail {
+
+// "00" "01" ... "99", two characters per entry
+extern const char kDigitPairs[201];
+
+// per byte: 0 plain, 1 plain but quoted in a text field value,
+// 'u' written as \u00XX, any other c written as \c
+extern const char kEscape[256];
+
+template <typename T>
+inline size_t count_digits(T v)
+{
+    size_t n = 1;
+    for (;;) {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+/*!
+* Writes the decimal digits of the unsigned value v to out,
+* two digits per step from the pair table.
+* @return the number of characters written.
+*/
+template <typename T>
+inline size_t format_decimal(char* out, T v)
+{
+    size_t len = count_digits(v);
+    char* p = out + len;
+    while (v >= 100) {
+        size_t idx = static_cast<size_t>(v % 100) * 2;
+        v /= 100;
+        *--p = kDigitPairs[idx + 1];
+        *--p = kDigitPairs[idx];
+    }
+    if (v < 10) {
+        *--p = static_cast<char>('0' + v);
+    } else {
+        size_t idx = static_cast<size_t>(v) * 2;
+        *--p = kDigitPairs[idx + 1];
+        *--p = kDigitPairs[idx];
+    }
+    return len;
+}
+
+}
+
 class LogStream{
 public:
     static const int kBufferSize = 2048;
+    // inline room of the kv() members of a JSON line
+    static const int kFieldsSize = 256;
+    // room reserved in the buffer before formatting one number
+    static const int kMaxNumericSize = 64;
     typedef StackBuffer<char, kBufferSize> Buffer;
+    typedef StackBuffer<char, kFieldsSize> FieldBuffer;
     typedef LogStream self;
+
+    /*!
+    * In binary mode every argument is stored as one of these
+    * tags followed by its raw bytes, strings as a uint32_t length
+    * and the bytes. Formatting is left to the record decoder.
+    */
+    enum ArgTag {
+        eArgInt32 = 1,
+        eArgUInt32,
+        eArgInt64,
+        eArgUInt64,
+        eArgDouble,
+        eArgChar,
+        eArgString,
+        eArgPointer
+    };
 public:
-    LogStream(){}
+    LogStream():_fields(), _binary(false), _json(false){}
     ~LogStream(){}
 
     self& operator << (bool v)
     {
         static const char *t = "1";
         static const char *f = "0";
-        if(v) {
+        if(_binary) {
+            encode_char(v ? '1' : '0');
+        } else if(v) {
             _buffer.append(t, t+1);
         } else {
             _buffer.append(f, f+1);   
@@ -48,59 +126,194 @@ public:
 
     self& operator<<(char v)
     {
+        if(_binary) {
+            encode_char(v);
+            return *this;
+        }
+        if(_json) {
+            append_escaped(_buffer, &v, 1);
+            return *this;
+        }
         _buffer.append(&v, 1);
         return *this;
     }
 
     self& operator<<(const char* v)
     {
-        _buffer.append(v, strlen(v));
+        append(v, strlen(v));
         return *this;
     }
 
     self& operator<<(const std::string& v)
     {
-        _buffer.append(v.c_str(), v.size());
+        append(v.c_str(), v.size());
         return *this;
     }
 
     self& operator<<(const StringRef& v)
     {
-        _buffer.append(v.data(), v.size());
+        append(v.data(), v.size());
         return *this;
     }
 
-    self& sprintf(const char *fmt, ...)
+    /*!
+    * Adds the field key=value to the line. In text format it is
+    * written in place as "key=value ", a string value in double
+    * quotes if it holds a blank, '=', '"' or a control character.
+    * In JSON format (set_json) it becomes the member "key":value
+    * after "msg", kept in an inline buffer until finish_json().
+    * Values are escaped straight into the buffer. In binary mode the field is stored as the arguments
+    * key, '=', value (quoted as in text) and ' '.
+    */
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, self&>::type
+    kv(const char* key, T v)
     {
-	    if(_buffer.avaible() <= 2) {
-		    return *this;
-	    }
-	    va_list args;
-    	va_start(args, fmt);
-	    int size = vsnprintf(_buffer.current(), _buffer.avaible() -2, fmt, args);
-    	va_end(args);
-    	if(size > 0) {
-    		_buffer.drain(size);
-    	}
-	    return *this;
+        return kv_int(key, static_cast<long long>(v));
     }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, self&>::type
+    kv(const char* key, T v)
+    {
+        return kv_uint(key, static_cast<unsigned long long>(v));
+    }
+
+    self& kv(const char* key, bool v);
+    self& kv(const char* key, char v);
+    self& kv(const char* key, double v);
+    self& kv(const char* key, const void* v);
+
+    self& kv(const char* key, const char* v)
+    {
+        return kv_string(key, v, strlen(v));
+    }
+
+    self& kv(const char* key, const std::string& v)
+    {
+        return kv_string(key, v.data(), v.size());
+    }
+
+    self& kv(const char* key, const StringRef& v)
+    {
+        return kv_string(key, v.data(), v.size());
+    }
+
+    self& sprintf(const char *fmt, ...);
     
     void append(const char* data, size_t len)
     {
+        if(_binary) {
+            encode_string(data, len);
+            return;
+        }
+        if(_json) {
+            append_escaped(_buffer, data, len);
+            return;
+        }
         _buffer.append(data, len);
     }
+
+    /*!
+    * Switches argument encoding between text and binary,
+    * bytes already in the buffer are left alone.
+    */
+    void set_binary(bool on) { _binary = on; }
+    bool binary() const { return _binary; }
+
+    /*!
+    * Starts the JSON body of a line: the buffer must end inside
+    * the open string of "msg", text appended from now on is
+    * escaped into it and kv() fields are kept aside.
+    */
+    void set_json(bool on) { _json = on; }
+    bool json() const { return _json; }
+
+    /*!
+    * Closes "msg", appends the kv() fields and the closing brace
+    * and leaves JSON mode.
+    */
+    void finish_json();
+
+    /*!
+    * Appends data to buf with '"', '\\' and control characters
+    * escaped as in a JSON string. Other bytes, UTF-8 included,
+    * are copied as they are.
+    */
+    static void append_escaped(BasicBuffer<char> &buf, const char* data, size_t len);
+
     const Buffer& buffer() const { return _buffer; }
+    Buffer& buffer() { return _buffer; }
     void reset_bufffer() { _buffer.clear(); }
 private:
+    void encode(ArgTag tag, const void *v, size_t len)
+    {
+        _buffer.push_back(static_cast<char>(tag));
+        _buffer.append(static_cast<const char*>(v), len);
+    }
+
+    void encode_char(char v)
+    {
+        _buffer.push_back(static_cast<char>(eArgChar));
+        _buffer.push_back(v);
+    }
+
+    void encode_string(const char* data, size_t len)
+    {
+        uint32_t size = static_cast<uint32_t>(len);
+        encode(eArgString, &size, sizeof(size));
+        _buffer.append(data, len);
+    }
+
+    self& kv_int(const char* key, long long v);
+    self& kv_uint(const char* key, unsigned long long v);
+    self& kv_string(const char* key, const char* v, size_t len);
+    BasicBuffer<char>& begin_field(const char* key);
+    void end_field(BasicBuffer<char> &buf);
+    static void append_double(BasicBuffer<char> &buf, double v);
+    static void append_pointer(BasicBuffer<char> &buf, uintptr_t v);
+    void append_formatted(const char *fmt, va_list args);
+
+    template <typename T>
+    void append_uint(T value)
+    {
+        append_uint(_buffer, value);
+    }
+
     template <typename T>
-    void append_int(T value) 
+    void append_int(T value)
     {
-        std::string ret;
-        uint_to_str(value, 0x10, ret);
-        _buffer.append(ret.data(), ret.length());
+        append_int(_buffer, value);
+    }
+
+    template <typename T>
+    static void append_uint(BasicBuffer<char> &buf, T value)
+    {
+        buf.reserve(buf.size() + kMaxNumericSize);
+        buf.resize(buf.size() + detail::format_decimal(buf.current(), value));
+    }
+
+    template <typename T>
+    static void append_int(BasicBuffer<char> &buf, T value)
+    {
+        buf.reserve(buf.size() + kMaxNumericSize);
+        char* p = buf.current();
+        size_t n = 0;
+        typedef typename std::make_unsigned<T>::type U;
+        U u = static_cast<U>(value);
+        if (value < 0) {
+            p[n++] = '-';
+            u = static_cast<U>(0) - u;
+        }
+        n += detail::format_decimal(p + n, u);
+        buf.resize(buf.size() + n);
     }
 private:
     Buffer _buffer;
+    // kv() members in JSON mode, they go after "msg"
+    FieldBuffer _fields;
+    bool   _binary;
+    bool   _json;
 };
 
 }
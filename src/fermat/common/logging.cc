@@ -1,16 +1,26 @@
 #include <fermat/common/this_thread.h>
 #include <fermat/common/logging.h>
+#include <fermat/common/log_record.h>
+#include <fermat/common/mutex.h>
+#include <fermat/common/hazard_pointer.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <fnmatch.h>
 #include <sstream>
+#include <atomic>
+#include <vector>
 
 namespace fermat {
 __thread char t_errnobuf[512];
 __thread char t_time[32];
 __thread time_t t_lastSecond;
 
+std::atomic<int> g_clock_source(Logging::eClockRealtime);
+
 const char* strerror_tl(int savedErrno)
 {
     ::strerror_r(savedErrno, t_errnobuf, sizeof t_errnobuf);
@@ -28,7 +38,18 @@ Logging::LogLevel init_log_level()
   }
 }
 
-Logging::LogLevel g_log_level = init_log_level();
+std::atomic<int> g_log_level(init_log_level());
+
+static Logging::LogFormat init_log_format()
+{
+    const char* env = ::getenv("FERMAT_LOG_FORMAT");
+    if (env && strcasecmp(env, "json") == 0) {
+        return Logging::eFormatJson;
+    }
+    return Logging::eFormatText;
+}
+
+std::atomic<int> g_log_format(init_log_format());
 
 const char* LogLevelName[Logging::eNUM_LOG_LEVELS] =
 {
@@ -65,6 +86,210 @@ inline LogStream& operator<<(LogStream& s, const Logging::SourceFile& v)
   return s;
 }
 
+// head of the LogSite registry, sites are pushed in front
+static std::atomic<LogSite*> g_sites(NULL);
+
+struct ModuleLevel {
+    std::string  pattern;
+    int          level;
+};
+typedef std::vector<ModuleLevel> ModuleLevels;
+
+static std::string strip_blank(const std::string &str)
+{
+    size_t first = str.find_first_not_of(" \t");
+    if (first == std::string::npos) {
+        return std::string();
+    }
+    size_t last = str.find_last_not_of(" \t");
+    return str.substr(first, last - first + 1);
+}
+
+static bool parse_vmodule(const std::string &spec, ModuleLevels &levels)
+{
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = strip_blank(spec.substr(pos, end - pos));
+        pos = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        ModuleLevel ml;
+        ml.pattern = strip_blank(item.substr(0, eq));
+        std::string level = strip_blank(item.substr(eq + 1));
+        ml.level = -1;
+        for (int i = 0; i < Logging::eNUM_LOG_LEVELS; ++i) {
+            std::string name = strip_blank(std::string(LogLevelName[i]));
+            if (strcasecmp(name.c_str(), level.c_str()) == 0) {
+                ml.level = i;
+            }
+        }
+        if (ml.level < 0 && level.size() == 1 &&
+            level[0] >= '0' && level[0] < '0' + Logging::eNUM_LOG_LEVELS) {
+            ml.level = level[0] - '0';
+        }
+        if (ml.pattern.empty() || ml.level < 0) {
+            return false;
+        }
+        levels.push_back(ml);
+    }
+    return true;
+}
+
+// set_vmodule entries and the lock serializing threshold updates with
+// site registration, function statics so sites built during static
+// initialization of other files find them constructed
+static Mutex& vmodule_mutex()
+{
+    static Mutex mutex;
+    return mutex;
+}
+
+static ModuleLevels& vmodule_levels()
+{
+    static ModuleLevels levels;
+    static bool loaded = false;
+    if (!loaded) {
+        loaded = true;
+        const char* env = ::getenv("FERMAT_LOG_VMODULE");
+        if (env && !parse_vmodule(env, levels)) {
+            levels.clear();
+        }
+    }
+    return levels;
+}
+
+// called with vmodule_mutex held
+static int site_threshold(const LogSite *site)
+{
+    const ModuleLevels &levels = vmodule_levels();
+    if (!levels.empty()) {
+        const char* dot = static_cast<const char*>(
+            memchr(site->basename, '.', site->basename_size));
+        std::string module(site->basename,
+                           dot ? dot - site->basename : site->basename_size);
+        for (size_t i = 0; i < levels.size(); ++i) {
+            if (::fnmatch(levels[i].pattern.c_str(), module.c_str(), 0) == 0) {
+                return levels[i].level;
+            }
+        }
+    }
+    return g_log_level.load(std::memory_order_relaxed);
+}
+
+static void update_thresholds()
+{
+    for (LogSite *site = g_sites.load(std::memory_order_acquire);
+         site != NULL; site = site->next) {
+        site->threshold.store(site_threshold(site), std::memory_order_relaxed);
+    }
+}
+
+LogSite::LogSite(const char* fileName, const char* funcName, int lineNum, int lvl)
+  : file(fileName),
+    func(funcName),
+    line(lineNum),
+    level(lvl),
+    basename(fileName),
+    basename_size(0),
+    prefix(NULL),
+    prefix_size(0),
+    json_prefix(NULL),
+    json_prefix_size(0),
+    threshold(0),
+    next(NULL)
+{
+    const char* slash = strrchr(fileName, '/');
+    if (slash) {
+        basename = slash + 1;
+    }
+    basename_size = strlen(basename);
+
+    LogStream stream;
+    stream << T(LogLevelName[level], 6) << " [";
+    stream.append(basename, basename_size);
+    stream << ':' << line << "] " << func << ' ';
+    char* bytes = new char[stream.buffer().size()];
+    memcpy(bytes, stream.buffer().data(), stream.buffer().size());
+    prefix = bytes;
+    prefix_size = stream.buffer().size();
+
+    // "level":"INFO","file":"f.cc","line":N,"func":"f","msg":"
+    LogStream json;
+    json << "\"level\":\"";
+    json.append(LogLevelName[level], strcspn(LogLevelName[level], " "));
+    json << "\",\"file\":\"";
+    LogStream::append_escaped(json.buffer(), basename, basename_size);
+    json << "\",\"line\":" << line << ",\"func\":\"";
+    LogStream::append_escaped(json.buffer(), func, strlen(func));
+    json << "\",\"msg\":\"";
+    bytes = new char[json.buffer().size()];
+    memcpy(bytes, json.buffer().data(), json.buffer().size());
+    json_prefix = bytes;
+    json_prefix_size = json.buffer().size();
+
+    ScopedMutex lock(vmodule_mutex());
+    threshold.store(site_threshold(this), std::memory_order_relaxed);
+    next = g_sites.load(std::memory_order_relaxed);
+    g_sites.store(this, std::memory_order_release);
+}
+
+void Logging::for_each_site(const std::function<void(LogSite*)> &fn)
+{
+    for (LogSite *site = g_sites.load(std::memory_order_acquire);
+         site != NULL; site = site->next) {
+        fn(site);
+    }
+}
+
+bool LogLimit::every_t(int64_t ms, uint64_t *skipped)
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    int64_t now = static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    int64_t next = next_time.load(std::memory_order_relaxed);
+    if (now < next ||
+        !next_time.compare_exchange_strong(next, now + ms, std::memory_order_relaxed)) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    *skipped = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+// xorshift64*, one generator per thread
+static __thread uint64_t t_sample_state;
+
+bool LogLimit::sampled(double p, uint64_t *skipped)
+{
+    uint64_t x = t_sample_state;
+    if (x == 0) {
+        x = static_cast<uint64_t>(this_thread::thread_id()) * 0x9E3779B97F4A7C15ULL |
+            1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t_sample_state = x;
+    // top 53 bits as a double in [0, 1)
+    double r = static_cast<double>((x * 0x2545F4914F6CDD1DULL) >> 11) *
+               (1.0 / 9007199254740992.0);
+    if (r >= p) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    *skipped = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
 class DefaultOutPut : public LogOutput {
 public:
     DefaultOutPut():LogOutput("default_log_output") {}
@@ -80,49 +305,257 @@ public:
         fflush(stdout);   
     }
 };
+// g_output owns the output, readers go through g_output_ptr
+// under a HazardPtr and never touch the reference count.
+// g_output is only read and written under g_output_mutex.
 LogOutputPtr g_output(new DefaultOutPut());
+std::atomic<LogOutput*> g_output_ptr(g_output.get());
+Mutex g_output_mutex;
+// whether g_output takes binary records, cached by set_output
+std::atomic<bool> g_output_binary(false);
+
+static void format_time(LogStream &stream, int64_t microSecondsSinceEpoch);
+static void format_time(char* out, int64_t microSecondsSinceEpoch);
 
 Logging::Impl::Impl(LogLevel level, int savedErrno, const SourceFile& file, int line)
-  : _time(),
+  : _time(now()),
     _stream(),
     _level(level),
     _line(line),
-    _basename(file)
+    _basename(file),
+    _site(NULL),
+    _record(g_output_binary.load(std::memory_order_relaxed))
 {
-   
-    format_time();
+    if (_record) {
+        // text line wrapped in a record with no site
+        LogRecordHeader header = LogRecordHeader();
+        _stream.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    } else if (g_log_format.load(std::memory_order_relaxed) == eFormatJson) {
+        format_json_prefix(_stream, _time.total_micro_seconds(),
+                           this_thread::thread_id(), level, _basename, _line,
+                           savedErrno);
+        _stream.set_json(true);
+        return;
+    }
     this_thread::thread_id();
+    format_prefix(_stream, _time.total_micro_seconds(),
+                  this_thread::thread_id_string(),
+                  this_thread::thread_id_string_length(),
+                  level, _basename, _line, savedErrno);
+}
+
+Logging::Impl::Impl(const LogSite *site, int savedErrno)
+  : _time(now()),
+    _stream(),
+    _level(static_cast<LogLevel>(site->level)),
+    _line(site->line),
+    _basename(site->file, 0),
+    _site(site),
+    _record(g_output_binary.load(std::memory_order_relaxed))
+{
+    if (_record) {
+        LogRecordHeader header = LogRecordHeader();
+        header.saved_errno = savedErrno;
+        header.micro_seconds = _time.total_micro_seconds();
+        header.site = site;
+        header.tid = this_thread::thread_id();
+        _stream.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        _stream.set_binary(true);
+        return;
+    }
+    _basename = SourceFile(site->basename, site->basename_size);
+    if (g_log_format.load(std::memory_order_relaxed) == eFormatJson) {
+        format_json_prefix(_stream, _time.total_micro_seconds(),
+                           this_thread::thread_id(), site, savedErrno);
+        _stream.set_json(true);
+        return;
+    }
+    this_thread::thread_id();
+    format_prefix(_stream, _time.total_micro_seconds(),
+                  this_thread::thread_id_string(),
+                  this_thread::thread_id_string_length(),
+                  site, savedErrno);
+}
+
+void Logging::format_prefix(LogStream &stream, int64_t microSeconds,
+                            const char* tid, size_t tidLen,
+                            LogLevel level, const SourceFile &file,
+                            int line, int savedErrno)
+{
+    format_time(stream, microSeconds);
+    stream << T(tid, tidLen) << " ";
+    stream << T(LogLevelName[level], 6);
+    stream << " [" << file << ':' << line << "] ";
+    if (savedErrno != 0) {
+        stream << strerror_tl(savedErrno) << " (errno=" << savedErrno << ") ";
+    }
+}
 
-    _stream << T(this_thread::thread_id_string(),this_thread::thread_id_string_length())<<" ";
-    _stream << T(LogLevelName[level], 6);
-    _stream << " [" << _basename << ':' << _line << "] ";
+void Logging::format_prefix(LogStream &stream, int64_t microSeconds,
+                            const char* tid, size_t tidLen,
+                            const LogSite *site, int savedErrno)
+{
     if (savedErrno != 0) {
-        _stream << strerror_tl(savedErrno) << " (errno=" << savedErrno << ") ";
+        // the errno text goes between "] " and the function name
+        format_prefix(stream, microSeconds, tid, tidLen,
+                      static_cast<LogLevel>(site->level),
+                      SourceFile(site->basename, site->basename_size),
+                      site->line, savedErrno);
+        stream << site->func << ' ';
+        return;
     }
+    format_time(stream, microSeconds);
+    stream.append(tid, tidLen);
+    stream.append(" ", 1);
+    stream.append(site->prefix, site->prefix_size);
+}
+
+// {"time":"YYYYMMDD HH:MM:SS.uuuuuuZ","tid":N, plus the errno members
+static void format_json_head(LogStream &stream, int64_t microSeconds,
+                             int tid, int savedErrno)
+{
+    char time[25];
+    format_time(time, microSeconds);
+    stream << T("{\"time\":\"", 9);
+    stream.append(time, sizeof(time));
+    stream << T("\",\"tid\":", 8) << tid << ',';
+    if (savedErrno != 0) {
+        stream << T("\"errno\":", 8) << savedErrno << T(",\"error\":\"", 10);
+        const char* error = strerror_tl(savedErrno);
+        LogStream::append_escaped(stream.buffer(), error, strlen(error));
+        stream << T("\",", 2);
+    }
+}
+
+void Logging::format_json_prefix(LogStream &stream, int64_t microSeconds,
+                                 int tid, LogLevel level,
+                                 const SourceFile &file, int line,
+                                 int savedErrno)
+{
+    format_json_head(stream, microSeconds, tid, savedErrno);
+    stream << T("\"level\":\"", 9);
+    stream.append(LogLevelName[level], strcspn(LogLevelName[level], " "));
+    stream << T("\",\"file\":\"", 10);
+    LogStream::append_escaped(stream.buffer(), file._data, file._size);
+    stream << T("\",\"line\":", 9) << line << T(",\"msg\":\"", 8);
 }
 
-void Logging::Impl::format_time()
+void Logging::format_json_prefix(LogStream &stream, int64_t microSeconds,
+                                 int tid, const LogSite *site, int savedErrno)
+{
+    format_json_head(stream, microSeconds, tid, savedErrno);
+    stream.append(site->json_prefix, site->json_prefix_size);
+}
+
+static inline void put_2digits(char* p, int v)
+{
+    memcpy(p, &detail::kDigitPairs[v * 2], 2);
+}
+
+// writes the 25 bytes "YYYYMMDD HH:MM:SS.uuuuuuZ" to out
+static void format_time(char* out, int64_t microSecondsSinceEpoch)
 {
-    int64_t microSecondsSinceEpoch = _time.total_micro_seconds();
     time_t seconds = static_cast<time_t>(microSecondsSinceEpoch / 1000000);
     int microseconds = static_cast<int>(microSecondsSinceEpoch % 1000000);
     if (seconds != t_lastSecond) {
+        // "YYYYMMDD HH:MM:SS", the date part only changes at midnight
+        if (seconds / 86400 != t_lastSecond / 86400) {
+            struct tm tm_time;
+            ::gmtime_r(&seconds, &tm_time);
+            int year = tm_time.tm_year + 1900;
+            put_2digits(t_time, year / 100);
+            put_2digits(t_time + 2, year % 100);
+            put_2digits(t_time + 4, tm_time.tm_mon + 1);
+            put_2digits(t_time + 6, tm_time.tm_mday);
+            t_time[8] = ' ';
+            t_time[11] = ':';
+            t_time[14] = ':';
+        }
         t_lastSecond = seconds;
-        struct tm tm_time;
-        ::gmtime_r(&seconds, &tm_time);
-        int len = snprintf(t_time, sizeof(t_time), "%4d%02d%02d %02d:%02d:%02d",
-            tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-            tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
-        assert(len == 17); (void)len;
+        int daySeconds = static_cast<int>(seconds % 86400);
+        put_2digits(t_time + 9, daySeconds / 3600);
+        put_2digits(t_time + 12, daySeconds / 60 % 60);
+        put_2digits(t_time + 15, daySeconds % 60);
+    }
+    memcpy(out, t_time, 17);
+    out[17] = '.';
+    put_2digits(out + 18, microseconds / 10000);
+    put_2digits(out + 20, microseconds / 100 % 100);
+    put_2digits(out + 22, microseconds % 100);
+    out[24] = 'Z';
+}
+
+size_t Logging::format_note(char* buf, size_t size, int64_t microSeconds,
+                            const char* fmt, ...)
+{
+    // "YYYYMMDD HH:MM:SS.uuuuuuZ "
+    const size_t timeSize = 26;
+    if (size <= timeSize) {
+        return 0;
+    }
+    format_time(buf, microSeconds);
+    buf[timeSize - 1] = ' ';
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + timeSize, size - timeSize, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return 0;
     }
-    char us[32];
-    snprintf(us, (sizeof(us) -1), ".%06dZ ", microseconds);
-    _stream << T(t_time, 17) << T(us, 9);
+    size_t len = timeSize + static_cast<size_t>(n);
+    return len < size ? len : size - 1;
+}
+
+static void format_time(LogStream &stream, int64_t microSecondsSinceEpoch)
+{
+    // "YYYYMMDD HH:MM:SS.uuuuuuZ "
+    char prefix[26];
+    format_time(prefix, microSecondsSinceEpoch);
+    prefix[25] = ' ';
+    stream.append(prefix, sizeof(prefix));
+}
+
+Timestamp Logging::now()
+{
+    if (g_clock_source.load(std::memory_order_relaxed) == eClockCoarse) {
+        struct timespec ts;
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return Timestamp(static_cast<Timestamp::TimeVal>(ts.tv_sec) * Timestamp::ratio() +
+                         ts.tv_nsec / 1000);
+    }
+    return Timestamp();
+}
+
+void Logging::set_format(LogFormat format)
+{
+    g_log_format.store(format, std::memory_order_relaxed);
+}
+
+Logging::LogFormat Logging::format()
+{
+    return static_cast<LogFormat>(g_log_format.load(std::memory_order_relaxed));
+}
+
+void Logging::set_clock_source(ClockSource source)
+{
+    g_clock_source.store(source, std::memory_order_relaxed);
 }
 
 void Logging::Impl::finish()
 {
-    _stream <<'\n';
+    if (_stream.binary()) {
+        _stream.set_binary(false);
+    } else if (_stream.json()) {
+        _stream.finish_json();
+        _stream << '\n';
+    } else {
+        _stream <<'\n';
+    }
+    if (_record) {
+        LogStream::Buffer &buf = _stream.buffer();
+        uint32_t size = static_cast<uint32_t>(buf.size());
+        memcpy(&buf[0], &size, sizeof(size));
+    }
 }
 
 Logging::Logging(SourceFile file, int line)
@@ -133,7 +566,11 @@ Logging::Logging(SourceFile file, int line)
 Logging::Logging(SourceFile file, int line, LogLevel level, const char* func)
   : _impl(level, 0, file, line)
 {
-  _impl._stream << func << ' ';
+    if (_impl._stream.json()) {
+        _impl._stream.kv("func", func);
+    } else {
+        _impl._stream << func << ' ';
+    }
 }
 
 Logging::Logging(SourceFile file, int line, LogLevel level)
@@ -146,27 +583,111 @@ Logging::Logging(SourceFile file, int line, bool toAbort)
 {
 }
 
+Logging::Logging(const LogSite *site)
+  : _impl(site, 0)
+{
+}
+
+Logging::Logging(const LogSite *site, uint64_t suppressed)
+  : _impl(site, 0)
+{
+    if (suppressed > 0 && _impl._stream.json()) {
+        _impl._stream.kv("suppressed", suppressed);
+    } else if (suppressed > 0) {
+        _impl._stream << '(' << suppressed << " suppressed) ";
+    }
+}
+
 Logging::~Logging()
 {
     _impl.finish();/*
     const char * data = stream().buffer().data();
     size_t size = stream().buffer().size();*/
+    HazardPtr<LogOutput> out(g_output_ptr);
+    if (__builtin_expect(out.acquired(), 1)) {
+        puts(out.get());
+        return;
+    }
+    // no hazard slot left, hold a reference instead
+    LogOutputPtr ref;
+    {
+        ScopedMutex lock(g_output_mutex);
+        ref = g_output;
+    }
+    puts(ref.get());
+}
+
+void Logging::puts(LogOutput *out)
+{
     const LogStream::Buffer& buf(stream().buffer());
-    LogOutputPtr out = g_output;
-    out->puts(buf.data(), buf.size());
+    if (__builtin_expect(_impl._record != out->binary(), 0)) {
+        // the output was swapped while this line was being built
+        convert_and_puts(out);
+    } else {
+        out->puts_level(_impl._level, buf.data(), buf.size());
+    }
     if (_impl._level == eFATAL){
             out->flush();
     }
 }
 
+void Logging::convert_and_puts(LogOutput *out)
+{
+    const LogStream::Buffer& buf(stream().buffer());
+    LogStream::Buffer converted;
+    if (_impl._record) {
+        LogRecordDecoder decoder;
+        decoder.decode(buf.data(), buf.size(), converted);
+    } else {
+        LogRecordHeader header = LogRecordHeader();
+        header.size = static_cast<uint32_t>(sizeof(header) + buf.size());
+        converted.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        converted.append(buf.data(), buf.size());
+    }
+    out->puts_level(_impl._level, converted.data(), converted.size());
+}
+
 void Logging::set_log_level(Logging::LogLevel level)
 {
-    g_log_level = level;
+    ScopedMutex lock(vmodule_mutex());
+    g_log_level.store(level, std::memory_order_relaxed);
+    update_thresholds();
+}
+
+bool Logging::set_vmodule(const std::string &spec)
+{
+    ModuleLevels levels;
+    if (!parse_vmodule(spec, levels)) {
+        return false;
+    }
+    ScopedMutex lock(vmodule_mutex());
+    vmodule_levels().swap(levels);
+    update_thresholds();
+    return true;
+}
+
+int Logging::crash_flush()
+{
+    // no HazardPtr, the output is not freed while the process dies
+    LogOutput *out = g_output_ptr.load(std::memory_order_acquire);
+    return out ? out->crash_flush() : -1;
 }
 
 void Logging::set_output(LogOutputPtr &out)
 {
-    g_output = out;
+    LogOutputPtr old;
+    {
+        ScopedMutex lock(g_output_mutex);
+        old = g_output;
+        g_output = out;
+        g_output_binary.store(out->binary(), std::memory_order_relaxed);
+        g_output_ptr.store(out.get(), std::memory_order_seq_cst);
+    }
+    // the last reference to old may be this one, drop it only
+    // once no thread is inside old->puts()
+    if (old != out) {
+        hazard_wait(old.get());
+    }
 }
 
 
@@ -8,6 +8,8 @@
     #pragma GCC diagnostic ignored "-Wtype-limits"
 #endif
 #include <memory>
+#include <functional>
+#include <atomic>
 
 namespace fermat {
 
@@ -16,11 +18,117 @@ public:
     explicit LogOutput(const std::string& logName) : _log_name(logName) {}
     virtual ~LogOutput(){}
     virtual void puts(const char* buf, size_t len) = 0; 
+    /*!
+    * What Logging calls for every line, level is a
+    * Logging::LogLevel. Outputs that filter by level override
+    * it, the default ignores the level.
+    */
+    virtual void puts_level(int level, const char* buf, size_t len)
+    {
+        (void)level;
+        puts(buf, len);
+    }
     virtual void flush() = 0;
+    /*!
+    * @return true if the output takes binary log records
+    * (see log_record.h) and formats them itself.
+    */
+    virtual bool binary() const { return false; }
+    /*!
+    * Called from the handler of a fatal signal, see
+    * LogCrashHandler: writes the lines the output still holds
+    * in memory straight to its file. Must be async-signal-safe:
+    * no locks, no allocation, raw write(2) only.
+    * @return the descriptor written to, -1 if none.
+    */
+    virtual int crash_flush() { return -1; }
 protected:
     std::string  _log_name;
 };
 typedef std::shared_ptr<LogOutput> LogOutputPtr;
+
+/*!
+* Static descriptor of one LOG_* call site, every macro
+* expansion owns one. Binary log records carry a pointer
+* to it instead of the formatted file, line and function.
+* The constructor runs once, on the first line the site logs:
+* it strips the directory from file, formats the
+* "LEVEL  [basename:line] func " part of the line prefix into
+* prefix, the JSON members "level" to "msg" of the same into
+* json_prefix, computes threshold and links the site into the
+* registry walked by Logging::for_each_site. Sites are never
+* destroyed.
+*/
+struct LogSite {
+    LogSite(const char* fileName, const char* funcName, int lineNum, int lvl);
+
+    const char*  file;
+    const char*  func;
+    int          line;
+    int          level;
+    const char*  basename;
+    size_t       basename_size;
+    const char*  prefix;
+    size_t       prefix_size;
+    const char*  json_prefix;
+    size_t       json_prefix_size;
+    //! lowest level the site logs at, from set_vmodule or the global level
+    std::atomic<int> threshold;
+    LogSite     *next;
+private:
+    LogSite(const LogSite&);
+    LogSite& operator=(const LogSite&);
+};
+
+/*!
+* Per call site state of the rate limited LOG_* macros. Zero
+* initialized statics, so the macros need no guard to set them up.
+* Each member function decides whether this call logs and, if it
+* does, stores in *suppressed how many calls were skipped since the
+* last line the site logged.
+*/
+struct LogLimit {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> suppressed;
+    std::atomic<int64_t>  next_time;
+
+    bool every_n(int64_t n, uint64_t *skipped)
+    {
+        uint64_t c = count.fetch_add(1, std::memory_order_relaxed);
+        if (n <= 1 || c % static_cast<uint64_t>(n) == 0) {
+            *skipped = (c == 0 || n <= 1) ? 0 : static_cast<uint64_t>(n) - 1;
+            return true;
+        }
+        return false;
+    }
+
+    bool first_n(int64_t n, uint64_t *skipped)
+    {
+        *skipped = 0;
+        // stops touching the counter once the site is done
+        if (count.load(std::memory_order_relaxed) >= static_cast<uint64_t>(n)) {
+            return false;
+        }
+        return count.fetch_add(1, std::memory_order_relaxed) < static_cast<uint64_t>(n);
+    }
+
+    //! at most one line every ms milliseconds of CLOCK_MONOTONIC_COARSE
+    bool every_t(int64_t ms, uint64_t *skipped);
+
+    //! each call logs with probability p
+    bool sampled(double p, uint64_t *skipped);
+};
+
+/*!
+* What the rate limited macros pass from the site check to Logging.
+*/
+struct LogGate {
+    const LogSite *site;
+    uint64_t       suppressed;
+
+    explicit operator bool() const { return site != NULL; }
+};
+
 class Logging {
 public:
     enum LogLevel{
@@ -57,46 +165,173 @@ public:
         _size = static_cast<int>(strlen(_data));
         }
 
+        SourceFile(const char* data, size_t size)
+        : _data(data),
+          _size(size)
+        {
+        }
+
         const char* _data;
         size_t      _size;
     };
     
+    /*!
+    * Clock read for every line. eClockCoarse reads
+    * CLOCK_REALTIME_COARSE, which is cheaper but only as precise
+    * as the kernel tick, for services that do not need
+    * microsecond timestamps.
+    */
+    enum ClockSource {
+        eClockRealtime,
+        eClockCoarse
+    };
+
+    /*!
+    * Layout of the lines. eFormatJson writes one JSON object per
+    * line: {"time":"...","tid":N,"level":"INFO","file":"f.cc",
+    * "line":N,"func":"f","msg":"text",<kv() fields>}. Lines
+    * sent to a binary output are records and keep the text
+    * layout when decoded.
+    */
+    enum LogFormat {
+        eFormatText,
+        eFormatJson
+    };
+
     Logging(SourceFile file, int line);
     Logging(SourceFile file, int line, LogLevel level);
     Logging(SourceFile file, int line, LogLevel level, const char* func);
     Logging(SourceFile file, int line, bool toAbort);
+    explicit Logging(const LogSite *site);
+    /*!
+    * Starts the line with "(N suppressed) " when N > 0.
+    */
+    Logging(const LogSite *site, uint64_t suppressed);
     ~Logging();
     
     LogStream& stream() { return _impl._stream; }
 
     static LogLevel log_level();
+    /*!
+    * Sets the global level, sites of modules matched by
+    * set_vmodule keep their own level.
+    */
     static void set_log_level(LogLevel level);
 
+    /*!
+    * Sets per-module levels from a comma separated list of
+    * module=level, e.g. "log_async=DEBUG,net_*=TRACE". A module is
+    * a source file name without directory and extension and may
+    * contain the wildcards * and ?. The level is a name (TRACE ...
+    * FATAL) or its number. The first matching entry wins, modules
+    * matching none log at the global level. The list replaces the
+    * previous one and applies to sites that already logged.
+    * The FERMAT_LOG_VMODULE environment variable sets the initial list.
+    * @return false and change nothing if spec does not parse.
+    */
+    static bool set_vmodule(const std::string &spec);
+
+    /*!
+    * Replaces the output, safe while other threads log. Returns
+    * once no thread writes to the previous output any more, so
+    * the caller may stop it right after.
+    */
     static void set_output(LogOutputPtr &ptr);
+
+    /*!
+    * Calls crash_flush() of the current output, for the fatal
+    * signal handler. Async-signal-safe.
+    */
+    static int crash_flush();
+
+    /*!
+    * Calls fn for every LogSite that has logged at least once.
+    * Safe to call while other threads log, a site constructed
+    * during the walk may or may not be visited.
+    */
+    static void for_each_site(const std::function<void(LogSite*)> &fn);
+
+    /*!
+    * Sets the layout of the lines built from now on, eFormatText
+    * by default; FERMAT_LOG_FORMAT=json sets the initial one.
+    */
+    static void set_format(LogFormat format);
+    static LogFormat format();
+
+    static void set_clock_source(ClockSource source);
+    /*!
+    * @return the current time from the selected clock source.
+    */
+    static Timestamp now();
+
+    /*!
+    * Writes the line prefix, "date time.usZ tid LEVEL [file:line] ",
+    * shared by the text path and the binary record decoder.
+    */
+    static void format_prefix(LogStream &stream, int64_t microSeconds,
+                              const char* tid, size_t tidLen,
+                              LogLevel level, const SourceFile &file,
+                              int line, int savedErrno);
+    /*!
+    * Writes the line prefix of a LogSite, function name included,
+    * from the bytes the site precomputed.
+    */
+    static void format_prefix(LogStream &stream, int64_t microSeconds,
+                              const char* tid, size_t tidLen,
+                              const LogSite *site, int savedErrno);
+    /*!
+    * Writes the JSON line prefix up to the open "msg" string,
+    * for a line without a site.
+    */
+    static void format_json_prefix(LogStream &stream, int64_t microSeconds,
+                                   int tid, LogLevel level,
+                                   const SourceFile &file, int line,
+                                   int savedErrno);
+    /*!
+    * Writes the JSON line prefix of a LogSite up to the open
+    * "msg" string.
+    */
+    static void format_json_prefix(LogStream &stream, int64_t microSeconds,
+                                   int tid, const LogSite *site, int savedErrno);
+
+    /*!
+    * Writes a line an output makes itself, such as its "Dropped"
+    * or stats lines, to buf: the time as in the line prefix, a
+    * blank, then fmt formatted as by snprintf.
+    * @return the length written, at most size - 1.
+    */
+    static size_t format_note(char* buf, size_t size, int64_t microSeconds,
+                              const char* fmt, ...)
+        __attribute__((format(printf, 4, 5)));
 private:
     class Impl {
     public:
         typedef Logging::LogLevel LogLevel;
         Impl(LogLevel level, int old_errno, const SourceFile& file, int line);
-        void format_time();
+        Impl(const LogSite *site, int old_errno);
         void finish();
 
-        Timestamp    _time;
-        LogStream    _stream;
-        LogLevel     _level;
-        int          _line;
-        SourceFile   _basename;
+        Timestamp      _time;
+        LogStream      _stream;
+        LogLevel       _level;
+        int            _line;
+        SourceFile     _basename;
+        const LogSite *_site;
+        bool           _record;
     };
 
+    void puts(LogOutput *out);
+    void convert_and_puts(LogOutput *out);
+
     Impl       _impl;
 
 };
 
-extern Logging::LogLevel g_log_level;
+extern std::atomic<int> g_log_level;
 
 inline Logging::LogLevel Logging::log_level()
 {
-  return g_log_level;
+  return static_cast<LogLevel>(g_log_level.load(std::memory_order_relaxed));
 }
 
 const char* strerror_tl(int savedErrno);
@@ -121,16 +356,76 @@ T* CheckNotNull(Logging::SourceFile file, int line, const char *names, T* ptr)
 
 } //namespace fermat
 
-#define LOG_TRACE if(fermat::Logging::eTRACE >= fermat::Logging::log_level()) \
-    fermat::Logging(__FILE__, __LINE__, fermat::Logging::eTRACE, __func__).stream()
-#define LOG_DEBUG if(fermat::Logging::eDEBUG >= fermat::Logging::log_level()) \
-    fermat::Logging(__FILE__, __LINE__, fermat::Logging::eDEBUG, __func__).stream()
-#define LOG_INFO if(fermat::Logging::eINFO >= fermat::Logging::log_level()) \
-    fermat::Logging(__FILE__, __LINE__, fermat::Logging::eINFO,__func__).stream()
-#define LOG_WARN if(fermat::Logging::eWARN >= fermat::Logging::log_level()) \
-    fermat::Logging(__FILE__, __LINE__, fermat::Logging::e WARN,__func__).stream()
-#define LOG_ERROR fermat::Logging(__FILE__, __LINE__, fermat::Logging::eERROR, __func__).stream()
-#define LOG_FATAL fermat::Logging(__FILE__, __LINE__, fermat::Logging::eFATAL, __func__).stream()
+// LOG_* sites below this level compile to nothing, FATAL is never
+// stripped. 0 keeps every level, 1 strips TRACE, 2 TRACE and DEBUG...
+#ifndef FERMAT_MIN_LOG_LEVEL
+#define FERMAT_MIN_LOG_LEVEL 0
+#endif
+
+// a pointer to the static LogSite of the expanding call site
+#define FERMAT_LOG_SITE(level) \
+    ([](const char* fermat_func) -> const ::fermat::LogSite* { \
+        static ::fermat::LogSite fermat_site(__FILE__, fermat_func, __LINE__, level); \
+        return &fermat_site; }(__func__))
+
+// the LogSite of the expanding call site if it logs at level, else
+// NULL. Once the site exists this is one relaxed load of its threshold.
+#define FERMAT_LOG_SITE_ON(level) \
+    ([](const char* fermat_func) -> const ::fermat::LogSite* { \
+        if (level < FERMAT_MIN_LOG_LEVEL) { \
+            return NULL; \
+        } \
+        static ::fermat::LogSite fermat_site(__FILE__, fermat_func, __LINE__, level); \
+        return level >= fermat_site.threshold.load(std::memory_order_relaxed) ? \
+            &fermat_site : NULL; }(__func__))
+
+#define LOG_TRACE if(const ::fermat::LogSite* fermat_log_site = \
+                     FERMAT_LOG_SITE_ON(fermat::Logging::eTRACE)) \
+    fermat::Logging(fermat_log_site).stream()
+#define LOG_DEBUG if(const ::fermat::LogSite* fermat_log_site = \
+                     FERMAT_LOG_SITE_ON(fermat::Logging::eDEBUG)) \
+    fermat::Logging(fermat_log_site).stream()
+#define LOG_INFO if(const ::fermat::LogSite* fermat_log_site = \
+                    FERMAT_LOG_SITE_ON(fermat::Logging::eINFO)) \
+    fermat::Logging(fermat_log_site).stream()
+#define LOG_WARN if(const ::fermat::LogSite* fermat_log_site = \
+                    FERMAT_LOG_SITE_ON(fermat::Logging::eWARN)) \
+    fermat::Logging(fermat_log_site).stream()
+#if FERMAT_MIN_LOG_LEVEL > 4
+#define LOG_ERROR if(false) \
+    fermat::Logging(FERMAT_LOG_SITE(fermat::Logging::eERROR)).stream()
+#else
+#define LOG_ERROR fermat::Logging(FERMAT_LOG_SITE(fermat::Logging::eERROR)).stream()
+#endif
+#define LOG_FATAL fermat::Logging(FERMAT_LOG_SITE(fermat::Logging::eFATAL)).stream()
+
+// the LogGate of the expanding call site, open if it logs at level
+// and fermat_limit.method(arg) lets this call through
+#define FERMAT_LOG_LIMITED(level, method, type, arg) \
+    if(const ::fermat::LogGate fermat_log_gate = \
+       ([](const char* fermat_func, type fermat_arg) -> ::fermat::LogGate { \
+            ::fermat::LogGate gate = {NULL, 0}; \
+            if (level < FERMAT_MIN_LOG_LEVEL) { \
+                return gate; \
+            } \
+            static ::fermat::LogSite fermat_site(__FILE__, fermat_func, __LINE__, level); \
+            static ::fermat::LogLimit fermat_limit; \
+            if (level >= fermat_site.threshold.load(std::memory_order_relaxed) && \
+                fermat_limit.method(fermat_arg, &gate.suppressed)) { \
+                gate.site = &fermat_site; \
+            } \
+            return gate; }(__func__, (arg)))) \
+    fermat::Logging(fermat_log_gate.site, fermat_log_gate.suppressed).stream()
 
+// severity is TRACE, DEBUG, INFO, WARN, ERROR or FATAL:
+// LOG_EVERY_N(WARN, 1000) << "queue full";
+#define LOG_EVERY_N(severity, n) \
+    FERMAT_LOG_LIMITED(fermat::Logging::e##severity, every_n, int64_t, n)
+#define LOG_FIRST_N(severity, n) \
+    FERMAT_LOG_LIMITED(fermat::Logging::e##severity, first_n, int64_t, n)
+#define LOG_EVERY_T(severity, ms) \
+    FERMAT_LOG_LIMITED(fermat::Logging::e##severity, every_t, int64_t, ms)
+#define LOG_SAMPLED(severity, p) \
+    FERMAT_LOG_LIMITED(fermat::Logging::e##severity, sampled, double, p)
 
 #endif
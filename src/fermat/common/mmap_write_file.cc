@@ -0,0 +1,212 @@
+#include <fermat/common/mmap_write_file.h>
+#include <fermat/common/sequence_write_file.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fermat {
+
+MmapWriteFile::MmapWriteFile(const char* fileName, size_t chunkSize)
+    :_file_name(fileName),
+     _chunk_size(chunkSize),
+     _fd(-1),
+     _mapped(true),
+     _map(NULL),
+     _map_offset(0),
+     _map_size(0),
+     _offset(0),
+     _write_size(0),
+     _dir_synced(false)
+{
+    open();
+}
+
+MmapWriteFile::MmapWriteFile(const std::string& fileName, size_t chunkSize)
+    :_file_name(fileName),
+     _chunk_size(chunkSize),
+     _fd(-1),
+     _mapped(true),
+     _map(NULL),
+     _map_offset(0),
+     _map_size(0),
+     _offset(0),
+     _write_size(0),
+     _dir_synced(false)
+{
+    open();
+}
+
+MmapWriteFile::~MmapWriteFile()
+{
+    if (_fd < 0) {
+        return;
+    }
+    unmap();
+    if (_mapped && ::ftruncate(_fd, static_cast<off_t>(_offset)) != 0) {
+        fprintf(stderr, "MmapWriteFile: ftruncate %s failed %d\n", _file_name.c_str(), errno);
+    }
+    ::close(_fd);
+    _fd = -1;
+}
+
+void MmapWriteFile::open()
+{
+    // the mapping needs read access, O_APPEND only affects write(2)
+    _fd = ::open(_file_name.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    assert(_fd >= 0);
+    struct stat st;
+    if (_fd >= 0 && ::fstat(_fd, &st) == 0) {
+        _offset = static_cast<size_t>(st.st_size);
+    }
+}
+
+void MmapWriteFile::unmap()
+{
+    if (_map) {
+        ::munmap(_map, _map_size);
+        _map = NULL;
+        _map_size = 0;
+    }
+}
+
+// maps the chunk starting at the page of _offset
+bool MmapWriteFile::advance()
+{
+    unmap();
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t chunk = (_chunk_size + page - 1) / page * page;
+    size_t start = _offset / page * page;
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (::fallocate(_fd, 0, static_cast<off_t>(start), static_cast<off_t>(chunk)) != 0) {
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            fprintf(stderr, "MmapWriteFile: fallocate %s failed %d\n", _file_name.c_str(), errno);
+            return false;
+        }
+        // the file system cannot reserve space, mapping past
+        // the end of the file would fault
+        return fall_back();
+    }
+#else
+    // no fallocate(2) to reserve the chunk with
+    return fall_back();
+#endif
+    void *p = ::mmap(NULL, chunk, PROT_READ | PROT_WRITE, MAP_SHARED, _fd,
+                     static_cast<off_t>(start));
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "MmapWriteFile: mmap %s failed %d\n", _file_name.c_str(), errno);
+        return fall_back();
+    }
+    _map = static_cast<char*>(p);
+    _map_offset = start;
+    _map_size = chunk;
+    return true;
+}
+
+// drops the reserved tail and goes on with write(2)
+bool MmapWriteFile::fall_back()
+{
+    if (::ftruncate(_fd, static_cast<off_t>(_offset)) != 0) {
+        return false;
+    }
+    _mapped = false;
+    return true;
+}
+
+bool MmapWriteFile::write_fully(const char* content, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(_fd, content, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "MmapWriteFile::append() failed %d\n", errno);
+            return false;
+        }
+        content += n;
+        len -= static_cast<size_t>(n);
+        _offset += static_cast<size_t>(n);
+        _write_size += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void MmapWriteFile::flush()
+{
+}
+
+bool MmapWriteFile::append(const char* content, const size_t len)
+{
+    if (_fd < 0) {
+        return false;
+    }
+    size_t remain = len;
+    while (remain > 0) {
+        if (!_mapped) {
+            return write_fully(content, remain);
+        }
+        size_t room = _map ? _map_offset + _map_size - _offset : 0;
+        if (room == 0) {
+            if (!advance()) {
+                return false;
+            }
+            continue;
+        }
+        size_t n = remain < room ? remain : room;
+        memcpy(_map + (_offset - _map_offset), content, n);
+        content += n;
+        remain -= n;
+        _offset += n;
+        _write_size += n;
+    }
+    return true;
+}
+
+bool MmapWriteFile::append(const struct iovec *iov, int cnt)
+{
+    for (int i = 0; i < cnt; ++i) {
+        if (!append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t MmapWriteFile::write_size()
+{
+    return _write_size;
+}
+
+bool MmapWriteFile::sync()
+{
+    if (_fd < 0) {
+        return false;
+    }
+    if (::fdatasync(_fd) != 0) {
+        fprintf(stderr, "MmapWriteFile::sync() failed %d\n", errno);
+        return false;
+    }
+    if (!_dir_synced) {
+        _dir_synced = SequenceWriteFile::sync_directory(_file_name);
+    }
+    return true;
+}
+
+bool MmapWriteFile::write_behind()
+{
+    if (_fd < 0) {
+        return false;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    return ::sync_file_range(_fd, 0, 0, SYNC_FILE_RANGE_WRITE) == 0;
+#else
+    return true;
+#endif
+}
+
+}
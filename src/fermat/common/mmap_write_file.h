@@ -0,0 +1,89 @@
+#ifndef FERMAT_COMMON_MMAP_WRITE_FILE_H_
+#define FERMAT_COMMON_MMAP_WRITE_FILE_H_
+#include <cstdint>
+#include <string>
+#include <cstddef>
+#include <sys/uio.h>
+
+namespace fermat {
+
+/*!
+* Append-only file written through a shared mapping, with the
+* interface of SequenceWriteFile so LogFile can take either.
+* Space is reserved with fallocate(2) one chunk at a time and
+* the chunk is mapped; appends are a memcpy, and when a chunk is
+* full the window moves forward to the next one. The destructor
+* truncates the file to the bytes written. A process that dies
+* first leaves the file NUL padded up to the end of the chunk.
+* If the file system cannot fallocate, or the platform has no
+* fallocate(2), appends go through write(2) instead.
+*
+* Only a LogFile<MUTEX, MmapWriteFile> the caller owns writes
+* through it: LogAsync, LogMultiAsync and LogShardedAsync always
+* write with LogFile<NullMutex>, the SequenceWriteFile default.
+*/
+class MmapWriteFile {
+public:
+    static const size_t kDefaultChunkSize = 16 * 1024 * 1024;
+
+    explicit MmapWriteFile(const char* fileName, size_t chunkSize = kDefaultChunkSize);
+    explicit MmapWriteFile(const std::string& fileName, size_t chunkSize = kDefaultChunkSize);
+    ~MmapWriteFile();
+
+    /*!
+    * Nothing to push, a memcpy into the mapping is already in
+    * the page cache.
+    */
+    void flush();
+
+    bool append(const char* content, const size_t len);
+
+    bool append(const struct iovec *iov, int cnt);
+
+    size_t write_size();
+
+    /*!
+    * Waits with fdatasync(2) until the data is on the disk, the
+    * mapped pages are in the page cache it writes. The first
+    * call also syncs the directory.
+    */
+    bool sync();
+
+    /*!
+    * Starts writeback of the file with sync_file_range(2),
+    * without waiting for it; nothing where it is missing.
+    */
+    bool write_behind();
+
+    /*!
+    * @return the file descriptor, -1 if the file did not open.
+    * It is in append mode: lines written to it land after the
+    * reserved chunk, not after the mapped data.
+    */
+    int fd() const { return _fd; }
+
+    /*!
+    * @return false once appends fell back to write(2).
+    */
+    bool mapped() const { return _mapped; }
+private:
+    void open();
+    bool advance();
+    bool fall_back();
+    bool write_fully(const char* content, size_t len);
+    void unmap();
+private:
+    std::string  _file_name;
+    const size_t _chunk_size;
+    int          _fd;
+    bool         _mapped;
+    char        *_map;
+    size_t       _map_offset;  //!< file offset of _map
+    size_t       _map_size;
+    size_t       _offset;      //!< end of the data in the file
+    size_t       _write_size;
+    bool         _dir_synced;
+};
+
+}
+#endif
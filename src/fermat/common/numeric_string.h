@@ -89,7 +89,7 @@ bool str_to_int(const char* pStr, I& result, short base, char thSep = ',')
 		switch (*pStr) {
 			case '0': 
 				if (state < STATE_SIGNIFICANT_DIGITS) break;
-
+				// fall through
 			case '1': 
 			case '2': 
 			case '3': 
@@ -1,11 +1,18 @@
 #include <fermat/common/sequence_write_file.h>
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
 namespace fermat {
 
 SequenceWriteFile::SequenceWriteFile(const char* fileName) 
     :_file_name(fileName),
      _fp(::fopen(fileName, "ae")),
-     _write_size(0)
+     _write_size(0),
+     _dir_synced(false),
+     _iov()
 {
     assert(_fp);
 	::setbuffer(_fp, _buffer, sizeof _buffer);
@@ -14,7 +21,9 @@ SequenceWriteFile::SequenceWriteFile(const char* fileName)
 SequenceWriteFile::SequenceWriteFile(const std::string& fileName)
     :_file_name(fileName),
      _fp(::fopen(_file_name.c_str(), "ae")),
-     _write_size(0)
+     _write_size(0),
+     _dir_synced(false),
+     _iov()
 {
     assert(_fp);
 	::setbuffer(_fp, _buffer, sizeof _buffer);
@@ -55,11 +64,92 @@ bool SequenceWriteFile::append(const char* content, const size_t len)
 	return true;    
 }
     
+bool SequenceWriteFile::append(const struct iovec *iov, int cnt)
+{
+    if (cnt <= 0) {
+        return true;
+    }
+    ::fflush(_fp);
+    _iov.assign(iov, iov + cnt);
+    int fd = ::fileno(_fp);
+    size_t idx = 0;
+    while (idx < _iov.size()) {
+        int batch = static_cast<int>(std::min(_iov.size() - idx, static_cast<size_t>(IOV_MAX)));
+        ssize_t n = ::writev(fd, &_iov[idx], batch);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr,  "SequenceWriteFile::append() writev failed %d\n", errno);
+            return false;
+        }
+        _write_size += n;
+        // skip what was written, trim a partially written buffer
+        size_t done = static_cast<size_t>(n);
+        while (idx < _iov.size() && done >= _iov[idx].iov_len) {
+            done -= _iov[idx].iov_len;
+            ++idx;
+        }
+        if (done > 0) {
+            _iov[idx].iov_base = static_cast<char*>(_iov[idx].iov_base) + done;
+            _iov[idx].iov_len -= done;
+        }
+    }
+    return true;
+}
+
 size_t SequenceWriteFile::write_size()
 {
     return _write_size;
 }
 
+bool SequenceWriteFile::sync()
+{
+    if (!_fp || ::fflush(_fp) != 0) {
+        return false;
+    }
+#if !(defined(__APPLE__) && defined(__MACH__))
+    int rc = ::fdatasync(::fileno(_fp));
+#else
+    int rc = ::fsync(::fileno(_fp));
+#endif
+    if (rc != 0) {
+        fprintf(stderr,  "SequenceWriteFile::sync() failed %d\n", errno);
+        return false;
+    }
+    if (!_dir_synced) {
+        _dir_synced = sync_directory(_file_name);
+    }
+    return true;
+}
+
+bool SequenceWriteFile::write_behind()
+{
+    if (!_fp || ::fflush(_fp) != 0) {
+        return false;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    // 0, 0 is the whole file; pages already under writeback are skipped
+    return ::sync_file_range(::fileno(_fp), 0, 0, SYNC_FILE_RANGE_WRITE) == 0;
+#else
+    return true;
+#endif
+}
+
+bool SequenceWriteFile::sync_directory(const std::string &fileName)
+{
+    size_t slash = fileName.rfind('/');
+    std::string dir = slash == std::string::npos ? std::string(".") :
+                      slash == 0 ? std::string("/") : fileName.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
 size_t SequenceWriteFile::unlock_write(const char* content, const size_t len)
 {
 #if !(defined(__APPLE__) && defined(__MACH__))
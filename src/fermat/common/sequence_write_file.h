@@ -5,6 +5,8 @@
 #include <cstdio>
 #include <cstddef>
 #include <cstdlib>
+#include <vector>
+#include <sys/uio.h>
 
 namespace fermat {
 
@@ -19,14 +21,46 @@ public:
     void flush();
     
     bool append(const char* content, const size_t len);
+
+    /*!
+    * Writes cnt buffers with writev(2), bypassing the stdio
+    * buffer. Anything pending in the stdio buffer is flushed
+    * first so the file keeps the call order.
+    */
+    bool append(const struct iovec *iov, int cnt);
     
     size_t write_size();
+
+    /*!
+    * Flushes the stdio buffer and waits with fdatasync(2) until
+    * the data is on the disk. The first call also syncs the
+    * directory, so the file itself survives a power failure.
+    */
+    bool sync();
+
+    /*!
+    * Flushes the stdio buffer and starts writeback of the file
+    * with sync_file_range(2), without waiting for it.
+    */
+    bool write_behind();
+
+    /*!
+    * fsync(2)s the directory fileName is in.
+    */
+    static bool sync_directory(const std::string &fileName);
+
+    /*!
+    * @return the file descriptor, -1 if the file did not open.
+    */
+    int fd() const { return _fp ? ::fileno(_fp) : -1; }
 private:
     size_t unlock_write(const char* content, const size_t len);
 private:
     std::string  _file_name;
     FILE        *_fp;
     size_t       _write_size;
+    bool         _dir_synced;
+    std::vector<struct iovec> _iov;
     char         _buffer[kTempBuffSize];
 
 };
@@ -0,0 +1,268 @@
+#ifndef FERMAT_COMMON_SPSC_RING_H_
+#define FERMAT_COMMON_SPSC_RING_H_
+#include <fermat/common/basic_buffer.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace fermat {
+
+/*!
+* A bounded single-producer/single-consumer ring of byte records.
+*
+* Every record is framed by a 4 byte length so the consumer always
+* sees whole records, even when a record wraps around the end of the
+* ring. Records are always copied into the ring, up to max_record()
+* bytes, so the ring never allocates after it is made.
+*
+* push() is only called by the owning producer thread and pop_to()
+* only by the consumer thread; neither takes a lock.
+*/
+class SpscRing {
+public:
+    /*!
+    * Creates a ring with at least capacity bytes, rounded up
+    * to the next power of two.
+    */
+    explicit SpscRing(size_t capacity);
+    ~SpscRing();
+
+    /*!
+    * Appends one record. All or nothing.
+    * @return false if the ring has not enough free space, always
+    * for a record larger than max_record().
+    */
+    bool push(const char* data, size_t len);
+
+    /*!
+    * Moves every readable record into out, in push order.
+    * @return the number of records moved.
+    */
+    size_t pop_to(BasicBuffer<char> &out);
+
+    /*!
+    * Consumer side: calls fn(data, len) for every readable record,
+    * in push order and in place, a record that wraps around the
+    * end in two calls. The records keep their space until
+    * release(), so the pointers stay valid until then.
+    * @return the number of records.
+    */
+    template <typename F>
+    size_t read(F fn);
+
+    /*!
+    * Consumer side: frees the records of the last read().
+    */
+    void release() { _tail.store(_read_end, std::memory_order_release); }
+
+    /*!
+    * Calls fn(data, len) for every readable record without
+    * consuming it. Takes no lock and allocates nothing, for a
+    * crash handler; records the consumer pops meanwhile may be
+    * torn.
+    */
+    template <typename F>
+    void peek(F fn) const;
+
+    /*!
+    * Producer side: true at most once per half ring of pushed
+    * bytes, when more than half of the ring is in use. Used to
+    * wake the consumer before the producer runs out of space.
+    */
+    bool should_wakeup();
+
+    bool empty() const
+    {
+        return _head.load(std::memory_order_acquire) ==
+            _tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return _mask + 1; }
+
+    /*!
+    * @return the largest record that fits in the empty ring.
+    */
+    size_t max_record() const { return _mask + 1 - kFrameSize; }
+
+    /*!
+    * @return the bytes in use, frames included; a snapshot when
+    * called from neither the producer nor the consumer.
+    */
+    size_t size() const
+    {
+        return _head.load(std::memory_order_acquire) -
+            _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+
+    static const size_t   kFrameSize = sizeof(uint32_t);
+
+    void copy_in(size_t pos, const void *src, size_t len);
+    void copy_out(size_t pos, void *dst, size_t len) const;
+private:
+    char                *_data;
+    size_t               _mask;
+    char                 _pad0[64];
+    // producer side
+    std::atomic<size_t>  _head;
+    size_t               _tail_cache;
+    size_t               _wakeup_mark;
+    char                 _pad1[64];
+    // consumer side
+    std::atomic<size_t>  _tail;
+    size_t               _read_end;   //!< head seen by read()
+    char                 _pad2[64];
+};
+
+inline SpscRing::SpscRing(size_t capacity)
+    : _data(NULL),
+      _mask(0),
+      _head(0),
+      _tail_cache(0),
+      _wakeup_mark(0),
+      _tail(0),
+      _read_end(0)
+{
+    size_t cap = 1024;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    _data = new char[cap];
+    _mask = cap - 1;
+}
+
+inline SpscRing::~SpscRing()
+{
+    delete [] _data;
+}
+
+inline void SpscRing::copy_in(size_t pos, const void *src, size_t len)
+{
+    size_t off = pos & _mask;
+    size_t first = _mask + 1 - off;
+    if (first >= len) {
+        memcpy(_data + off, src, len);
+    } else {
+        memcpy(_data + off, src, first);
+        memcpy(_data, static_cast<const char*>(src) + first, len - first);
+    }
+}
+
+inline void SpscRing::copy_out(size_t pos, void *dst, size_t len) const
+{
+    size_t off = pos & _mask;
+    size_t first = _mask + 1 - off;
+    if (first >= len) {
+        memcpy(dst, _data + off, len);
+    } else {
+        memcpy(dst, _data + off, first);
+        memcpy(static_cast<char*>(dst) + first, _data, len - first);
+    }
+}
+
+inline bool SpscRing::push(const char* data, size_t len)
+{
+    const size_t need = kFrameSize + len;
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head + need - _tail_cache > _mask + 1) {
+        _tail_cache = _tail.load(std::memory_order_acquire);
+        if (head + need - _tail_cache > _mask + 1) {
+            return false;
+        }
+    }
+    uint32_t frame = static_cast<uint32_t>(len);
+    copy_in(head, &frame, kFrameSize);
+    copy_in(head + kFrameSize, data, len);
+    _head.store(head + need, std::memory_order_release);
+    return true;
+}
+
+inline bool SpscRing::should_wakeup()
+{
+    const size_t half = (_mask + 1) / 2;
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _wakeup_mark < half || head - _tail_cache <= half) {
+        return false;
+    }
+    _tail_cache = _tail.load(std::memory_order_acquire);
+    if (head - _tail_cache <= half) {
+        return false;
+    }
+    _wakeup_mark = head;
+    return true;
+}
+
+template <typename F>
+inline void SpscRing::peek(F fn) const
+{
+    size_t tail = _tail.load(std::memory_order_acquire);
+    const size_t head = _head.load(std::memory_order_acquire);
+    while (tail != head) {
+        uint32_t frame;
+        copy_out(tail, &frame, kFrameSize);
+        tail += kFrameSize;
+        size_t off = tail & _mask;
+        size_t first = _mask + 1 - off;
+        if (first >= frame) {
+            fn(_data + off, frame);
+        } else {
+            fn(_data + off, first);
+            fn(_data, frame - first);
+        }
+        tail += frame;
+    }
+}
+
+template <typename F>
+inline size_t SpscRing::read(F fn)
+{
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    const size_t head = _head.load(std::memory_order_acquire);
+    size_t n = 0;
+    while (tail != head) {
+        uint32_t frame;
+        copy_out(tail, &frame, kFrameSize);
+        tail += kFrameSize;
+        size_t off = tail & _mask;
+        size_t first = _mask + 1 - off;
+        if (first >= frame) {
+            fn(_data + off, static_cast<size_t>(frame));
+        } else {
+            fn(_data + off, first);
+            fn(_data, frame - first);
+        }
+        tail += frame;
+        ++n;
+    }
+    _read_end = head;
+    return n;
+}
+
+inline size_t SpscRing::pop_to(BasicBuffer<char> &out)
+{
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    const size_t head = _head.load(std::memory_order_acquire);
+    if (tail == head) {
+        return 0;
+    }
+    size_t n = 0;
+    while (tail != head) {
+        uint32_t frame;
+        copy_out(tail, &frame, kFrameSize);
+        tail += kFrameSize;
+        size_t size = out.size();
+        out.resize(size + frame);
+        copy_out(tail, &out[size], frame);
+        tail += frame;
+        ++n;
+    }
+    _tail.store(tail, std::memory_order_release);
+    return n;
+}
+
+} //namespace fermat
+#endif
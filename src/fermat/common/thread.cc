@@ -23,6 +23,7 @@ namespace detail {
 			prio(Thread::PRIO_NORMAL),
 			policy(Thread::POLICY_DEFAULT),
 			event(Thread::RS_STOP),
+			launched(false),
 			stackSize(),
 			started(false),
 			joined(false)
@@ -37,6 +38,9 @@ namespace detail {
 		int                       osPrio;
 		int                       policy;
 		SharedState<int>          event;
+		// set once the thread runs, a short thread may be back
+		// to RS_STOP before start() looks at event
+		SharedState<bool>         launched;
 		std::size_t               stackSize;
 		bool                      started;
 		bool                      joined;
@@ -172,7 +176,7 @@ bool Thread::start(const RunnablePtr& target)
 		par.sched_priority = map_priority(_threadData->prio, SCHED_OTHER);
 		::pthread_setschedparam(_threadData->thread, SCHED_OTHER, &par);
 	}
-	_threadData->event.wait_for(RS_RUNING);
+	_threadData->launched.wait_for(true);
 	return true;
 
 }
@@ -309,6 +313,7 @@ void* Thread::thread_fuction(void *data)
 {
 	Thread* pthis = static_cast<Thread*>(data);
 	pthis->_threadData->event.set_to(RS_RUNING);
+	pthis->_threadData->launched.set_to(true);
 	detail::current_thread_ptr = pthis;
 	//pthis->_threadData->tid = pthread_self();
 	pthis->_threadData->tid = fermat::this_thread::thread_id();
@@ -0,0 +1,229 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_multi_async.h>
+#include <fermat/common/log_sharded_async.h>
+#include <fermat/common/log_file.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/mutex.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include "log_bench.h"
+
+// Runs every backend at every thread count and message size and
+// writes one JSON object per run and line, see run_once.
+
+// what Logging writes to before set_output
+class StdoutOutput : public fermat::LogOutput {
+public:
+    StdoutOutput() : fermat::LogOutput("stdout") {}
+    virtual void puts(const char* buf, size_t len)
+    {
+        size_t n = fwrite(buf, 1, len, stdout);
+        (void)n;
+    }
+    virtual void flush() { fflush(stdout); }
+};
+
+// LogFile written on the logging threads
+template <typename WRITER>
+class FileOutput : public fermat::LogOutput {
+public:
+    FileOutput(const std::string &base, size_t rollSize, const fermat::LogSyncPolicy &sync)
+        : fermat::LogOutput("file"), _file(base, rollSize)
+    {
+        _file.set_sync_policy(sync);
+    }
+    virtual void puts(const char* buf, size_t len) { _file.append(buf, len); }
+    virtual void flush() { _file.flush(); }
+private:
+    fermat::LogFile<fermat::Mutex, WRITER> _file;
+};
+
+static const size_t kRollSize = 1024 * 1024 * 1024;
+static size_t buffer_size = 0;
+static bool huge_pages = false;
+static size_t shards = 4;
+static fermat::LogSyncPolicy sync_policy;
+
+// creates the output, started if it has a backend thread
+static fermat::LogOutputPtr make_output(const std::string &backend, int threads)
+{
+    fermat::LogOutputPtr out;
+    if (backend == "stdout") {
+        out.reset(new StdoutOutput());
+    } else if (backend == "file") {
+        out.reset(new FileOutput<fermat::SequenceWriteFile>("./log/bench_file", kRollSize,
+                                                            sync_policy));
+    } else if (backend == "mmap") {
+        out.reset(new FileOutput<fermat::MmapWriteFile>("./log/bench_mmap", kRollSize,
+                                                        sync_policy));
+    } else if (backend == "async" || backend == "ring") {
+        fermat::LogAsync *la = new fermat::LogAsync("./log/bench_" + backend, kRollSize, 3,
+            backend == "ring" ? fermat::LogAsync::eThreadRing : fermat::LogAsync::eLockedQueue);
+        // nothing dropped, so every backend writes the same lines
+        la->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+        if (buffer_size > 0) {
+            la->set_buffer_size(buffer_size);
+        }
+        la->set_huge_pages(huge_pages);
+        la->set_sync_policy(sync_policy);
+        out.reset(la);
+        la->start();
+    } else if (backend == "multi") {
+        fermat::LogMultiAsync *lm = new fermat::LogMultiAsync("./log/bench_multi", kRollSize,
+                                                              static_cast<size_t>(threads));
+        if (buffer_size > 0) {
+            lm->set_buffer_size(buffer_size);
+        }
+        lm->set_huge_pages(huge_pages);
+        lm->set_sync_policy(sync_policy);
+        out.reset(lm);
+        lm->start();
+    } else if (backend == "sharded") {
+        fermat::LogShardedAsync *ls = new fermat::LogShardedAsync("./log/bench_sharded", kRollSize,
+                                                                  shards);
+        for (size_t i = 0; i < ls->shard_count(); ++i) {
+            ls->shard(i).set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+            if (buffer_size > 0) {
+                ls->shard(i).set_buffer_size(buffer_size);
+            }
+            ls->shard(i).set_huge_pages(huge_pages);
+        }
+        ls->set_sync_policy(sync_policy);
+        out.reset(ls);
+        ls->start();
+    }
+    return out;
+}
+
+static void stop_output(const std::string &backend, fermat::LogOutputPtr &out)
+{
+    if (backend == "async" || backend == "ring") {
+        static_cast<fermat::LogAsync*>(out.get())->stop();
+    } else if (backend == "multi") {
+        static_cast<fermat::LogMultiAsync*>(out.get())->stop();
+    } else if (backend == "sharded") {
+        static_cast<fermat::LogShardedAsync*>(out.get())->stop();
+    } else {
+        out->flush();
+    }
+}
+
+static std::string run_once(const std::string &backend, int threads, int msgSize, int lines)
+{
+    const std::string message(msgSize, 'x');
+    fermat::LogOutputPtr out = make_output(backend, threads);
+    fermat::Logging::set_output(out);
+
+    log_bench::Latencies latencies;
+    int64_t produced = log_bench::run_producers(threads, lines / threads,
+        [&message](int i) { LOG_INFO<<i<<' '<<message; }, &latencies);
+    int64_t begin = log_bench::now_ns();
+    stop_output(backend, out);
+    int64_t lag = log_bench::now_ns() - begin;
+    fermat::LogOutputPtr stdoutOut(new StdoutOutput());
+    fermat::Logging::set_output(stdoutOut);
+
+    int total = lines / threads * threads;
+    double seconds = static_cast<double>(produced + lag) / 1e9;
+    std::ostringstream os;
+    os<<"{\"backend\":\""<<backend<<"\""
+      <<",\"threads\":"<<threads
+      <<",\"msg_size\":"<<msgSize
+      <<",\"lines\":"<<total
+      <<",\"seconds\":"<<seconds
+      <<",\"lines_per_sec\":"<<static_cast<int64_t>(total / seconds)
+      <<",\"payload_mb_per_sec\":"<<static_cast<double>(total) * msgSize / seconds / (1024 * 1024)
+      <<",\"p50_ns\":"<<latencies.percentile(0.50)
+      <<",\"p99_ns\":"<<latencies.percentile(0.99)
+      <<",\"p999_ns\":"<<latencies.percentile(0.999)
+      <<",\"max_ns\":"<<latencies.max()
+      <<",\"backend_lag_us\":"<<lag / 1000
+      <<"}";
+    return os.str();
+}
+
+// none, interval:<ms>, bytes:<n> or behind:<n>
+static bool parse_sync(const std::string &spec, fermat::LogSyncPolicy *policy)
+{
+    size_t colon = spec.find(':');
+    std::string mode = spec.substr(0, colon);
+    int64_t value = colon == std::string::npos ? 0 : atoll(spec.c_str() + colon + 1);
+    if (mode == "none") {
+        *policy = fermat::LogSyncPolicy();
+    } else if (mode == "interval" && value > 0) {
+        *policy = fermat::LogSyncPolicy::every(fermat::Timespan(value * 1000));
+    } else if (mode == "bytes" && value > 0) {
+        *policy = fermat::LogSyncPolicy::every_bytes(static_cast<size_t>(value));
+    } else if (mode == "behind" && value >= 0) {
+        *policy = fermat::LogSyncPolicy::write_behind(static_cast<size_t>(value));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines per run", false, 1000000, fermat::range(1, 1000000000));
+    p.add<std::string>("backends", 'b', "comma separated: stdout,file,mmap,async,ring,multi,sharded",
+                       false, "stdout,file,async,ring,multi");
+    p.add<std::string>("threads", 'c', "comma separated thread counts", false, "1,4,16");
+    p.add<std::string>("sizes", 's', "comma separated message sizes", false, "16,128,1024");
+    p.add<std::string>("output", 'o', "file the JSON lines are appended to, - for stderr",
+                       false, "-");
+    p.add<int>("buffer", 'B', "async buffer size in KB, 0 for the default", false, 0,
+               fermat::range(0, 65536));
+    p.add("huge", 'H', "back the async buffers with huge pages");
+    p.add<std::string>("sync", 'y', "none, interval:<ms>, bytes:<n> or behind:<n>",
+                       false, "none");
+    p.add<int>("shards", 'S', "shards of the sharded backend", false, 4, fermat::range(1, 256));
+    p.parse_check(argc, argv);
+    buffer_size = static_cast<size_t>(p.get<int>("buffer")) * 1024;
+    huge_pages = p.exist("huge");
+    shards = static_cast<size_t>(p.get<int>("shards"));
+    if (!parse_sync(p.get<std::string>("sync"), &sync_policy)) {
+        std::cerr<<"bad --sync "<<p.get<std::string>("sync")<<std::endl;
+        return 1;
+    }
+    int lines = p.get<int>("number");
+    std::vector<std::string> backends = split(p.get<std::string>("backends"));
+    std::vector<std::string> threads = split(p.get<std::string>("threads"));
+    std::vector<std::string> sizes = split(p.get<std::string>("sizes"));
+    std::string output = p.get<std::string>("output");
+
+    std::ofstream file;
+    if (output != "-") {
+        file.open(output.c_str(), std::ios::app);
+    }
+    std::ostream &result = output == "-" ? std::cerr : file;
+    for (size_t b = 0; b < backends.size(); ++b) {
+        for (size_t t = 0; t < threads.size(); ++t) {
+            for (size_t s = 0; s < sizes.size(); ++s) {
+                int n = std::max(1, atoi(threads[t].c_str()));
+                int size = std::max(0, atoi(sizes[s].c_str()));
+                result<<run_once(backends[b], n, size, lines)<<std::endl;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+#ifndef FERMAT_TESTS_COMMON_LOG_BENCH_H_
+#define FERMAT_TESTS_COMMON_LOG_BENCH_H_
+#include <fermat/common/thread.h>
+#include <fermat/common/mutex.h>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The latency harness of log_bench and log_test: producer threads
+// log a fixed number of lines each and time every kSampleStep-th
+// call. Also the ./log helpers the log tests share to read back
+// and remove what they wrote.
+
+namespace log_bench {
+
+static const int kSampleStep = 16;
+
+inline int64_t now_ns()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*!
+* Per call latencies in nanoseconds, sorted once the producers
+* are joined.
+*/
+class Latencies {
+public:
+    void add(const std::vector<int64_t> &local)
+    {
+        fermat::ScopedMutex lock(_mutex);
+        _samples.insert(_samples.end(), local.begin(), local.end());
+    }
+
+    void sort() { std::sort(_samples.begin(), _samples.end()); }
+
+    /*!
+    * @return the p-th quantile, p in [0, 1], of the sorted
+    * samples, 0 if there are none.
+    */
+    int64_t percentile(double p) const
+    {
+        if (_samples.empty()) {
+            return 0;
+        }
+        return _samples[static_cast<size_t>(p * (_samples.size() - 1))];
+    }
+
+    int64_t max() const { return _samples.empty() ? 0 : _samples.back(); }
+    size_t size() const { return _samples.size(); }
+    void clear() { _samples.clear(); }
+private:
+    fermat::Mutex         _mutex;
+    std::vector<int64_t>  _samples;
+};
+
+template <typename LOG>
+void produce(const LOG &log, int count, Latencies *latencies)
+{
+    std::vector<int64_t> local;
+    local.reserve(count / kSampleStep + 1);
+    for (int i = 0; i < count; ++i) {
+        if (i % kSampleStep == 0) {
+            int64_t begin = now_ns();
+            log(i);
+            local.push_back(now_ns() - begin);
+        } else {
+            log(i);
+        }
+    }
+    latencies->add(local);
+}
+
+/*!
+* Runs threads producers calling log(i) for i in [0, count) each,
+* joins them and sorts the samples. LOG is a template argument so
+* the timed call is not behind a std::function.
+* @return the nanoseconds from the first start to the last join.
+*/
+template <typename LOG>
+int64_t run_producers(int threads, int count, const LOG &log, Latencies *latencies)
+{
+    std::vector<fermat::Thread*> ths;
+    int64_t start = now_ns();
+    for (int i = 0; i < threads; ++i) {
+        fermat::Thread *t = new fermat::Thread("log_bench");
+        t->start(std::bind(&produce<LOG>, std::cref(log), count, latencies));
+        ths.push_back(t);
+    }
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    int64_t elapsed = now_ns() - start;
+    latencies->sort();
+    return elapsed;
+}
+
+/*!
+* Creates ./log if it is missing.
+* @return false, with the reason on stderr, if it cannot.
+*/
+inline bool make_log_dir()
+{
+    if (::mkdir("./log", 0755) != 0 && errno != EEXIST) {
+        std::cerr<<"cannot create ./log: "<<strerror(errno)<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*!
+* @return the paths of the files of ./log whose name starts with
+* prefix, sorted, empty if ./log cannot be opened.
+*/
+inline std::vector<std::string> log_files(const std::string &prefix)
+{
+    std::vector<std::string> files;
+    DIR *d = ::opendir("./log");
+    if (!d) {
+        return files;
+    }
+    while (struct dirent *de = ::readdir(d)) {
+        std::string name(de->d_name);
+        if (name.compare(0, prefix.size(), prefix) == 0) {
+            files.push_back("./log/" + name);
+        }
+    }
+    ::closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+inline std::string read_file(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::ostringstream ss;
+    ss<<in.rdbuf();
+    return ss.str();
+}
+
+inline void remove_logs(const std::string &prefix)
+{
+    std::vector<std::string> files = log_files(prefix);
+    for (size_t i = 0; i < files.size(); ++i) {
+        ::unlink(files[i].c_str());
+    }
+}
+
+/*!
+* Reads back and removes the ./log files starting with prefix.
+* @return their contents, in name order.
+*/
+inline std::string take_files(const std::string &prefix, size_t *count = NULL)
+{
+    std::string data;
+    std::vector<std::string> files = log_files(prefix);
+    for (size_t i = 0; i < files.size(); ++i) {
+        data += read_file(files[i]);
+        ::unlink(files[i].c_str());
+    }
+    if (count) {
+        *count = files.size();
+    }
+    return data;
+}
+
+/*!
+* Calls fn(line) for every line of the ./log files starting with
+* prefix, then removes them.
+* @return the number of lines.
+*/
+template <typename F>
+size_t take_lines(const std::string &prefix, F fn)
+{
+    size_t n = 0;
+    std::vector<std::string> files = log_files(prefix);
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::ifstream in(files[i].c_str());
+        std::string line;
+        while (std::getline(in, line)) {
+            fn(line);
+            ++n;
+        }
+        ::unlink(files[i].c_str());
+    }
+    return n;
+}
+
+/*!
+* @return the number of lines of the ./log files starting with
+* prefix, which are removed.
+*/
+inline size_t take_lines(const std::string &prefix)
+{
+    return take_lines(prefix, [](const std::string &) {});
+}
+
+} //namespace log_bench
+#endif
@@ -0,0 +1,108 @@
+#include <fermat/common/log_buffer.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/logging.h>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "log_bench.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::cout<<what<<(ok ? " OK" : " FAILED")<<std::endl;
+    if (!ok) {
+        ++failures;
+    }
+}
+
+int main()
+{
+    check(fermat::LogBufferPool::buffer_size(100) == fermat::LogBufferPool::kMinBufferSize,
+          "buffer size clamped to the minimum");
+    check(fermat::LogBufferPool::buffer_size(65 * 1024) == 68 * 1024,
+          "buffer size rounded to pages");
+
+    {
+        fermat::LogBufferPool pool(64 * 1024, 8, true);
+        std::vector<fermat::LogBuffer*> out;
+        while (fermat::LogBuffer *b = pool.get()) {
+            out.push_back(b);
+        }
+        check(out.size() == 8 && pool.in_use() == 8, "pool hands out count buffers");
+        out[3]->append("abc", 3);
+        fermat::LogBuffer *last = out[3];
+        pool.put(last);
+        check(pool.get() == last && last->size() == 0, "put buffer comes back first, empty");
+        fermat::LogBuffer *big = pool.get_heap(1024 * 1024);
+        check(big->capacity() >= 1024 * 1024 && pool.in_use() == 9, "heap buffer");
+        big->append("heap", 4);
+        pool.put(big);
+        // retired, not freed: crash_flush() may still read it
+        check(pool.in_use() == 8 && memcmp(big->data(), "heap", 4) == 0,
+              "heap buffer kept until reclaim");
+        pool.reclaim();
+        for (size_t i = 0; i < out.size(); ++i) {
+            pool.put(out[i]);
+        }
+        check(pool.in_use() == 0, "all buffers back");
+        std::cout<<"huge pages: "<<(pool.huge_pages() ? "MAP_HUGETLB" : "madvise")<<std::endl;
+    }
+
+    {
+        fermat::LogBufferPool pool(4096, 4);
+        fermat::LogBufferList list;
+        fermat::LogBuffer *b[4];
+        for (int i = 0; i < 4; ++i) {
+            b[i] = pool.get();
+            list.push_back(b[i]);
+        }
+        size_t walked = 0;
+        for (fermat::LogBuffer *p = list.front(); p; p = fermat::LogBufferList::next(p)) {
+            walked += walked < 4 && p == b[walked] ? 1 : 100;
+        }
+        check(walked == 4 && list.size() == 4, "list walks in push order");
+        std::vector<fermat::LogBuffer*> taken;
+        list.take_all(taken);
+        check(list.empty() && !list.front() && taken.size() == 4 && taken[0] == b[0] &&
+              taken[3] == b[3], "take_all empties the list, oldest first");
+        // relinked in another order, stale links are not followed
+        list.push_back(b[2]);
+        list.push_back(b[0]);
+        check(fermat::LogBufferList::next(b[0]) == NULL && list.size() == 2 &&
+              list.front() == b[2] && fermat::LogBufferList::next(b[2]) == b[0],
+              "reused buffers relink");
+        list.take_all(taken);
+        for (int i = 0; i < 4; ++i) {
+            pool.put(b[i]);
+        }
+    }
+
+    // lines larger than a buffer, and many small ones, through LogAsync
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    log_bench::remove_logs("buffer_test.");
+    fermat::LogAsync *la = new fermat::LogAsync("./log/buffer_test", 1024 * 1024 * 1024);
+    fermat::LogOutputPtr out(la);
+    la->set_buffer_size(4096);
+    la->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    la->start();
+    fermat::Logging::set_output(out);
+    std::string big(20000, 'x');
+    for (int i = 0; i < 1000; ++i) {
+        LOG_INFO<<"small "<<i;
+        if (i % 100 == 0) {
+            LOG_INFO<<big;
+        }
+    }
+    la->stop();
+    size_t longest = 0;
+    size_t lines = log_bench::take_lines("buffer_test.", [&](const std::string &line) {
+        longest = std::max(longest, line.size());
+    });
+    check(lines == 1010 && longest > big.size(), "large lines through 4KB buffers");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_compressor.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/timestamp.h>
+#include <fermat/common/this_thread.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "log_bench.h"
+
+// Logs in rounds through LogAsync with the compressor as roll
+// listener and reports what it compressed. LogFile rolls at most
+// once a second, so the rounds are a second apart and each one
+// writes more than the roll size; the file still open at the end
+// is compressed on this thread.
+
+// the log files of base not compressed yet
+static std::vector<std::string> plain_files(const std::string &base)
+{
+    std::vector<std::string> files;
+    std::vector<std::string> all = log_bench::log_files(base);
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (all[i].size() > 4 && all[i].compare(all[i].size() - 4, 4, ".log") == 0) {
+            files.push_back(all[i]);
+        }
+    }
+    return files;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines to log", false, 400000, fermat::range(1, 100000000));
+    p.add<int>("rounds", 'R', "rounds, a second apart", false, 4, fermat::range(1, 1000));
+    p.add<int>("roll", 'r', "roll size in MB", false, 4, fermat::range(1, 1024));
+    p.add<int>("level", 'l', "zlib level [1, 9]", false, 1, fermat::range(1, 9));
+    p.add<int>("rate", 'm', "compressor MB/s, 0 for no limit", false, 0, fermat::range(0, 4096));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+    int rounds = p.get<int>("rounds");
+
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    if (!fermat::LogCompressor::available()) {
+        std::cout<<"built without zlib, nothing to measure"<<std::endl;
+        return 0;
+    }
+    fermat::LogCompressor compressor;
+    compressor.set_level(p.get<int>("level"));
+    compressor.set_rate_limit(static_cast<size_t>(p.get<int>("rate")) * 1024 * 1024);
+    compressor.start();
+
+    fermat::LogOutputPtr alogger(new fermat::LogAsync("./log/compress",
+        static_cast<size_t>(p.get<int>("roll")) * 1024 * 1024));
+    fermat::LogAsync *la = static_cast<fermat::LogAsync*>(alogger.get());
+    la->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    la->set_roll_listener(compressor.listener());
+    la->start();
+    fermat::Logging::set_output(alogger);
+
+    fermat::Timestamp start;
+    for (int r = 0; r < rounds; ++r) {
+        if (r > 0) {
+            fermat::this_thread::sleep_for(fermat::Timespan(1100 * 1000));
+        }
+        for (int i = r * lines / rounds; i < (r + 1) * lines / rounds; ++i) {
+            LOG_INFO<<"request "<<i<<" user "<<(i % 977)<<" latency_us "<<(i * 7 % 10000)
+                    <<" status "<<(i % 13 == 0 ? "error" : "ok");
+        }
+    }
+    la->stop();
+    compressor.stop();
+    uint64_t rolled = compressor.stats().files;
+    std::vector<std::string> left = plain_files("compress.");
+    for (size_t i = 0; i < left.size(); ++i) {
+        compressor.compress(left[i]);
+    }
+    fermat::Timestamp end;
+
+    fermat::LogCompressor::Stats st = compressor.stats();
+    double mb = static_cast<double>(st.in_bytes) / (1024 * 1024);
+    std::cout<<"files: "<<st.files
+             <<" rolled: "<<rolled
+             <<" failed: "<<st.failed
+             <<" in_mb: "<<mb
+             <<" ratio: "<<(st.out_bytes ? static_cast<double>(st.in_bytes) / st.out_bytes : 0)
+             <<" compress_mb_per_s: "<<(st.micro_seconds ? mb * 1000000 / st.micro_seconds : 0)
+             <<" total_micro_seconds: "<<(end - start)
+             <<std::endl;
+
+    // a file rolled after its compressor is gone stays as it is
+    bool outlived = false;
+    {
+        fermat::LogFile<fermat::NullMutex> file("./log/compress_outlive", 1024 * 1024);
+        {
+            fermat::LogCompressor gone;
+            file.set_roll_listener(gone.listener());
+        }
+        file.append("line\n", 5);
+        fermat::this_thread::sleep_for(fermat::Timespan(1100 * 1000));
+        outlived = file.roll();
+    }
+    std::vector<std::string> outlive = log_bench::log_files("compress_outlive.");
+    outlived = outlived && outlive.size() == 2;
+    for (size_t i = 0; i < outlive.size(); ++i) {
+        ::unlink(outlive[i].c_str());
+    }
+    std::cout<<"listener outlived the compressor: "<<(outlived ? "ok" : "FAILED")<<std::endl;
+
+    bool ok = outlived && st.failed == 0 && st.files > 0 && st.in_bytes > 0 &&
+              (rounds == 1 || rolled > 0);
+    if (!ok) {
+        std::cout<<"FAILED"<<std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_multi_async.h>
+#include <fermat/common/log_crash.h>
+#include <iostream>
+#include <string>
+#include <csignal>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "log_bench.h"
+
+static const int kLines = 200;
+
+// logs kLines lines the backend has not written yet, then dies
+static void child(const std::string &mode, int sig)
+{
+    fermat::LogCrashHandler::install();
+    fermat::LogOutputPtr out;
+    if (mode == "multi") {
+        fermat::LogMultiAsync *lm = new fermat::LogMultiAsync("./log/crash_" + mode,
+                                                              1024 * 1024 * 1024, 4, 1000);
+        out.reset(lm);
+        lm->start();
+    } else {
+        fermat::LogAsync *la = new fermat::LogAsync("./log/crash_" + mode, 1024 * 1024 * 1024, 1000,
+            mode == "ring" ? fermat::LogAsync::eThreadRing : fermat::LogAsync::eLockedQueue);
+        out.reset(la);
+        la->start();
+    }
+    fermat::Logging::set_output(out);
+    for (int i = 0; i < kLines; ++i) {
+        LOG_INFO<<"line before the crash "<<i;
+    }
+    if (sig == SIGSEGV) {
+        volatile int *p = NULL;
+        *p = 1;
+    }
+    ::abort();
+}
+
+static void scan(const std::string &prefix, int *lines, bool *backtrace)
+{
+    *lines = 0;
+    *backtrace = false;
+    log_bench::take_lines(prefix, [&](const std::string &line) {
+        if (line.find("line before the crash") != std::string::npos) {
+            ++*lines;
+        } else if (line.find("received by thread") != std::string::npos) {
+            *backtrace = true;
+        }
+    });
+}
+
+static bool run(const std::string &mode, int sig)
+{
+    std::string prefix = "crash_" + mode + ".";
+    int lines = 0;
+    bool backtrace = false;
+    scan(prefix, &lines, &backtrace);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        child(mode, sig);
+        ::_exit(0);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    scan(prefix, &lines, &backtrace);
+    bool ok = WIFSIGNALED(status) && WTERMSIG(status) == sig &&
+              lines == kLines && backtrace;
+    std::cout<<mode<<" "<<(sig == SIGSEGV ? "SIGSEGV" : "SIGABRT")
+             <<": lines "<<lines<<"/"<<kLines
+             <<" backtrace "<<(backtrace ? "yes" : "no")
+             <<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok;
+}
+
+int main()
+{
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    bool ok = run("locked", SIGSEGV);
+    ok = run("locked", SIGABRT) && ok;
+    ok = run("ring", SIGSEGV) && ok;
+    ok = run("multi", SIGABRT) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_dedup.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "log_bench.h"
+
+static std::string join(const std::vector<struct iovec> &iov)
+{
+    std::string out;
+    for (size_t i = 0; i < iov.size(); ++i) {
+        out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return out;
+}
+
+static size_t count(const std::string &text, const std::string &what)
+{
+    size_t n = 0;
+    for (size_t pos = text.find(what); pos != std::string::npos;
+         pos = text.find(what, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+static bool expect(const char* name, size_t got, size_t want)
+{
+    std::cout<<name<<": "<<got<<std::endl;
+    if (got != want) {
+        std::cout<<"unexpected, want "<<want<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+// lines as Logging writes them, time and thread id vary
+static bool check_filter()
+{
+    bool ok = true;
+    fermat::LogDedup dedup(fermat::Timespan(1000000));
+    std::string data;
+    for (int i = 0; i < 100; ++i) {
+        char line[512];
+        snprintf(line, sizeof line,
+                 "20261017 03:00:00.%06dZ %d ERROR [disk.cc:10] write disk full\n"
+                 "20261017 03:00:00.%06dZ 42 INFO  [main.cc:5] run step %d\n"
+                 "{\"time\":\"20261017 03:00:00.%06dZ\",\"tid\":%d,\"level\":\"WARN\",\"msg\":\"slow\"}\n",
+                 i, 100 + i % 3, i, i, i, 7 + i);
+        data += line;
+    }
+    data += "no prefix\nno prefix\n";
+    int64_t now = 1000000000;
+    std::vector<struct iovec> iov;
+    dedup.filter(data.data(), data.size(), now, iov);
+    std::string out = join(iov);
+    ok = expect("notes before the window ends", count(out, "Message repeated"), 0) && ok;
+    ok = expect("storm lines kept", count(out, "disk full\n"), 1) && ok;
+    ok = expect("json storm lines kept", count(out, "\"msg\":\"slow\"}"), 1) && ok;
+    ok = expect("distinct lines kept", count(out, "run step"), 100) && ok;
+    ok = expect("lines without prefix kept", count(out, "no prefix\n"), 2) && ok;
+    ok = expect("coalesced", dedup.dropped_lines(), 198) && ok;
+
+    iov.clear();
+    dedup.expire(now + 500000, iov);
+    ok = expect("notes inside the window", iov.size(), 0) && ok;
+    dedup.expire(now + 1000000, iov);
+    out = join(iov);
+    ok = expect("notes after the window",
+                count(out, "Message repeated 99 times in the last 1000 ms: ERROR [disk.cc:10] "
+                      "write disk full\n"), 1) && ok;
+    ok = expect("json notes after the window", count(out, "Message repeated 99 times"), 2) && ok;
+    dedup.clear_notes();
+    return ok;
+}
+
+// an ERROR storm with a little INFO traffic in between
+static bool check_async(int lines, int64_t window)
+{
+    log_bench::take_files("dedup_test.");
+    fermat::LogAsync *log = new fermat::LogAsync("./log/dedup_test", 1024 * 1024 * 1024);
+    log->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    log->set_dedup_window(fermat::Timespan(window));
+    fermat::LogOutputPtr out(log);
+    log->start();
+    fermat::Logging::set_output(out);
+    fermat::Clock begin;
+    for (int i = 0; i < lines; ++i) {
+        LOG_ERROR<<"write failed: No space left on device, path /data/segment.log";
+        if (i % 1000 == 0) {
+            LOG_INFO<<"progress "<<i;
+        }
+    }
+    log->stop();
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    fermat::LogAsyncStats s = log->stats();
+    std::string data = log_bench::take_files("dedup_test.");
+
+    size_t written = count(data, "segment.log\n") - count(data, "Message repeated");
+    size_t repeated = 0;
+    for (size_t pos = data.find("Message repeated "); pos != std::string::npos;
+         pos = data.find("Message repeated ", pos + 1)) {
+        repeated += strtoull(data.c_str() + pos + 17, NULL, 10);
+    }
+    std::cout<<"window_us "<<window<<" file_bytes "<<data.size()
+             <<" storm_lines_written "<<written<<" coalesced "<<s.coalesced_lines
+             <<" micro_seconds "<<cost<<std::endl;
+    bool ok = expect("storm lines accounted", written + repeated, static_cast<size_t>(lines));
+    ok = expect("progress lines", count(data, "progress "), static_cast<size_t>((lines + 999) / 1000)) && ok;
+    return expect("coalesced counted", s.coalesced_lines, repeated) && ok;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines of the storm", false, 500000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    int lines = p.get<int>("number");
+
+    bool ok = check_filter();
+    ok = check_async(lines, 0) && ok;
+    ok = check_async(lines, 100000) && ok;
+    std::cout<<(ok ? "OK" : "FAILED")<<std::endl;
+    return ok ? 0 : 1;
+}
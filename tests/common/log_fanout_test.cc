@@ -0,0 +1,94 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_fanout.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/this_thread.h>
+#include <fermat/common/timestamp.h>
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include "log_bench.h"
+
+// a sink slower than the loggers, counts the lines it gets
+class SlowOutput : public fermat::LogOutput {
+public:
+    SlowOutput() : fermat::LogOutput("slow"), lines(0) {}
+    virtual void puts(const char* buf, size_t len)
+    {
+        lines += std::count(buf, buf + len, '\n');
+        fermat::this_thread::sleep_for(fermat::Timespan(2000));
+    }
+    virtual void flush() {}
+
+    std::atomic<uint64_t> lines;
+};
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines per level", false, 50000, fermat::range(1, 10000000));
+    p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    int n = p.get<int>("number");
+
+    log_bench::take_lines("fanout_main.");
+    log_bench::take_lines("fanout_error.");
+    fermat::LogAsync *mainLog = new fermat::LogAsync("./log/fanout_main", 1024 * 1024 * 1024);
+    mainLog->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    fermat::LogOutputPtr mainOut(mainLog);
+    fermat::LogAsync *errorLog = new fermat::LogAsync("./log/fanout_error", 1024 * 1024 * 1024);
+    errorLog->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    fermat::LogOutputPtr errorOut(errorLog);
+    SlowOutput *slow = new SlowOutput();
+    fermat::LogOutputPtr slowOut(slow);
+    fermat::LogQueueOutput *queue = new fermat::LogQueueOutput(slowOut, 4096, 4);
+    fermat::LogOutputPtr queueOut(queue);
+
+    fermat::LogFanout *fan = new fermat::LogFanout();
+    fan->add_sink(mainOut, fermat::Logging::eDEBUG);
+    fan->add_sink(errorOut, fermat::Logging::eERROR);
+    fan->add_sink(queueOut, fermat::Logging::eWARN);
+    fermat::LogOutputPtr fanOut(fan);
+    mainLog->start();
+    errorLog->start();
+    queue->start();
+    fermat::Logging::set_log_level(fermat::Logging::eDEBUG);
+    fermat::Logging::set_output(fanOut);
+
+    // flush() reaches the queued sink before its 1s interval
+    LOG_WARN<<"flushed";
+    fanOut->flush();
+    fermat::this_thread::sleep_for(fermat::Timespan(200 * 1000));
+    bool flushed = slow->lines.load() == 1;
+
+    fermat::Timestamp start;
+    for (int i = 0; i < n; ++i) {
+        LOG_DEBUG<<"debug "<<i;
+        LOG_INFO<<"info "<<i;
+        LOG_WARN<<"warn "<<i;
+        LOG_ERROR<<"error "<<i;
+    }
+    fermat::Timestamp end;
+    mainLog->stop();
+    errorLog->stop();
+    queue->stop();
+
+    size_t mainLines = log_bench::take_lines("fanout_main.");
+    size_t errorLines = log_bench::take_lines("fanout_error.");
+    uint64_t slowLines = slow->lines.load();
+    uint64_t dropped = queue->dropped_lines();
+    // the slow sink also got the "Dropped" notes
+    bool ok = flushed &&
+              mainLines == static_cast<size_t>(4 * n) + 1 &&
+              errorLines == static_cast<size_t>(n) &&
+              slowLines >= static_cast<uint64_t>(2 * n) + 1 - dropped &&
+              slowLines <= static_cast<uint64_t>(2 * n) + 1 - dropped + 1000;
+    std::cout<<"flushed: "<<flushed<<" main: "<<mainLines<<" error: "<<errorLines
+             <<" slow: "<<slowLines<<" slow dropped: "<<dropped
+             <<" cost micro_seconds: "<<(end - start)
+             <<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok ? 0 : 1;
+}
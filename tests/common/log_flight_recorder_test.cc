@@ -0,0 +1,146 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_flight_recorder.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <fermat/common/thread.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <unistd.h>
+
+static const char* kDumpName = "./log/flight_recorder.log";
+static const char* kPayload = "payload-0123456789-abcdefghijklmnopqrstuvwxyz";
+
+static std::string read_dump()
+{
+    std::ifstream in(kDumpName);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static size_t count(const std::string &text, const std::string &what)
+{
+    size_t n = 0;
+    for (size_t pos = text.find(what); pos != std::string::npos;
+         pos = text.find(what, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+static bool expect(const char* name, size_t got, size_t lo, size_t hi)
+{
+    std::cout<<name<<": "<<got<<std::endl;
+    if (got < lo || got > hi) {
+        std::cout<<"unexpected, want ["<<lo<<", "<<hi<<"]"<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool check_triggers(fermat::LogFlightRecorder *rec)
+{
+    bool ok = true;
+    for (int i = 0; i < 100; ++i) {
+        LOG_TRACE<<"before "<<i;
+        LOG_DEBUG<<"before "<<i;
+    }
+    ok = expect("dumped before the error", read_dump().size(), 0, 0) && ok;
+    LOG_ERROR<<"boom";
+    std::string dump = read_dump();
+    ok = expect("lines dumped by the error", count(dump, "before "), 200, 200) && ok;
+    ok = expect("error line dumped", count(dump, "boom"), 1, 1) && ok;
+
+    for (int i = 0; i < 3000; ++i) {
+        LOG_DEBUG<<"wrap "<<i;
+    }
+    ok = expect("lines dumped on demand", rec->dump(), 1024, 1024) && ok;
+    dump = read_dump();
+    ok = expect("newest line dumped", count(dump, "wrap 2999\n"), 1, 1) && ok;
+    ok = expect("overwritten line dumped", count(dump, "wrap 1000\n"), 0, 0) && ok;
+    ok = expect("earlier lines after a second dump", count(dump, "before "), 200, 200) && ok;
+    // the recorder keeps the file open in append mode
+    ok = ::truncate(kDumpName, 0) == 0 && ok;
+    return ok;
+}
+
+static void producer(int lines)
+{
+    for (int i = 0; i < lines; ++i) {
+        LOG_DEBUG<<"line "<<i<<' '<<kPayload;
+    }
+}
+
+// every line a concurrent dump writes must be whole
+static bool check_concurrent(fermat::LogFlightRecorder *rec, int lines)
+{
+    std::atomic<bool> done(false);
+    fermat::Thread dumper("dumper");
+    dumper.start([&]() {
+        while (!done.load()) {
+            rec->dump();
+            ::usleep(100);
+        }
+    });
+    std::vector<fermat::Thread*> ths;
+    for (int i = 0; i < 4; ++i) {
+        fermat::Thread *t = new fermat::Thread("producer");
+        t->start(std::bind(&producer, lines));
+        ths.push_back(t);
+    }
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    done.store(true);
+    dumper.join();
+    rec->dump();
+
+    std::istringstream in(read_dump());
+    std::string line;
+    size_t whole = 0;
+    size_t torn = 0;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 4, "--- ") == 0) {
+            continue;
+        }
+        if (line.size() > strlen(kPayload) &&
+            line.compare(line.size() - strlen(kPayload), std::string::npos, kPayload) == 0 &&
+            line.find("line ") != std::string::npos) {
+            ++whole;
+        } else {
+            ++torn;
+        }
+    }
+    std::cout<<"lost while lapped: "<<rec->lost()<<std::endl;
+    return expect("whole lines dumped", whole, 1, 4 * lines) &&
+           expect("torn lines dumped", torn, 0, 0);
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines per thread", false, 200000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+
+    ::unlink(kDumpName);
+    fermat::LogFlightRecorder *rec = new fermat::LogFlightRecorder(kDumpName, 1000, 256);
+    fermat::LogOutputPtr out(rec);
+    fermat::Logging::set_log_level(fermat::Logging::eTRACE);
+    fermat::Logging::set_output(out);
+    bool ok = check_triggers(rec);
+    ok = check_concurrent(rec, lines) && ok;
+
+    fermat::Clock begin;
+    producer(lines);
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    std::cout<<"recorded ns_per_line: "<<static_cast<double>(cost) * 1000 / lines<<std::endl;
+    ::unlink(kDumpName);
+    std::cout<<(ok ? "OK" : "FAILED")<<std::endl;
+    return ok ? 0 : 1;
+}
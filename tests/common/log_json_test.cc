@@ -0,0 +1,189 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cmath>
+
+// keeps the last line instead of writing it
+class CaptureOutput : public fermat::LogOutput {
+public:
+    CaptureOutput() : fermat::LogOutput("capture") {}
+    virtual void puts(const char* buf, size_t len) { line.assign(buf, len); }
+    virtual void flush() {}
+
+    std::string line;
+};
+
+// just enough of a JSON parser to tell a valid object line
+struct JsonChecker {
+    const char* p;
+    const char* end;
+
+    bool ws() { while (p < end && (*p == ' ' || *p == '\t')) ++p; return p < end; }
+
+    bool string()
+    {
+        if (*p++ != '"') return false;
+        while (p < end && *p != '"') {
+            unsigned char c = static_cast<unsigned char>(*p++);
+            if (c < 0x20) return false;
+            if (c != '\\') continue;
+            if (p == end) return false;
+            c = static_cast<unsigned char>(*p++);
+            if (c == 'u') {
+                for (int i = 0; i < 4; ++i, ++p) {
+                    if (p == end || !isxdigit(static_cast<unsigned char>(*p))) return false;
+                }
+            } else if (!strchr("\"\\/bfnrt", c)) {
+                return false;
+            }
+        }
+        return p++ < end;
+    }
+
+    bool literal(const char* word)
+    {
+        size_t n = strlen(word);
+        if (static_cast<size_t>(end - p) < n || memcmp(p, word, n) != 0) return false;
+        p += n;
+        return true;
+    }
+
+    bool value()
+    {
+        if (!ws()) return false;
+        if (*p == '"') return string();
+        if (*p == 't') return literal("true");
+        if (*p == 'f') return literal("false");
+        if (*p == 'n') return literal("null");
+        const char* start = p;
+        if (*p == '-') ++p;
+        while (p < end && strchr("0123456789.eE+-", *p)) ++p;
+        return p > start;
+    }
+
+    bool object()
+    {
+        if (!ws() || *p++ != '{') return false;
+        for (bool first = true;; first = false) {
+            if (!ws()) return false;
+            if (*p == '}' && first) { ++p; return true; }
+            if (!string() || !ws() || *p++ != ':' || !value() || !ws()) return false;
+            if (*p == '}') { ++p; return true; }
+            if (*p++ != ',') return false;
+        }
+    }
+
+    static bool valid(const std::string &line)
+    {
+        if (line.empty() || line[line.size() - 1] != '\n') return false;
+        JsonChecker c = {line.data(), line.data() + line.size() - 1};
+        return c.object() && c.p == c.end;
+    }
+};
+
+static bool expect(const std::string &line, const char* part)
+{
+    if (line.find(part) == std::string::npos) {
+        std::cout<<"missing "<<part<<" in "<<line;
+        return false;
+    }
+    return true;
+}
+
+static bool check(CaptureOutput *out)
+{
+    bool ok = true;
+    fermat::Logging::set_format(fermat::Logging::eFormatText);
+    LOG_INFO.kv("user", 42).kv("lat_us", 1.5).kv("ok", true).kv("path", "/a b")
+            .kv("empty", "")<<"done";
+    ok = expect(out->line, "] check user=42 lat_us=1.5 ok=true path=\"/a b\" empty=\"\" done\n") && ok;
+
+    fermat::Logging::set_format(fermat::Logging::eFormatJson);
+    LOG_INFO.kv("user", 42).kv("lat_us", 1.5).kv("neg", -7LL).kv("ok", false)<<"done "<<3;
+    ok = JsonChecker::valid(out->line) && ok;
+    ok = expect(out->line, "\"level\":\"INFO\",\"file\":\"log_json_test.cc\"") && ok;
+    ok = expect(out->line, "\"func\":\"check\",\"msg\":\"done 3\","
+                "\"user\":42,\"lat_us\":1.5,\"neg\":-7,\"ok\":false}\n") && ok;
+
+    std::string nasty("quote\" back\\ nl\n tab\t bell\a utf8 \xc3\xa9");
+    LOG_WARN.kv("k\"ey", nasty).kv("inf", HUGE_VAL).kv("c", '\n')<<nasty<<'\x01'<<'"';
+    ok = JsonChecker::valid(out->line) && ok;
+    ok = expect(out->line, "\"msg\":\"quote\\\" back\\\\ nl\\n tab\\t bell\\u0007 utf8 "
+                "\xc3\xa9\\u0001\\\"\"") && ok;
+    ok = expect(out->line, "\"k\\\"ey\":\"quote\\\"") && ok;
+    ok = expect(out->line, "\"inf\":null,\"c\":\"\\n\"}") && ok;
+
+    LOG_INFO.sprintf("%s=%d", "a\"b", 1);
+    ok = JsonChecker::valid(out->line) && ok;
+    ok = expect(out->line, "\"msg\":\"a\\\"b=1\"}") && ok;
+
+    // longer than the line buffer, formatted in place
+    std::string wide(3000, 'w');
+    LOG_INFO.sprintf("<%s>", wide.c_str());
+    ok = JsonChecker::valid(out->line) && ok;
+    ok = expect(out->line, ("\"msg\":\"<" + wide + ">\"}").c_str()) && ok;
+
+    // one line buffer and the small inline one of the kv() fields
+    ok = sizeof(fermat::LogStream) < 2 * fermat::LogStream::kBufferSize && ok;
+
+    for (int i = 0; i < 3; ++i) {
+        LOG_EVERY_N(INFO, 2)<<"limited "<<i;
+    }
+    ok = JsonChecker::valid(out->line) && ok;
+    ok = expect(out->line, "\"msg\":\"limited 2\",\"suppressed\":1}") && ok;
+    fermat::Logging::set_format(fermat::Logging::eFormatText);
+    return ok;
+}
+
+template <typename F>
+static void bench(const char* name, F fn, int lines)
+{
+    fermat::Clock begin;
+    for (int i = 0; i < lines; ++i) {
+        fn(i);
+    }
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    std::cout<<name<<" ns_per_line: "<<static_cast<double>(cost) * 1000 / lines<<std::endl;
+}
+
+// the JSON members built by hand before the line, as callers did
+static void by_hand(int i)
+{
+    std::string json("{\"user\":\"");
+    json += "alice \"admin\"";
+    json += "\",\"id\":";
+    json += std::to_string(i);
+    json += ",\"lat_us\":";
+    json += std::to_string(i * 0.5);
+    json += "}";
+    LOG_INFO<<json;
+}
+
+static void with_kv(int i)
+{
+    LOG_INFO.kv("user", "alice \"admin\"").kv("id", i).kv("lat_us", i * 0.5);
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines per benchmark", false, 1000000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+
+    CaptureOutput *capture = new CaptureOutput();
+    fermat::LogOutputPtr out(capture);
+    fermat::Logging::set_output(out);
+    bool ok = check(capture);
+    std::cout<<(ok ? "checks OK" : "checks FAILED")<<std::endl;
+
+    bench("text by hand", by_hand, lines);
+    bench("text kv     ", with_kv, lines);
+    fermat::Logging::set_format(fermat::Logging::eFormatJson);
+    bench("json kv     ", with_kv, lines);
+    fermat::Logging::set_format(fermat::Logging::eFormatText);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <string>
+
+// keeps the lines instead of writing them
+class CaptureOutput : public fermat::LogOutput {
+public:
+    CaptureOutput() : fermat::LogOutput("capture") {}
+    virtual void puts(const char* buf, size_t len) { lines.append(buf, len); }
+    virtual void flush() {}
+    std::string lines;
+};
+
+static void log_all()
+{
+    LOG_TRACE<<"trace";
+    LOG_DEBUG<<"debug";
+    LOG_INFO<<"info";
+    LOG_WARN<<"warn";
+}
+
+static bool expect(CaptureOutput *out, const char* what, bool logged)
+{
+    bool found = out->lines.find(what) != std::string::npos;
+    if (found != logged) {
+        std::cout<<"unexpected: "<<what<<(logged ? " missing" : " logged")<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool check(CaptureOutput *out)
+{
+    bool ok = true;
+    fermat::Logging::set_log_level(fermat::Logging::eINFO);
+    out->lines.clear();
+    log_all();
+    ok = expect(out, "debug", false) && expect(out, "info", true) && ok;
+
+    // applies to sites that already logged
+    ok = fermat::Logging::set_vmodule("log_level_*=TRACE") && ok;
+    out->lines.clear();
+    log_all();
+    ok = expect(out, "trace", true) && ok;
+
+    ok = fermat::Logging::set_vmodule("other=0, log_level_test=3") && ok;
+    out->lines.clear();
+    log_all();
+    ok = expect(out, "info", false) && expect(out, "warn", true) && ok;
+
+    ok = !fermat::Logging::set_vmodule("log_level_test") && ok;
+    ok = !fermat::Logging::set_vmodule("log_level_test=LOUD") && ok;
+
+    fermat::Logging::set_vmodule("");
+    out->lines.clear();
+    log_all();
+    ok = expect(out, "debug", false) && expect(out, "info", true) && ok;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "disabled lines to time", false, 100000000, fermat::range(1, 1000000000));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+
+    CaptureOutput *out = new CaptureOutput();
+    fermat::LogOutputPtr ptr(out);
+    fermat::Logging::set_output(ptr);
+    if (!check(out)) {
+        return 1;
+    }
+
+    fermat::Logging::set_log_level(fermat::Logging::eINFO);
+    fermat::Clock begin;
+    for (int i = 0; i < lines; ++i) {
+        LOG_DEBUG<<"disabled "<<i;
+    }
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    std::cout<<"disabled site ns_per_line: "
+             <<static_cast<double>(cost) * 1000 / lines<<std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+// keeps the lines instead of writing them
+class CaptureOutput : public fermat::LogOutput {
+public:
+    CaptureOutput() : fermat::LogOutput("capture") {}
+    virtual void puts(const char* buf, size_t len) { lines.append(buf, len); }
+    virtual void flush() {}
+
+    size_t count(const char* what) const
+    {
+        size_t n = 0;
+        for (size_t pos = lines.find(what); pos != std::string::npos;
+             pos = lines.find(what, pos + 1)) {
+            ++n;
+        }
+        return n;
+    }
+
+    std::string lines;
+};
+
+static bool expect(const char* name, size_t got, size_t lo, size_t hi)
+{
+    std::cout<<name<<": "<<got<<" lines"<<std::endl;
+    if (got < lo || got > hi) {
+        std::cout<<"unexpected, want ["<<lo<<", "<<hi<<"]"<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool check(CaptureOutput *out)
+{
+    bool ok = true;
+    for (int i = 0; i < 1000; ++i) {
+        LOG_EVERY_N(INFO, 100)<<"every_n "<<i;
+        LOG_FIRST_N(WARN, 3)<<"first_n "<<i;
+        LOG_SAMPLED(INFO, 0.1)<<"sampled "<<i;
+        LOG_EVERY_N(DEBUG, 1)<<"disabled "<<i;
+    }
+    ok = expect("every_n", out->count("every_n"), 10, 10) && ok;
+    ok = expect("every_n suppressed", out->count("(99 suppressed) every_n"), 9, 9) && ok;
+    ok = expect("first_n", out->count("first_n"), 3, 3) && ok;
+    ok = expect("sampled", out->count("sampled "), 50, 200) && ok;
+    ok = expect("disabled", out->count("disabled"), 0, 0) && ok;
+
+    for (int i = 0; i < 30; ++i) {
+        LOG_EVERY_T(INFO, 100)<<"every_t "<<i;
+        ::usleep(10 * 1000);
+    }
+    ok = expect("every_t", out->count("every_t"), 2, 5) && ok;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "suppressed lines to time", false, 10000000, fermat::range(1, 1000000000));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+
+    CaptureOutput *out = new CaptureOutput();
+    fermat::LogOutputPtr ptr(out);
+    fermat::Logging::set_output(ptr);
+    if (!check(out)) {
+        return 1;
+    }
+
+    fermat::Clock begin;
+    for (int i = 0; i < lines; ++i) {
+        LOG_EVERY_N(INFO, 1000000000)<<"bench "<<i;
+    }
+    std::cout<<"every_n suppressed ns_per_line: "
+             <<static_cast<double>(begin.elapsed()) * 1000 / lines<<std::endl;
+    begin.update();
+    for (int i = 0; i < lines; ++i) {
+        LOG_EVERY_T(INFO, 1000000)<<"bench "<<i;
+    }
+    std::cout<<"every_t suppressed ns_per_line: "
+             <<static_cast<double>(begin.elapsed()) * 1000 / lines<<std::endl;
+    begin.update();
+    for (int i = 0; i < lines; ++i) {
+        LOG_SAMPLED(INFO, 0.0)<<"bench "<<i;
+    }
+    std::cout<<"sampled suppressed ns_per_line: "
+             <<static_cast<double>(begin.elapsed()) * 1000 / lines<<std::endl;
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <fermat/common/log_shard_merger.h>
+#include <fermat/common/cmdline.h>
+#include <iostream>
+#include <cstdio>
+
+// Merges the shards of a LogShardedAsync into one log ordered by
+// time: log_merge -b ./log/base -o merged.log
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<std::string>("base", 'b', "base name the shards were created with", true, "");
+    p.add<std::string>("output", 'o', "merged file, - for stdout", false, "-");
+    p.add<int>("window", 'w', "lines per shard held for reordering", false,
+               static_cast<int>(fermat::LogShardMerger::kDefaultWindow),
+               fermat::range(1, 16 * 1024 * 1024));
+    p.parse_check(argc, argv);
+    std::string output = p.get<std::string>("output");
+
+    fermat::LogShardMerger merger(static_cast<size_t>(p.get<int>("window")));
+    size_t shards = merger.add_shards(p.get<std::string>("base"));
+    if (shards == 0) {
+        std::cerr<<"no shards found for "<<p.get<std::string>("base")<<std::endl;
+        return 1;
+    }
+    FILE *out = output == "-" ? stdout : fopen(output.c_str(), "w");
+    if (!out) {
+        std::cerr<<"cannot open "<<output<<std::endl;
+        return 1;
+    }
+    bool ok = merger.merge(out);
+    ok = fflush(out) == 0 && ok;
+    if (out != stdout) {
+        ok = fclose(out) == 0 && ok;
+    }
+    std::cerr<<"merged "<<merger.lines()<<" lines from "<<shards<<" shards"<<std::endl;
+    return ok ? 0 : 1;
+}
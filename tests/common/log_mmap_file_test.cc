@@ -0,0 +1,93 @@
+#include <fermat/common/log_file.h>
+#include <fermat/common/mmap_write_file.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log_bench.h"
+
+static bool check_writer()
+{
+    const char* name = "./log/mmap_writer.log";
+    ::unlink(name);
+    std::string expect;
+    {
+        // a chunk smaller than a page rounds up to one page
+        fermat::MmapWriteFile f(name, 100);
+        for (int i = 0; i < 2000; ++i) {
+            std::string line = "line " + std::to_string(i) + "\n";
+            f.append(line.data(), line.size());
+            expect += line;
+        }
+        struct iovec iov[2];
+        iov[0].iov_base = const_cast<char*>("iov a\n");
+        iov[0].iov_len = 6;
+        iov[1].iov_base = const_cast<char*>("iov b\n");
+        iov[1].iov_len = 6;
+        f.append(iov, 2);
+        expect += "iov a\niov b\n";
+        std::cout<<"mapped: "<<f.mapped()<<" write_size: "<<f.write_size()<<std::endl;
+        if (f.write_size() != expect.size()) {
+            return false;
+        }
+    }
+    {
+        // reopening appends after what is there
+        fermat::MmapWriteFile f(name);
+        f.append("tail\n", 5);
+        expect += "tail\n";
+    }
+    std::ifstream in(name);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    ::unlink(name);
+    if (ss.str() != expect) {
+        std::cout<<"content mismatch, "<<ss.str().size()<<" bytes, want "
+                 <<expect.size()<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename WRITER>
+static bool bench(const char* name, const std::string &base, int lines)
+{
+    std::string line(100, 'x');
+    line += '\n';
+    fermat::Clock begin;
+    {
+        // rolls about every 10MB, each roll truncates the mapped file
+        fermat::LogFile<fermat::NullMutex, WRITER> file(base, 10 * 1024 * 1024);
+        for (int i = 0; i < lines; ++i) {
+            file.append(line.data(), line.size());
+        }
+    }
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    size_t files = 0;
+    std::string data = log_bench::take_files(base.substr(6) + ".", &files);
+    std::cout<<name<<" ns_per_line: "<<static_cast<double>(cost) * 1000 / lines
+             <<" files: "<<files<<std::endl;
+    return data.size() == line.size() * lines;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines to write", false, 1000000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    int lines = p.get<int>("number");
+
+    bool ok = check_writer();
+    ok = bench<fermat::SequenceWriteFile>("stdio", "./log/mmap_test_stdio", lines) && ok;
+    ok = bench<fermat::MmapWriteFile>("mmap ", "./log/mmap_test_mmap", lines) && ok;
+    std::cout<<(ok ? "OK" : "FAILED")<<std::endl;
+    return ok ? 0 : 1;
+}
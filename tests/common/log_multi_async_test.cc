@@ -0,0 +1,123 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_multi_async.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/timestamp.h>
+#include <fermat/common/thread.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "log_bench.h"
+
+static int lines_per_thread = 0;
+
+static void runner()
+{
+    for (int i = 0; i < lines_per_thread; ++i) {
+        LOG_INFO<<"short lived thread line "<<i;
+    }
+}
+
+// lines larger than a buffer from more threads than queues: the
+// heap buffers stay under the cap, the policy takes the rest
+static bool check_cap(fermat::LogAsync::OverflowPolicy policy, const char* name)
+{
+    const size_t kBuffer = 4096;
+    const size_t kCap = 12 * kBuffer;
+    const int kThreads = 4;
+    const int kLines = 2000;
+    log_bench::take_lines("multi_cap.");
+    fermat::LogMultiAsync *lm = new fermat::LogMultiAsync("./log/multi_cap", 1024 * 1024 * 1024, 2);
+    fermat::LogOutputPtr out(lm);
+    lm->set_buffer_size(kBuffer);
+    lm->set_max_buffer_bytes(kCap);
+    lm->set_overflow_policy(policy);
+    lm->start();
+    fermat::Logging::set_output(out);
+    std::atomic<int> running(kThreads);
+    std::vector<fermat::Thread*> ths;
+    for (int t = 0; t < kThreads; ++t) {
+        fermat::Thread *th = new fermat::Thread("log_multi");
+        th->start([&running]() {
+            std::string payload(6000, 'm');
+            for (int i = 0; i < kLines; ++i) {
+                LOG_INFO<<"large line "<<i<<' '<<payload;
+            }
+            running.fetch_sub(1);
+        });
+        ths.push_back(th);
+    }
+    size_t peak = 0;
+    while (running.load() > 0) {
+        peak = std::max<size_t>(peak, lm->stats().queued_bytes);
+    }
+    for (size_t t = 0; t < ths.size(); ++t) {
+        ths[t]->join();
+        delete ths[t];
+    }
+    lm->stop();
+    fermat::LogAsyncStats st = lm->stats();
+    log_bench::take_lines("multi_cap.");
+    uint64_t total = static_cast<uint64_t>(kThreads) * kLines;
+    bool ok = peak <= kCap && st.written_lines + st.dropped_lines == total &&
+              (policy == fermat::LogAsync::eOverflowBlock ? st.dropped_lines == 0
+                                                          : st.dropped_lines > 0);
+    std::cout<<name<<": written "<<st.written_lines<<" dropped "<<st.dropped_lines
+             <<" peak_queued "<<peak<<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("waves", 'w', "waves of threads", false, 20, fermat::range(1, 10000));
+    p.add<int>("threads", 'c', "threads per wave", false, 50, fermat::range(1, 1024));
+    p.add<int>("queues", 'q', "queues of the logger", false, 16, fermat::range(1, 4096));
+    p.add<int>("number", 'n', "lines per thread", false, 2000, fermat::range(1, 10000000));
+    p.parse_check(argc, argv);
+    int waves = p.get<int>("waves");
+    int threads = p.get<int>("threads");
+    size_t queues = static_cast<size_t>(p.get<int>("queues"));
+    lines_per_thread = p.get<int>("number");
+
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    log_bench::take_lines("multi.");
+    fermat::LogOutputPtr out(new fermat::LogMultiAsync("./log/multi", 1024 * 1024 * 1024, queues));
+    fermat::LogMultiAsync *lm = static_cast<fermat::LogMultiAsync*>(out.get());
+    // every line must arrive, however far the threads outrun the backend
+    lm->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    lm->start();
+    fermat::Logging::set_output(out);
+
+    fermat::Timestamp start;
+    for (int w = 0; w < waves; ++w) {
+        std::vector<fermat::Thread*> ths;
+        for (int i = 0; i < threads; ++i) {
+            fermat::Thread *t = new fermat::Thread("log_multi");
+            t->start(std::bind(&runner));
+            ths.push_back(t);
+        }
+        for (size_t i = 0; i < ths.size(); ++i) {
+            ths[i]->join();
+            delete ths[i];
+        }
+    }
+    fermat::Timestamp end;
+    lm->stop();
+
+    size_t expect = static_cast<size_t>(waves) * threads * lines_per_thread;
+    size_t got = log_bench::take_lines("multi.");
+    std::cout<<"threads: "<<waves * threads
+             <<" queues_created: "<<lm->queue_count()
+             <<" lines: "<<got<<"/"<<expect
+             <<" dropped: "<<lm->stats().dropped_lines
+             <<" cost micro_seconds: "<<(end - start)
+             <<std::endl;
+    bool ok = got == expect && lm->queue_count() <= queues;
+    ok = check_cap(fermat::LogAsync::eOverflowBlock, "cap_block") && ok;
+    ok = check_cap(fermat::LogAsync::eOverflowDrop, "cap_drop") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/hazard_pointer.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/thread.h>
+#include <fermat/common/this_thread.h>
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <ctime>
+
+// Cost of reaching the global output from many threads, the old
+// shared_ptr copy against the HazardPtr read, and a stress run
+// swapping the output while threads log.
+
+static std::atomic<uint64_t> g_lines(0);
+static std::atomic<bool> g_stop(false);
+
+class CountOutput : public fermat::LogOutput {
+public:
+    CountOutput() : fermat::LogOutput("count"), _alive(kAlive), _count(0) {}
+    ~CountOutput()
+    {
+        g_lines.fetch_add(_count.load(), std::memory_order_relaxed);
+        _alive = 0;
+    }
+    virtual void puts(const char*, size_t)
+    {
+        if (_alive != kAlive) {
+            std::cerr<<"puts on a destroyed output"<<std::endl;
+            abort();
+        }
+        _count.fetch_add(1, std::memory_order_relaxed);
+    }
+    virtual void flush() {}
+private:
+    static const int kAlive = 0x5a5a5a5a;
+    volatile int           _alive;
+    std::atomic<uint64_t>  _count;
+};
+
+class NullOutput : public fermat::LogOutput {
+public:
+    NullOutput() : fermat::LogOutput("null") {}
+    virtual void puts(const char*, size_t) {}
+    virtual void flush() {}
+};
+
+static fermat::LogOutputPtr g_shared(new NullOutput());
+static std::atomic<fermat::LogOutput*> g_raw(g_shared.get());
+static int iterations = 0;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void shared_reader()
+{
+    for (int i = 0; i < iterations; ++i) {
+        fermat::LogOutputPtr out = g_shared;
+        out->puts(NULL, 0);
+    }
+}
+
+static void hazard_reader()
+{
+    for (int i = 0; i < iterations; ++i) {
+        fermat::HazardPtr<fermat::LogOutput> out(g_raw);
+        out->puts(NULL, 0);
+    }
+}
+
+static void log_reader()
+{
+    for (int i = 0; i < iterations; ++i) {
+        LOG_INFO<<"line "<<i;
+    }
+}
+
+static void swap_reader()
+{
+    int i = 0;
+    while (!g_stop.load(std::memory_order_relaxed)) {
+        LOG_INFO<<"swap line "<<i++;
+    }
+    g_lines.fetch_sub(i, std::memory_order_relaxed);
+}
+
+// wall ns per call of each thread with threads threads running
+// fn, flat as threads grow while they fit in the cores
+static double run(void (*fn)(), int threads)
+{
+    std::vector<fermat::Thread*> ths;
+    int64_t start = now_ns();
+    for (int i = 0; i < threads; ++i) {
+        fermat::Thread *t = new fermat::Thread("swap_test");
+        t->start(std::bind(fn));
+        ths.push_back(t);
+    }
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    return static_cast<double>(now_ns() - start) / iterations;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "calls per thread", false, 2000000, fermat::range(1, 1000000000));
+    p.add<int>("swaps", 's', "set_output calls of the stress run", false, 2000, fermat::range(0, 10000000));
+    p.parse_check(argc, argv);
+    iterations = p.get<int>("number");
+    int swaps = p.get<int>("swaps");
+
+    fermat::LogOutputPtr null(new NullOutput());
+    fermat::Logging::set_output(null);
+    static const int kThreads[] = {1, 2, 4, 8, 16, 32, 64};
+    for (size_t i = 0; i < sizeof(kThreads) / sizeof(kThreads[0]); ++i) {
+        int threads = kThreads[i];
+        double shared = run(&shared_reader, threads);
+        double hazard = run(&hazard_reader, threads);
+        double logging = run(&log_reader, threads);
+        std::cout<<"threads: "<<threads
+                 <<" shared_ptr_ns: "<<shared
+                 <<" hazard_ns: "<<hazard
+                 <<" LOG_INFO_ns: "<<logging<<std::endl;
+    }
+
+    fermat::LogOutputPtr first(new CountOutput());
+    fermat::Logging::set_output(first);
+    first.reset();
+    std::vector<fermat::Thread*> ths;
+    for (int i = 0; i < 8; ++i) {
+        fermat::Thread *t = new fermat::Thread("swap_test");
+        t->start(std::bind(&swap_reader));
+        ths.push_back(t);
+    }
+    for (int i = 0; i < swaps; ++i) {
+        fermat::LogOutputPtr out(new CountOutput());
+        fermat::Logging::set_output(out);
+        fermat::this_thread::sleep_for(fermat::Timespan(100));
+    }
+    g_stop = true;
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    fermat::Logging::set_output(null);
+    int64_t lost = static_cast<int64_t>(g_lines.load());
+    std::cout<<"swaps: "<<swaps<<" lines lost or doubled: "<<lost
+             <<(lost == 0 ? " OK" : " FAILED")<<std::endl;
+    return lost == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/thread.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "log_bench.h"
+
+// Bursts of lines from several threads overrun a small LogAsync
+// under each overflow policy, in both queue modes. Every line must
+// end up in the log file, in the overflow file, or in the counts
+// of a "Dropped" line, and the stats must agree with those counts.
+
+static const int kThreads = 4;
+static const int kLines = 50000;
+
+struct Counts {
+    uint64_t  lines;          //!< logged lines in the main files
+    uint64_t  spilled;        //!< in the overflow files
+    uint64_t  noted_lines;    //!< summed over the "Dropped" lines
+    uint64_t  noted_bytes;
+};
+
+static void producer()
+{
+    for (int i = 0; i < kLines; ++i) {
+        LOG_INFO<<"overflow line "<<i<<" with some padding to fill the buffers";
+    }
+}
+
+// reads and removes the files of base
+static Counts count(const std::string &base)
+{
+    Counts c = {0, 0, 0, 0};
+    bool spill = true;
+    auto parse = [&](const std::string &line) {
+        unsigned long long bytes = 0;
+        unsigned long long lines = 0;
+        size_t at = line.find(" Dropped ");
+        if (at != std::string::npos &&
+            sscanf(line.c_str() + at, " Dropped %llu bytes (%llu lines)", &bytes, &lines) == 2) {
+            c.noted_bytes += bytes;
+            c.noted_lines += lines;
+        } else if (line.find("overflow line ") != std::string::npos) {
+            ++(spill ? c.spilled : c.lines);
+        }
+    };
+    // the overflow files first, base. matches them too
+    log_bench::take_lines(base + ".overflow.", parse);
+    spill = false;
+    log_bench::take_lines(base + ".", parse);
+    return c;
+}
+
+static bool run(const char* name, fermat::LogAsync::QueueMode mode,
+                fermat::LogAsync::OverflowPolicy policy)
+{
+    std::string base = std::string("overflow_") + name;
+    count(base);
+    fermat::LogAsync *la = new fermat::LogAsync("./log/" + base, 1024 * 1024 * 1024, 3, mode);
+    la->set_overflow_policy(policy);
+    la->set_buffer_size(4096);
+    la->set_max_buffer_bytes(8 * 4096);
+    la->set_ring_size(4096);
+    fermat::LogOutputPtr out(la);
+    la->start();
+    fermat::Logging::set_output(out);
+
+    std::vector<fermat::Thread*> ths;
+    for (int i = 0; i < kThreads; ++i) {
+        fermat::Thread *t = new fermat::Thread("log_overflow");
+        t->start(std::bind(&producer));
+        ths.push_back(t);
+    }
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    la->stop();
+    fermat::LogAsyncStats st = la->stats();
+    Counts c = count(base);
+
+    uint64_t total = static_cast<uint64_t>(kThreads) * kLines;
+    bool ok = c.lines + c.spilled + c.noted_lines == total &&
+              st.dropped_lines == c.noted_lines &&
+              st.dropped_bytes == c.noted_bytes;
+    switch (policy) {
+        case fermat::LogAsync::eOverflowBlock:
+            ok = ok && c.lines == total;
+            break;
+        case fermat::LogAsync::eOverflowDrop:
+            // the burst outruns the backend
+            ok = ok && c.spilled == 0 && c.noted_lines > 0 && c.noted_bytes > c.noted_lines;
+            break;
+        case fermat::LogAsync::eOverflowSpill:
+            ok = ok && c.noted_lines == 0 && c.spilled > 0;
+            break;
+    }
+    std::cout<<name<<": written "<<c.lines<<" spilled "<<c.spilled
+             <<" dropped "<<c.noted_lines<<" ("<<c.noted_bytes<<" bytes)"
+             <<" stats dropped "<<st.dropped_lines<<" ("<<st.dropped_bytes<<" bytes)"
+             <<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok;
+}
+
+// lines larger than a buffer, half of them urgent, take heap
+// buffers that must stay under the cap as well
+static bool run_large(fermat::LogAsync::OverflowPolicy policy, const char* name)
+{
+    std::string base = std::string("overflow_") + name;
+    count(base);
+    const size_t kCap = 8 * 4096;
+    const int kLarge = 2000;
+    fermat::LogAsync *la = new fermat::LogAsync("./log/" + base, 1024 * 1024 * 1024);
+    la->set_overflow_policy(policy);
+    la->set_buffer_size(4096);
+    la->set_max_buffer_bytes(kCap);
+    fermat::LogOutputPtr out(la);
+    la->start();
+    fermat::Logging::set_output(out);
+
+    std::atomic<int> running(kThreads);
+    std::vector<fermat::Thread*> ths;
+    for (int t = 0; t < kThreads; ++t) {
+        fermat::Thread *th = new fermat::Thread("log_overflow");
+        th->start([&running]() {
+            std::string payload(6000, 'l');
+            for (int i = 0; i < kLarge; ++i) {
+                if (i % 2) {
+                    LOG_ERROR<<"overflow line "<<i<<' '<<payload;
+                } else {
+                    LOG_INFO<<"overflow line "<<i<<' '<<payload;
+                }
+            }
+            running.fetch_sub(1);
+        });
+        ths.push_back(th);
+    }
+    size_t peak = 0;
+    while (running.load() > 0) {
+        peak = std::max<size_t>(peak, la->stats().queued_bytes);
+    }
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    la->stop();
+    fermat::LogAsyncStats st = la->stats();
+    Counts c = count(base);
+
+    uint64_t total = static_cast<uint64_t>(kThreads) * kLarge;
+    bool ok = peak <= kCap && c.lines + c.noted_lines == total &&
+              st.dropped_lines == c.noted_lines;
+    ok = ok && (policy == fermat::LogAsync::eOverflowBlock ? c.lines == total : c.noted_lines > 0);
+    std::cout<<name<<": written "<<c.lines<<" dropped "<<c.noted_lines
+             <<" peak_queued "<<peak<<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok;
+}
+
+int main()
+{
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    bool ok = true;
+    ok = run("locked_block", fermat::LogAsync::eLockedQueue, fermat::LogAsync::eOverflowBlock) && ok;
+    ok = run("locked_drop", fermat::LogAsync::eLockedQueue, fermat::LogAsync::eOverflowDrop) && ok;
+    ok = run("locked_spill", fermat::LogAsync::eLockedQueue, fermat::LogAsync::eOverflowSpill) && ok;
+    ok = run("ring_block", fermat::LogAsync::eThreadRing, fermat::LogAsync::eOverflowBlock) && ok;
+    ok = run("ring_drop", fermat::LogAsync::eThreadRing, fermat::LogAsync::eOverflowDrop) && ok;
+    ok = run("ring_spill", fermat::LogAsync::eThreadRing, fermat::LogAsync::eOverflowSpill) && ok;
+    ok = run_large(fermat::LogAsync::eOverflowBlock, "large_block") && ok;
+    ok = run_large(fermat::LogAsync::eOverflowDrop, "large_drop") && ok;
+    return ok ? 0 : 1;
+}
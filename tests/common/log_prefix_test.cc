@@ -0,0 +1,82 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/this_thread.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <cstdio>
+
+// the prefix code before the per-second cache: a Timestamp and
+// an snprintf for the microseconds on every line
+static void legacy_prefix(fermat::LogStream &stream)
+{
+    static __thread char t_time[80];
+    static __thread time_t t_last = 0;
+    fermat::Timestamp now;
+    int64_t us = now.total_micro_seconds();
+    time_t seconds = static_cast<time_t>(us / 1000000);
+    if (seconds != t_last) {
+        t_last = seconds;
+        struct tm tm_time;
+        ::gmtime_r(&seconds, &tm_time);
+        snprintf(t_time, sizeof(t_time), "%4d%02d%02d %02d:%02d:%02d",
+            tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
+            tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), ".%06dZ ", static_cast<int>(us % 1000000));
+    stream.append(t_time, 17);
+    stream.append(buf, 9);
+    stream.append(fermat::this_thread::thread_id_string(),
+                  fermat::this_thread::thread_id_string_length());
+    stream << " INFO   [log_prefix_test.cc:" << __LINE__ << "] ";
+}
+
+static void current_prefix(fermat::LogStream &stream)
+{
+    static const fermat::Logging::SourceFile file(__FILE__);
+    fermat::Logging::format_prefix(stream, fermat::Logging::now().total_micro_seconds(),
+                                   fermat::this_thread::thread_id_string(),
+                                   fermat::this_thread::thread_id_string_length(),
+                                   fermat::Logging::eINFO, file, __LINE__, 0);
+}
+
+static void site_prefix(fermat::LogStream &stream)
+{
+    fermat::Logging::format_prefix(stream, fermat::Logging::now().total_micro_seconds(),
+                                   fermat::this_thread::thread_id_string(),
+                                   fermat::this_thread::thread_id_string_length(),
+                                   FERMAT_LOG_SITE(fermat::Logging::eINFO), 0);
+}
+
+template <typename F>
+static void bench(const char* name, F fn, int lines)
+{
+    fermat::LogStream stream;
+    fermat::Clock begin;
+    for (int i = 0; i < lines; ++i) {
+        stream.reset_bufffer();
+        fn(stream);
+    }
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    std::cout<<name
+             <<" ns_per_prefix: "<<static_cast<double>(cost) * 1000 / lines
+             <<" sample: "<<std::string(stream.buffer().data(), stream.buffer().size())
+             <<std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "prefixes to format", false, 5000000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+    fermat::this_thread::thread_id();
+
+    bench("legacy  ", legacy_prefix, lines);
+    fermat::Logging::set_clock_source(fermat::Logging::eClockRealtime);
+    bench("realtime", current_prefix, lines);
+    fermat::Logging::set_clock_source(fermat::Logging::eClockCoarse);
+    bench("coarse  ", current_prefix, lines);
+    bench("site    ", site_prefix, lines);
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <fermat/common/thread.h>
+#include <fermat/common/this_thread.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <atomic>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "log_bench.h"
+
+static const char* kPrefix = "priority_";
+
+// reads only what the log files of ./log named kPrefix... gained
+// since the last call, the flood makes them large
+struct Tail {
+    std::map<std::string, size_t> offsets;
+
+    bool find(const std::string &token)
+    {
+        bool found = false;
+        std::vector<std::string> files = log_bench::log_files(kPrefix);
+        for (size_t i = 0; i < files.size(); ++i) {
+            std::ifstream in(files[i].c_str());
+            size_t &offset = offsets[files[i]];
+            in.seekg(0, std::ios::end);
+            size_t size = static_cast<size_t>(in.tellg());
+            // keep a token length of overlap with the previous read
+            size_t from = offset > token.size() ? offset - token.size() : 0;
+            if (size <= from) {
+                continue;
+            }
+            std::string data(size - from, '\0');
+            in.seekg(static_cast<std::streamoff>(from));
+            in.read(&data[0], static_cast<std::streamsize>(data.size()));
+            offset = size;
+            found = found || data.find(token) != std::string::npos;
+        }
+        return found;
+    }
+};
+
+// micro seconds until token shows up in the file, -1 after limit
+static int64_t wait_for(Tail &tail, const std::string &token, int64_t limit)
+{
+    fermat::Clock begin;
+    while (begin.elapsed() < limit) {
+        if (tail.find(token)) {
+            return begin.elapsed();
+        }
+        fermat::this_thread::sleep_for(fermat::Timespan(1000));
+    }
+    return -1;
+}
+
+static bool check(fermat::LogAsync::QueueMode mode, const char* name, int flood)
+{
+    log_bench::remove_logs(kPrefix);
+    fermat::LogAsync *log = new fermat::LogAsync("./log/priority_test", 1024 * 1024 * 1024, 3, mode);
+    fermat::LogOutputPtr out(log);
+    log->start();
+    fermat::Logging::set_output(out);
+    bool ok = true;
+    Tail tail;
+
+    // idle: a WARN line waits for the 3s flush interval
+    LOG_WARN<<"bulk token";
+    int64_t warn = wait_for(tail, "bulk token", 300000);
+    LOG_ERROR<<"urgent token";
+    int64_t error = wait_for(tail, "urgent token", 300000);
+    std::cout<<name<<" idle: warn_us "<<warn<<" error_us "<<error<<std::endl;
+    ok = warn == -1 && error >= 0 && ok;
+
+    // busy: INFO floods the bulk queue
+    std::atomic<bool> done(false);
+    fermat::Thread flooder("flooder");
+    flooder.start([&]() {
+        std::string payload(200, 'x');
+        for (int i = 0; i < flood && !done.load(std::memory_order_relaxed); ++i) {
+            LOG_INFO<<i<<' '<<payload;
+        }
+    });
+    fermat::this_thread::sleep_for(fermat::Timespan(20000));
+    LOG_ERROR<<"urgent under load";
+    int64_t busy = wait_for(tail, "urgent under load", 2000000);
+    done.store(true);
+    flooder.join();
+    std::cout<<name<<" busy: error_us "<<busy<<std::endl;
+    ok = busy >= 0 && ok;
+
+    log->stop();
+    log_bench::remove_logs(kPrefix);
+    return ok;
+}
+
+static size_t count_token(const std::string &token)
+{
+    size_t n = 0;
+    std::vector<std::string> files = log_bench::log_files(kPrefix);
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::ifstream in(files[i].c_str());
+        std::string line;
+        while (std::getline(in, line)) {
+            n += line.find(token) != std::string::npos ? 1 : 0;
+        }
+    }
+    return n;
+}
+
+// urgent lines take pool buffers: a flood of them stays under the
+// cap and what does not fit is dropped and counted
+static bool check_cap(fermat::LogAsync::QueueMode mode, const char* name)
+{
+    log_bench::remove_logs(kPrefix);
+    const size_t kBuffer = 4096;
+    const size_t kCap = 8 * kBuffer;
+    const int kThreads = 4;
+    const int kLines = 50000;
+    fermat::LogAsync *log = new fermat::LogAsync("./log/priority_cap", 1024 * 1024 * 1024, 3, mode);
+    fermat::LogOutputPtr out(log);
+    log->set_buffer_size(kBuffer);
+    log->set_max_buffer_bytes(kCap);
+    log->set_overflow_policy(fermat::LogAsync::eOverflowDrop);
+    log->start();
+    fermat::Logging::set_output(out);
+    std::atomic<int> running(kThreads);
+    std::vector<fermat::Thread*> ths;
+    for (int t = 0; t < kThreads; ++t) {
+        fermat::Thread *th = new fermat::Thread("urgent");
+        th->start([&running]() {
+            std::string payload(100, 'e');
+            for (int i = 0; i < kLines; ++i) {
+                LOG_ERROR<<"urgent flood "<<i<<' '<<payload;
+            }
+            running.fetch_sub(1);
+        });
+        ths.push_back(th);
+    }
+    size_t peak = 0;
+    while (running.load() > 0) {
+        peak = std::max<size_t>(peak, log->stats().queued_bytes);
+    }
+    for (size_t t = 0; t < ths.size(); ++t) {
+        ths[t]->join();
+        delete ths[t];
+    }
+    log->stop();
+    fermat::LogAsyncStats st = log->stats();
+    size_t written = count_token("urgent flood ");
+    std::cout<<name<<" cap: written "<<written<<" dropped "<<st.dropped_lines
+             <<" peak_queued "<<peak<<std::endl;
+    log_bench::remove_logs(kPrefix);
+    return peak <= kCap && written > 0 && written + st.dropped_lines == kThreads * kLines;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "INFO lines of the flood", false, 2000000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    int flood = p.get<int>("number");
+
+    bool ok = check(fermat::LogAsync::eLockedQueue, "locked", flood);
+    ok = check(fermat::LogAsync::eThreadRing, "ring", flood) && ok;
+    ok = check_cap(fermat::LogAsync::eLockedQueue, "locked") && ok;
+    ok = check_cap(fermat::LogAsync::eThreadRing, "ring") && ok;
+    std::cout<<(ok ? "OK" : "FAILED")<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_record.h>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cmath>
+
+// Logs the same lines to a text output and a binary output,
+// decodes the records with LogRecordDecoder and checks both
+// come out byte for byte the same, timestamps aside.
+
+static int failures = 0;
+
+class CaptureOutput : public fermat::LogOutput {
+public:
+    explicit CaptureOutput(bool binary)
+        : fermat::LogOutput("capture"), _binary(binary) {}
+    virtual void puts(const char* buf, size_t len)
+    {
+        lines.push_back(std::string(buf, len));
+    }
+    virtual void flush() {}
+    virtual bool binary() const { return _binary; }
+
+    std::vector<std::string> lines;
+private:
+    bool _binary;
+};
+
+static const char* kCString = "c string";
+
+// one site, so both runs share the prefix
+static void log_all()
+{
+    short s = -12345;
+    unsigned short us = 65535;
+    std::string str("std::string with \"quotes\" and = signs");
+    int local = 0;
+    LOG_INFO<<"ints "<<0<<' '<<-1<<' '<<s<<' '<<us<<' '
+            <<std::numeric_limits<int>::min()<<' '
+            <<std::numeric_limits<int>::max()<<' '
+            <<std::numeric_limits<unsigned int>::max()<<' '
+            <<-1234567890123L<<' '<<std::numeric_limits<long>::min()<<' '
+            <<std::numeric_limits<unsigned long>::max()<<' '
+            <<std::numeric_limits<long long>::min()<<' '
+            <<std::numeric_limits<unsigned long long>::max();
+    LOG_INFO<<"doubles "<<0.0<<' '<<-0.0<<' '<<0.1<<' '<<-2.5<<' '<<1e300<<' '
+            <<-1.7976931348623157e308<<' '<<4.9e-324<<' '<<1.0f / 3<<' '
+            <<std::numeric_limits<double>::infinity()<<' '
+            <<std::nan("");
+    LOG_INFO<<"chars "<<'a'<<'\t'<<'\0'<<'z'<<' '<<true<<' '<<false;
+    LOG_INFO<<"strings "<<kCString<<' '<<str<<' '<<std::string()<<' '
+            <<fermat::StringRef("string ref")<<' '<<std::string("bytes\x01\xff", 7);
+    LOG_INFO<<"pointers "<<static_cast<const void*>(NULL)<<' '
+            <<static_cast<const void*>(&local)<<' '
+            <<reinterpret_cast<const void*>(~static_cast<uintptr_t>(0));
+    LOG_INFO.sprintf("sprintf %d %u %lld %s %.3f %p", -7, 7u, -1099511627776LL,
+                     "text", -3.14159, static_cast<void*>(&local));
+    LOG_INFO.kv("i", -5).kv("u", 5u).kv("b", true).kv("c", 'x')
+            .kv("d", -0.25).kv("p", static_cast<const void*>(&local))
+            .kv("s", "plain").kv("q", "with blank").kv("e", "")
+            .kv("j", std::string("a=\"b\"")) << "fields";
+}
+
+// the line from the decoded record or as it was put
+static std::vector<std::string> run(bool binary)
+{
+    CaptureOutput *capture = new CaptureOutput(binary);
+    fermat::LogOutputPtr out(capture);
+    fermat::Logging::set_output(out);
+    log_all();
+    if (!binary) {
+        return capture->lines;
+    }
+    std::vector<std::string> lines;
+    fermat::LogRecordDecoder decoder;
+    for (size_t i = 0; i < capture->lines.size(); ++i) {
+        const std::string &record = capture->lines[i];
+        fermat::LogStream::Buffer text;
+        size_t used = decoder.decode(record.data(), record.size(), text);
+        if (used != record.size()) {
+            std::cerr<<"FAILED: record "<<i<<" decoded "<<used<<" of "
+                     <<record.size()<<" bytes"<<std::endl;
+            ++failures;
+        }
+        lines.push_back(std::string(text.data(), text.size()));
+    }
+    return lines;
+}
+
+// drops "YYYYMMDD HH:MM:SS.uuuuuuZ", the only part that differs
+static std::string strip_time(const std::string &line)
+{
+    size_t z = line.find('Z');
+    return z == std::string::npos ? line : line.substr(z + 1);
+}
+
+int main()
+{
+    std::vector<std::string> text = run(false);
+    std::vector<std::string> decoded = run(true);
+    if (text.size() != decoded.size() || text.empty()) {
+        std::cerr<<"FAILED: "<<text.size()<<" text lines, "
+                 <<decoded.size()<<" decoded lines"<<std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (strip_time(text[i]) != strip_time(decoded[i])) {
+            std::cerr<<"FAILED line "<<i<<"\n  text:    "<<text[i]
+                     <<"  decoded: "<<decoded[i];
+            ++failures;
+        }
+    }
+    if (failures) {
+        std::cerr<<failures<<" checks failed"<<std::endl;
+        return 1;
+    }
+    std::cout<<text.size()<<" lines, all passed"<<std::endl;
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <fermat/common/log_retention.h>
+#include <fermat/common/this_thread.h>
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char* kDir = "./log/retention";
+
+static std::string file_name(int i)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s/app.20260101-%06d.log", kDir, i);
+    return name;
+}
+
+static void make_file(const std::string &name, size_t size, time_t mtime)
+{
+    FILE *f = fopen(name.c_str(), "wb");
+    std::string data(size, 'x');
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    struct timeval tv[2] = {{mtime, 0}, {mtime, 0}};
+    ::utimes(name.c_str(), tv);
+}
+
+static size_t count_files()
+{
+    size_t n = 0;
+    DIR *dir = ::opendir(kDir);
+    while (struct dirent *de = ::readdir(dir)) {
+        n += de->d_name[0] != '.';
+    }
+    ::closedir(dir);
+    return n;
+}
+
+static void clean()
+{
+    ::mkdir("./log", 0755);
+    ::mkdir(kDir, 0755);
+    DIR *dir = ::opendir(kDir);
+    while (struct dirent *de = ::readdir(dir)) {
+        if (de->d_name[0] != '.') {
+            ::unlink((std::string(kDir) + "/" + de->d_name).c_str());
+        }
+    }
+    ::closedir(dir);
+}
+
+static bool expect(const char* what, size_t got, size_t want)
+{
+    std::cout<<what<<": "<<got<<std::endl;
+    if (got != want) {
+        std::cout<<"unexpected, want "<<want<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+    time_t now = ::time(NULL);
+
+    // count limit, the files found by the scan count too
+    clean();
+    for (int i = 0; i < 5; ++i) {
+        make_file(file_name(i), 1000, now);
+    }
+    make_file(std::string(kDir) + "/app.overflow.20260101-000000.log", 10, now);
+    make_file(std::string(kDir) + "/other.20260101-000000.log", 10, now);
+    {
+        fermat::LogRetention retention(std::string(kDir) + "/app");
+        retention.set_max_files(3);
+        retention.set_delete_interval(fermat::Timespan(1000));
+        retention.start();
+        make_file(file_name(5), 1000, now);
+        retention.add(file_name(5));
+        retention.stop();
+        ok = expect("count: deleted", retention.stats().deleted_files, 3) && ok;
+        ok = expect("count: files left", count_files(), 5) && ok;
+        ok = expect("count: oldest gone", ::access(file_name(2).c_str(), F_OK) != 0, 1) && ok;
+    }
+
+    // byte and age limits
+    clean();
+    for (int i = 0; i < 4; ++i) {
+        make_file(file_name(i), 1000, i == 0 ? now - 7200 : now);
+    }
+    {
+        fermat::LogRetention retention(std::string(kDir) + "/app");
+        retention.set_max_bytes(2500);
+        retention.set_max_age(fermat::Timespan(3600, 0));
+        retention.set_delete_interval(fermat::Timespan(1000));
+        retention.start();
+        retention.stop();
+        ok = expect("bytes: deleted", retention.stats().deleted_files, 2) && ok;
+        ok = expect("bytes: kept", retention.stats().bytes, 2000) && ok;
+    }
+
+    // a compressed file replaces its original in the index
+    clean();
+    {
+        fermat::LogRetention retention(std::string(kDir) + "/app");
+        retention.set_max_bytes(1500);
+        retention.start();
+        make_file(file_name(0), 1000, now);
+        retention.add(file_name(0));
+        ::unlink(file_name(0).c_str());
+        make_file(file_name(0) + ".gz", 100, now);
+        retention.add(file_name(0) + ".gz");
+        make_file(file_name(1), 1000, now);
+        retention.add(file_name(1));
+        retention.stop();
+        ok = expect("gz: deleted", retention.stats().deleted_files, 0) && ok;
+        ok = expect("gz: bytes", retention.stats().bytes, 1100) && ok;
+    }
+    clean();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/timestamp.h>
+#include <fermat/common/thread.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "log_bench.h"
+
+// Waves of short-lived threads log through LogAsync in eThreadRing
+// mode with a small ring and the blocking policy: every line must
+// be written whole, long ones wrapping around the ring too, and the rings
+// of exited threads are reused, so no more are created than threads
+// run at once. A line larger than the ring is dropped, not waited on.
+
+static int lines_per_thread = 0;
+
+static void runner()
+{
+    std::string wide(3000, 'w');
+    for (int i = 0; i < lines_per_thread; ++i) {
+        if (i % 500 == 0) {
+            LOG_INFO<<"ring churn wide line "<<i<<' '<<wide;
+        } else {
+            LOG_INFO<<"ring churn line "<<i;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("waves", 'w', "waves of threads", false, 20, fermat::range(1, 10000));
+    p.add<int>("threads", 'c', "threads per wave", false, 8, fermat::range(1, 1024));
+    p.add<int>("number", 'n', "lines per thread", false, 5000, fermat::range(1, 10000000));
+    p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    int waves = p.get<int>("waves");
+    int threads = p.get<int>("threads");
+    lines_per_thread = p.get<int>("number");
+
+    log_bench::take_lines("ring_churn.");
+    fermat::LogAsync *la = new fermat::LogAsync("./log/ring_churn", 1024 * 1024 * 1024, 3,
+                                                fermat::LogAsync::eThreadRing);
+    // small enough that producers wait for the backend
+    la->set_ring_size(4096);
+    la->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    fermat::LogOutputPtr out(la);
+    la->start();
+    fermat::Logging::set_output(out);
+
+    fermat::Timestamp start;
+    for (int w = 0; w < waves; ++w) {
+        std::vector<fermat::Thread*> ths;
+        for (int i = 0; i < threads; ++i) {
+            fermat::Thread *t = new fermat::Thread("log_ring");
+            t->start(std::bind(&runner));
+            ths.push_back(t);
+        }
+        for (size_t i = 0; i < ths.size(); ++i) {
+            ths[i]->join();
+            delete ths[i];
+        }
+    }
+    fermat::Timestamp end;
+    LOG_INFO<<"ring churn too wide "<<std::string(10000, 'x');
+    la->stop();
+
+    // and the "Dropped" line of the one too wide
+    size_t expect = static_cast<size_t>(waves) * threads * lines_per_thread + 1;
+    const std::string wide(3000, 'w');
+    size_t torn = 0;
+    size_t got = log_bench::take_lines("ring_churn.", [&](const std::string &line) {
+        if (line.find("ring churn wide line ") != std::string::npos) {
+            torn += line.compare(line.size() - wide.size(), wide.size(), wide) != 0;
+        } else if (line.find("ring churn line ") != std::string::npos) {
+            torn += line.empty() || line[line.size() - 1] < '0' || line[line.size() - 1] > '9';
+        } else {
+            torn += line.find(" Dropped ") == std::string::npos;
+        }
+    });
+    size_t rings = la->ring_count();
+    bool ok = got == expect && torn == 0 && rings <= static_cast<size_t>(threads) + 1 &&
+              la->stats().dropped_lines == 1;
+    std::cout<<"threads: "<<waves * threads
+             <<" rings: "<<rings
+             <<" lines: "<<got<<"/"<<expect
+             <<" torn: "<<torn
+             <<" cost micro_seconds: "<<(end - start)
+             <<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/log_multi_async.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/thread.h>
+#include <fermat/common/this_thread.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "log_bench.h"
+
+static int lines_per_thread = 0;
+
+static void runner()
+{
+    for (int i = 0; i < lines_per_thread; ++i) {
+        LOG_INFO<<"stats line "<<i;
+        if (i % 1000 == 0) {
+            fermat::this_thread::sleep_for(fermat::Timespan(100));
+        }
+    }
+}
+
+// counts the lines of the files starting with prefix and the
+// self-report lines among them, then removes the files
+static size_t count_lines(const std::string &prefix, size_t *reports)
+{
+    *reports = 0;
+    return log_bench::take_lines(prefix, [&](const std::string &line) {
+        if (line.find(" stats: queued_buffers=") != std::string::npos) {
+            ++*reports;
+        }
+    });
+}
+
+static void print(const char* name, const fermat::LogAsyncStats &s)
+{
+    char buf[512];
+    size_t len = s.format(name, buf, sizeof buf);
+    std::cout.write(buf, len);
+}
+
+template <typename OUTPUT>
+static bool run(const std::string &name, OUTPUT *out, int threads)
+{
+    std::string prefix = name + ".";
+    size_t reports = 0;
+    count_lines(prefix, &reports);
+    fermat::LogOutputPtr ptr(out);
+    out->set_report_interval(fermat::Timespan(50 * 1000));
+    out->start();
+    fermat::Logging::set_output(ptr);
+
+    std::vector<fermat::Thread*> ths;
+    for (int i = 0; i < threads; ++i) {
+        fermat::Thread *t = new fermat::Thread("log_stats");
+        t->start(std::bind(&runner));
+        ths.push_back(t);
+    }
+    for (size_t i = 0; i < ths.size(); ++i) {
+        ths[i]->join();
+        delete ths[i];
+    }
+    // an idle backend still reports
+    fermat::this_thread::sleep_for(fermat::Timespan(120 * 1000));
+    print((name + " running").c_str(), out->stats());
+    out->stop();
+    fermat::LogAsyncStats s = out->stats();
+    print((name + " stopped").c_str(), s);
+
+    uint64_t expect = static_cast<uint64_t>(threads) * lines_per_thread;
+    size_t lines = count_lines(prefix, &reports);
+    bool ok = s.written_lines == expect && s.queued_bytes == 0 &&
+              s.dropped_lines == 0 && lines == expect + reports && reports > 0;
+    std::cout<<name<<": written_lines "<<s.written_lines<<" expect "<<expect
+             <<" file_lines "<<lines<<" reports "<<reports
+             <<(ok ? " OK" : " FAILED")<<std::endl;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("threads", 'c', "logging threads", false, 4, fermat::range(1, 256));
+    p.add<int>("number", 'n', "lines per thread", false, 100000, fermat::range(1, 10000000));
+    p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    int threads = p.get<int>("threads");
+    lines_per_thread = p.get<int>("number");
+
+    static const size_t kRoll = 1024 * 1024 * 1024;
+    fermat::LogAsync *locked = new fermat::LogAsync("./log/stats_locked", kRoll);
+    locked->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    fermat::LogAsync *ring = new fermat::LogAsync("./log/stats_ring", kRoll, 3,
+                                                  fermat::LogAsync::eThreadRing);
+    ring->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    fermat::LogMultiAsync *multi = new fermat::LogMultiAsync("./log/stats_multi", kRoll, 8);
+
+    bool ok = run("stats_locked", locked, threads);
+    ok = run("stats_ring", ring, threads) && ok;
+    ok = run("stats_multi", multi, threads) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+#include <fermat/common/log_stream.h>
+#include <fermat/common/numeric_string.h>
+#include <fermat/common/cmdline.h>
+#include <fermat/common/clock.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <climits>
+#include <new>
+
+// counts every heap allocation of the process
+static size_t alloc_count = 0;
+
+void* operator new(size_t size)
+{
+    ++alloc_count;
+    void *p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// the numeric formatting LogStream used before: a temporary
+// std::string per number. With a copy-on-write std::string
+// (gcc < 5) every one of them is a heap allocation, with SSO
+// only the ones longer than 15 characters are.
+static void legacy_int(fermat::LogStream &s, long long v)
+{
+    std::string ret;
+    fermat::int_to_str(v, 10, ret);
+    s.append(ret.data(), ret.size());
+}
+
+static void legacy_line(fermat::LogStream &s, int i, double d)
+{
+    legacy_int(s, i);
+    s << ' ';
+    legacy_int(s, i * 1000000007LL);
+    s << ' ';
+    {
+        std::string ret;
+        fermat::double_to_str(ret, d);
+        s.append(ret.data(), ret.size());
+    }
+    s << ' ';
+    {
+        std::string ret;
+        fermat::uint_to_str(reinterpret_cast<uintptr_t>(&s), 0x10, ret, true, 18, '0');
+        s.append(ret.data(), ret.size());
+    }
+    s << ' ';
+    legacy_int(s, -i);
+    s << '\n';
+}
+
+static void current_line(fermat::LogStream &s, int i, double d)
+{
+    s << i << ' '
+      << i * 1000000007LL << ' '
+      << d << ' '
+      << static_cast<const void*>(&s) << ' '
+      << -i << '\n';
+}
+
+// a JSON line with kv() members and text to escape, as Logging
+// builds it: the fields and the escaping stay in the stream
+static void json_line(fermat::LogStream &s, int i, double d)
+{
+    s.buffer().append("{\"msg\":\"", 8);
+    s.set_json(true);
+    s.kv("id", i).kv("ratio", d).kv("name", "a \"quoted\" name")
+     .kv("ptr", static_cast<const void*>(&s));
+    s << "text " << i;
+    s.sprintf(" \"%d\"\t", -i);
+    s.finish_json();
+}
+
+template <typename F>
+static size_t bench(const char* name, F fn, int lines)
+{
+    fermat::LogStream stream;
+    size_t before = alloc_count;
+    fermat::Clock begin;
+    for (int i = 0; i < lines; ++i) {
+        stream.reset_bufffer();
+        fn(stream, i, i * 0.25);
+    }
+    fermat::Clock::ClockDiff cost = begin.elapsed();
+    size_t allocs = alloc_count - before;
+    std::cout<<name
+             <<" allocs_per_line: "<<static_cast<double>(allocs) / lines
+             <<" ns_per_line: "<<static_cast<double>(cost) * 1000 / lines
+             <<std::endl;
+    return allocs;
+}
+
+template <typename T>
+static bool check(T v, const char* fmt)
+{
+    char expect[64];
+    snprintf(expect, sizeof(expect), fmt, v);
+    fermat::LogStream s;
+    s << v;
+    std::string got(s.buffer().data(), s.buffer().size());
+    if (got != expect) {
+        std::cout<<"mismatch: got "<<got<<" expect "<<expect<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    fermat::CmdParser p;
+    p.add<int>("number", 'n', "lines to format", false, 1000000, fermat::range(1, 100000000));
+    p.parse_check(argc, argv);
+    int lines = p.get<int>("number");
+
+    bool ok = check(0, "%d") && check(7, "%d") && check(-5, "%d") &&
+        check(INT_MIN, "%d") && check(INT_MAX, "%d") &&
+        check(UINT_MAX, "%u") && check(LLONG_MIN, "%lld") &&
+        check(ULLONG_MAX, "%llu") && check(1234567890123LL, "%lld");
+    if (!ok) {
+        return 1;
+    }
+    bench("legacy ", legacy_line, lines);
+    bench("current", current_line, lines);
+    if (bench("json   ", json_line, lines) != 0) {
+        std::cout<<"json lines allocate"<<std::endl;
+        return 1;
+    }
+    fermat::LogStream s;
+    json_line(s, 7, 0.5);
+    std::string got(s.buffer().data(), s.buffer().size());
+    const char* expect = "{\"msg\":\"text 7 \\\"-7\\\"\\t\",\"id\":7,\"ratio\":0.5,"
+                         "\"name\":\"a \\\"quoted\\\" name\",\"ptr\":\"0x";
+    if (got.compare(0, strlen(expect), expect) != 0 || got[got.size() - 1] != '}') {
+        std::cout<<"json mismatch: "<<got<<std::endl;
+        return 1;
+    }
+    return 0;
+}
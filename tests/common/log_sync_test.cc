@@ -0,0 +1,162 @@
+#include <fermat/common/logging.h>
+#include <fermat/common/log_file.h>
+#include <fermat/common/log_async.h>
+#include <fermat/common/this_thread.h>
+#include <iostream>
+#include <string>
+#include <ctime>
+
+// Checks that LogFile syncs as often as its LogSyncPolicy says,
+// that LogAsync wakes up for an interval sync with no buffer full,
+// and prints what each policy costs per line.
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr<<"FAILED line "<<__LINE__<<": "<<#cond<<std::endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static const std::string kLine(99, 'x');
+
+template <typename WRITER>
+static void test_bytes(const std::string &base)
+{
+    fermat::LogFile<fermat::NullMutex, WRITER> file(base, 1024 * 1024 * 1024);
+    file.set_sync_policy(fermat::LogSyncPolicy::every_bytes(4096));
+    for (int i = 0; i < 100; ++i) {
+        file.append(kLine + "\n");
+    }
+    // 10000 bytes, a sync after each 4096
+    CHECK(file.syncs() == 2);
+    file.flush();
+    CHECK(file.syncs() == 2);
+}
+
+// a batch through append(iov, cnt) is checked too, without a flush
+static void test_bytes_batch()
+{
+    fermat::LogFile<fermat::NullMutex> file("./log/log_sync_batch", 1024 * 1024 * 1024);
+    file.set_sync_policy(fermat::LogSyncPolicy::every_bytes(4096));
+    std::string line = kLine + "\n";
+    struct iovec iov[50];
+    for (int i = 0; i < 50; ++i) {
+        iov[i].iov_base = const_cast<char*>(line.data());
+        iov[i].iov_len = line.size();
+    }
+    for (int i = 0; i < 4; ++i) {
+        file.append(iov, 50);
+    }
+    // four batches of 5000 bytes
+    CHECK(file.syncs() == 4);
+}
+
+static void test_none()
+{
+    fermat::LogFile<fermat::NullMutex> file("./log/log_sync_none", 1024 * 1024 * 1024);
+    for (int i = 0; i < 100; ++i) {
+        file.append(kLine + "\n");
+    }
+    file.flush();
+    CHECK(file.syncs() == 0);
+}
+
+static void test_interval()
+{
+    fermat::LogFile<fermat::NullMutex> file("./log/log_sync_interval", 1024 * 1024 * 1024);
+    file.set_sync_policy(fermat::LogSyncPolicy::every(fermat::Timespan(50 * 1000)));
+    for (int i = 0; i < 60; ++i) {
+        file.append(kLine + "\n");
+        // a backend batch ends with a flush, where the interval is checked
+        file.flush();
+        fermat::this_thread::sleep_for(fermat::Timespan(5 * 1000));
+    }
+    // 300ms of lines, a sync each 50ms
+    CHECK(file.syncs() >= 3);
+    CHECK(file.syncs() <= 7);
+    // nothing new to sync
+    uint64_t syncs = file.syncs();
+    fermat::this_thread::sleep_for(fermat::Timespan(60 * 1000));
+    file.flush();
+    file.flush();
+    CHECK(file.syncs() <= syncs + 1);
+}
+
+static void test_write_behind()
+{
+    fermat::LogFile<fermat::NullMutex> file("./log/log_sync_behind", 1024 * 1024 * 1024);
+    file.set_sync_policy(fermat::LogSyncPolicy::write_behind(0));
+    for (int i = 0; i < 10; ++i) {
+        file.append(kLine + "\n");
+    }
+    CHECK(file.syncs() == 10);
+}
+
+// an idle LogAsync still syncs within the interval, not the flush interval
+static void test_async_interval()
+{
+    fermat::LogAsync *la = new fermat::LogAsync("./log/log_sync_async", 1024 * 1024 * 1024, 3);
+    la->set_sync_policy(fermat::LogSyncPolicy::every(fermat::Timespan(100 * 1000)));
+    fermat::LogOutputPtr out(la);
+    la->start();
+    fermat::Logging::set_output(out);
+    LOG_INFO<<"one line";
+    fermat::this_thread::sleep_for(fermat::Timespan(500 * 1000));
+    fermat::LogAsyncStats st = la->stats();
+    CHECK(st.syncs >= 1);
+    la->stop();
+}
+
+// the cost of a policy per line through LogAsync
+static void bench(const char* name, const fermat::LogSyncPolicy &policy)
+{
+    fermat::LogAsync *la = new fermat::LogAsync(std::string("./log/log_sync_bench_") + name,
+                                                1024 * 1024 * 1024, 3);
+    la->set_overflow_policy(fermat::LogAsync::eOverflowBlock);
+    la->set_sync_policy(policy);
+    fermat::LogOutputPtr out(la);
+    la->start();
+    fermat::Logging::set_output(out);
+    const int lines = 200000;
+    int64_t begin = now_ns();
+    for (int i = 0; i < lines; ++i) {
+        LOG_INFO<<kLine<<i;
+    }
+    la->stop();
+    int64_t ns = now_ns() - begin;
+    fermat::LogAsyncStats st = la->stats();
+    std::cout<<name<<": "<<ns / lines<<" ns/line, "<<st.syncs<<" syncs, "
+             <<st.sync_micro_seconds<<" us syncing"<<std::endl;
+}
+
+int main()
+{
+    test_bytes<fermat::SequenceWriteFile>("./log/log_sync_bytes");
+    test_bytes<fermat::MmapWriteFile>("./log/log_sync_mmap");
+    test_none();
+    test_bytes_batch();
+    test_interval();
+    test_write_behind();
+    test_async_interval();
+
+    bench("none", fermat::LogSyncPolicy());
+    bench("interval", fermat::LogSyncPolicy::every(fermat::Timespan(10 * 1000)));
+    bench("bytes", fermat::LogSyncPolicy::every_bytes(1024 * 1024));
+    bench("behind", fermat::LogSyncPolicy::write_behind(1024 * 1024));
+    if (failures > 0) {
+        std::cerr<<failures<<" checks failed"<<std::endl;
+        return 1;
+    }
+    std::cout<<"log_sync_test passed"<<std::endl;
+    return 0;
+}
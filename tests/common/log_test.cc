@@ -1,75 +1,116 @@
 #include <fermat/common/logging.h>
 #include <fermat/common/log_async.h>
+#include <fermat/common/log_file.h>
 #include <fermat/common/cmdline.h>
 #include <fermat/common/timespan.h>
-#include <fermat/common/timestamp.h>
-#include <fermat/common/thread.h>
+#include <fermat/common/mutex.h>
 #include <iostream>
-#include <atomic>
-#include <vector>
+#include "log_bench.h"
 
 static int long_count = 0;
 static int log_len = 128;
 static int thread_number = 0;
 static std::string type;
+static std::string mode;
+static bool binary = false;
 std::string long_string(512, 'x');
-void runner()
+
+// --type sync: LogFile written on the logging threads
+class SyncOutput : public fermat::LogOutput {
+public:
+    SyncOutput() : fermat::LogOutput("sync_log"), _file("./log/sync", 1024*1024*100) {}
+    virtual void puts(const char* buf, size_t len) { _file.append(buf, len); }
+    virtual void flush() { _file.flush(); }
+private:
+    fermat::LogFile<fermat::Mutex> _file;
+};
+
+// per call latencies, timed by the log_bench harness
+static log_bench::Latencies latencies;
+
+void log_line(int)
 {
-    int cnt = 0;
-    int max = long_count/thread_number;
-    while (cnt < max) {
-        LOG_INFO<<10<<" "
-            <<200<<" "
-            <<"sddf "
-            <<"dfggf "
-            <<long_string;
-            cnt++;
-    }
+    LOG_INFO<<10<<" "
+        <<200<<" "
+        <<"sddf "
+        <<"dfggf "
+        <<long_string;
 }
+
 fermat::Timespan run_test()
 {
     long_string.clear();
     long_string.append(log_len, 'x');
-    std::vector<fermat::Thread*> ths;
-    fermat::Timestamp start;
-    fermat::LogOutputPtr alogger(new fermat::LogAsync("./log/async", 1024*1024*100));
-    fermat::LogAsync *la = (fermat::LogAsync*)alogger.get();
-    la->start();
-    if(!alogger) {
-        exit(-0);
+    latencies.clear();
+    int64_t begin = log_bench::now_ns();
+    fermat::LogAsync::QueueMode qmode = mode == "ring" ?
+        fermat::LogAsync::eThreadRing : fermat::LogAsync::eLockedQueue;
+    fermat::LogOutputPtr alogger;
+    fermat::LogAsync *la = NULL;
+    if (type == "async") {
+        la = new fermat::LogAsync("./log/async", 1024*1024*100, 3, qmode);
+        alogger.reset(la);
+        la->set_binary(binary);
+        la->start();
+    } else if (type == "sync") {
+        alogger.reset(new SyncOutput());
     }
-    fermat::Logging::set_output(alogger);
-    for(int i = 0; i < thread_number; i++) {
-        fermat::Thread *t = new fermat::Thread("log_test");
-        t->start(std::bind(&runner));
-        ths.push_back(t);
+    // stdout keeps the default output
+    if (alogger) {
+        fermat::Logging::set_output(alogger);
     }
-    
-    for(int i = 0; i < thread_number; i++) {
-        fermat::Thread *t = ths[i];
-        t->join();
-        delete t;
+    log_bench::run_producers(thread_number, long_count / thread_number, &log_line, &latencies);
+    int64_t end = log_bench::now_ns();
+    if (la) {
+        la->stop();
+    } else if (alogger) {
+        alogger->flush();
     }
-    fermat::Timestamp end;
-    la->stop();
-    return fermat::Timespan(end - start);
+    return fermat::Timespan((end - begin) / 1000);
+}
+
+void report(const fermat::Timespan &span)
+{
+    std::cout<<"type: "<<type
+            <<" mode: "<<mode
+            <<" threads: "<<thread_number
+            <<" cost micro_seconds: "<<span.total_micro_seconds();
+    if (latencies.size() > 0) {
+        std::cout<<" p50_ns: "<<latencies.percentile(0.50)
+                <<" p99_ns: "<<latencies.percentile(0.99)
+                <<" max_ns: "<<latencies.max();
+    }
+    std::cout<<std::endl;
 }
 
 int main(int argc, char** argv)
 {
     fermat::CmdParser p;
     p.add<int>("number", 'n', "log number [1, 20]", false, 10000000,fermat::range(1, 100000000));
-    p.add<int>("client", 'c', "thread number [1, 20]", false, 10,fermat::range(1, 20));
+    p.add<int>("client", 'c', "thread number [1, 64]", false, 10,fermat::range(1, 64));
     p.add<int>("loglen", 's', "log long [1, 4096]", false, 40,fermat::range(1, 4096));
     p.add<std::string>("type", 't', "log sync  type", false, "async", fermat::oneof<std::string>("async", "sync", "stdout"));
+    p.add<std::string>("mode", 'm', "async queue mode", false, "locked", fermat::oneof<std::string>("locked", "ring"));
+    p.add("binary", 'b', "log binary records, formatted by the backend thread");
+    p.add("sweep", 'w', "run the contention sweep at 1, 4, 16 and 64 threads");
     p.parse_check(argc, argv);
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
     long_count = p.get<int>("number");
     thread_number = p.get<int>("client");
     type = p.get<std::string>("type");
+    mode = p.get<std::string>("mode");
     log_len = p.get<int>("loglen");
-    fermat::Timespan span = run_test();
-    std::cout<<"cost micro_seconds: "
-            <<span.total_micro_seconds()
-            <<std::endl;
+    binary = p.exist("binary");
+    if (p.exist("sweep")) {
+        static const int kThreads[] = {1, 4, 16, 64};
+        for (size_t i = 0; i < sizeof(kThreads) / sizeof(kThreads[0]); ++i) {
+            thread_number = kThreads[i];
+            report(run_test());
+        }
+        return 0;
+    }
+    report(run_test());
     return 0;
 }
@@ -0,0 +1,128 @@
+#include <fermat/common/log_file.h>
+#include <fermat/common/sequence_write_file.h>
+#include <fermat/common/this_thread.h>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "log_bench.h"
+
+// Checks the writev(2) paths: SequenceWriteFile::append(iovec)
+// with more than IOV_MAX buffers, and LogFile::append(iov, cnt)
+// rolling to a new file in the middle of a batch.
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr<<"FAILED line "<<__LINE__<<": "<<#cond<<std::endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+// fixed size lines, kLineSize bytes each
+static const size_t kLineSize = 15;
+
+static std::vector<std::string> make_lines(int count)
+{
+    std::vector<std::string> lines;
+    lines.reserve(count);
+    char buf[32];
+    for (int i = 0; i < count; ++i) {
+        snprintf(buf, sizeof buf, "writev %07d\n", i);
+        lines.push_back(buf);
+    }
+    return lines;
+}
+
+static std::vector<struct iovec> make_iov(const std::vector<std::string> &lines)
+{
+    std::vector<struct iovec> iov(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        iov[i].iov_base = const_cast<char*>(lines[i].data());
+        iov[i].iov_len = lines[i].size();
+    }
+    return iov;
+}
+
+static std::string join(const std::vector<std::string> &lines, size_t begin, size_t end)
+{
+    std::string s;
+    for (size_t i = begin; i < end; ++i) {
+        s += lines[i];
+    }
+    return s;
+}
+
+// more than IOV_MAX buffers in one call, in order and complete
+static void test_sequence_iov()
+{
+    const char* name = "./log/log_writev_seq.log";
+    ::remove(name);
+    std::vector<std::string> lines = make_lines(3 * IOV_MAX + 7);
+    std::vector<struct iovec> iov = make_iov(lines);
+    {
+        fermat::SequenceWriteFile file(name);
+        // a buffered line ahead of the batch is written first
+        file.append("head\n", 5);
+        CHECK(file.append(&iov[0], static_cast<int>(iov.size())));
+        CHECK(file.write_size() == 5 + lines.size() * kLineSize);
+        file.flush();
+    }
+    std::string got = log_bench::read_file(name);
+    CHECK(got == "head\n" + join(lines, 0, lines.size()));
+    std::cout<<"sequence: "<<iov.size()<<" iovecs, "<<got.size()<<" bytes"<<std::endl;
+}
+
+// a batch passing the roll size is split after the buffer crossing it
+static void test_log_file_roll()
+{
+    const std::string base = "log_writev_roll";
+    std::vector<std::string> old = log_bench::log_files(base + ".");
+    for (size_t i = 0; i < old.size(); ++i) {
+        ::remove(old[i].c_str());
+    }
+    const int count = 3000;
+    // the 2001st line passes the roll size
+    const size_t rollSize = 2000 * kLineSize + 7;
+    const size_t split = rollSize / kLineSize + 1;
+    std::vector<std::string> lines = make_lines(count);
+    std::vector<struct iovec> iov = make_iov(lines);
+    {
+        fermat::LogFile<fermat::NullMutex> file("./log/" + base, rollSize);
+        // a file rolls at most once a second
+        fermat::this_thread::sleep_for(fermat::Timespan(1100 * 1000));
+        file.append(&iov[0], count);
+        file.flush();
+    }
+    std::vector<std::string> files = log_bench::log_files(base + ".");
+    CHECK(files.size() == 2);
+    if (files.size() != 2) {
+        return;
+    }
+    std::string first = log_bench::read_file(files[0]);
+    std::string second = log_bench::read_file(files[1]);
+    CHECK(first.size() == split * kLineSize);
+    CHECK(first == join(lines, 0, split));
+    CHECK(second == join(lines, split, count));
+    std::cout<<"roll: "<<files[0]<<" "<<first.size()<<" bytes, "
+             <<files[1]<<" "<<second.size()<<" bytes"<<std::endl;
+}
+
+int main()
+{
+    if (!log_bench::make_log_dir()) {
+        return 1;
+    }
+    test_sequence_iov();
+    test_log_file_roll();
+    if (failures) {
+        std::cerr<<failures<<" checks failed"<<std::endl;
+        return 1;
+    }
+    std::cout<<"all passed"<<std::endl;
+    return 0;
+}